@@ -15,402 +15,9980 @@
     The exercise corresponds to the implementation of Designing a Virtual Memory Manager presented on page P-51 of the book Operating System Concepts, Silberschatz,
     A. et al, 10th edition. However, some modifications follow:
 
-        - The implementation is one in which the physical memory has only 128 frames;
-        - Two page replacement algorithms have been implemented, namely fifo and lru, while only fifo will be used in TLB.
+        - The implementation is one in which the physical memory has 128 frames by default (configurable with --frames);
+        - Several page replacement algorithms have been implemented: fifo, lru, cflru (clean-first lru), clock, esc
+          (enhanced second chance), lfu, arc and opt (Belady's optimal, as a lower bound), while the TLB uses fifo by
+          default;
+        - The page size (256 bytes to 2 MiB), virtual address width (up to 64 bits), frame count and TLB size are runtime
+          options; the defaults are the book's 16-bit address space with 256-byte pages;
+        - The page table is flat, a 2-4 level radix tree allocated on demand or an inverted table hashed on
+          (asid, page number); page walks on TLB misses are charged a configurable latency per memory reference;
+        - The TLB size, associativity (fully associative, N-way set-associative or direct-mapped) and replacement
+          (fifo, lru or random) are configurable;
+        - An optional inclusive or exclusive L2 TLB is probed on L1 misses, and the report estimates the average memory
+          access time from per-level latencies;
+        - Hot, fully resident aligned regions can be promoted to huge pages, each mapped by one entry of a separate or
+          unified huge-page TLB; the report shows the TLB reach and the hit rate against base pages only;
+        - Traces may tag addresses with a process id: processes get their own page tables and counters, TLB entries are
+          ASID-tagged (or flushed on every switch), and frames are replaced globally or from per-process partitions;
+        - Working-set and page-fault-frequency allocation grow and shrink each process's resident set, and an optional
+          interval time series reports fault and TLB hit rates, resident frames, evictions and thrashing, in the report or
+          streamed to a CSV or binary file by a background writer;
+        - Faults can prefetch further pages predicted by sequential read-ahead, a stride detector or a next-miss (Markov)
+          table; prefetched pages are inserted at the lowest replacement priority;
+        - Trace accesses can be writes, which dirty their frame; dirty victims are written back in batches, to private
+          copies or (--writable-store) into the backing store file;
+        - --async-io reads the pages of upcoming faults ahead of time through io_uring (or a thread pool), with results
+          identical to synchronous reads;
+        - --zswap-pool keeps evicted pages LZ4-compressed in a bounded in-memory pool, so refaults on them cost a
+          decompression instead of a backing-store read;
+        - A sweep runs every combination of several algorithms, frame counts and TLB sizes in parallel over one parse
+          of the trace and prints a single results table;
+        - --mrc computes the LRU miss-ratio curve for every memory and TLB size in one stack-distance pass;
+        - --sample estimates the fault and TLB hit rates, with 95% error bounds, from a hash-selected subset of pages
+          (SHARDS) or from periodic windows, and --warm-up simulates a prefix without measuring it;
+        - --checkpoint-at saves the whole simulator state at an access index and --restore resumes from it, mapping
+          the saved physical memory copy-on-write;
+        - --cpus runs several simulated CPUs on their own threads, with private TLBs over a sharded page table and a
+          concurrent CLOCK, and charges TLB shootdowns as IPIs;
+        - --generate writes seeded synthetic traces (uniform, Zipfian, scans, strides, loops and phase mixtures), and
+          --bench appends a CSV or JSON timing record of a run; make bench runs every policy over them;
+        - --reference runs a slow, linear-scan reference engine; make check compares the main engine with it and with
+          the golden outputs;
+        - make instrument builds a variant with per-phase timers, fault-latency and TLB-probe-depth histograms and
+          perf_event_open hardware counters in the report.
 
     Example Usage:
         make && ./vm address.txt fifo
         make && ./vm address.txt lru
+        make && ./vm address.txt clock
+        make && ./vm address.txt lru --tlb-size 64 --tlb-ways 4 --tlb-replacement lru
+        make && ./vm address.txt --convert-trace address.bin && ./vm address.bin fifo
+        make && ./vm address.bin lru --stats-only --output -
+        make && ./vm address.txt lru --frames 4096
+        make && ./vm address.txt lru --page-size 4K --va-bits 32 --frames 1024
+        make && ./vm address.txt lru --page-size 4K --va-bits 48 --page-table radix --extended-stats
+        make && ./vm address.txt lru --tlb-size 16 --l2-tlb-size 256 --l2-tlb-ways 4 --tlb-inclusion exclusive
+        make && ./vm address.txt fifo --backing-store /path/to/BACKING_STORE.bin
+        make && ./vm address.txt lru --backing-store /mnt/nvme/BACKING_STORE.bin --async-io uring --io-depth 64
+        make && ./vm zipf.bin lru --va-bits 32 --page-size 4K --frames 512 --zswap-pool 1M --zswap-latency 3000
+        make && ./vm processes.txt lru --frame-allocation local --processes 4
+        make && ./vm processes.txt lru --frame-allocation ws --ws-window 5000 --interval 10000
+        make && ./vm address.txt fifo,lru,opt --frames 16,32,64,128 --tlb-size 16,64 --output -
+        make && ./vm address.txt lru --prefetch sequential --prefetch-degree 8
+        make && ./vm address.txt lru --frames 256 --huge-page-size 4K --huge-tlb-size 16
+        make && ./vm writes.txt cflru --writable-store --writeback-batch 64
+        make && ./vm address.txt --mrc --output -
+        make && ./vm zipf.bin clock --va-bits 32 --frames 4096 --tlb-size 64 --cpus 8 --output -
+        make && ./vm zipf.bin --generate zipf --trace-length 4M --va-bits 32 --page-size 4K
+        make bench BENCH_FORMAT=json
+        make check
+        make instrument && ./vm_instrument address.txt lru --stats-only --output -
 */
 
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING 1
+#endif
+#if defined(VM_INSTRUMENT) && defined(__NR_perf_event_open)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#define HAVE_PERF_EVENTS 1
+#endif
+#endif
 
-#define MAX_ADDRESS_LENGTH 10
 #define PAGE_NUMBER_BITS 8
 #define OFFSET_BITS 8
+#define MIN_OFFSET_BITS 8
+#define MAX_OFFSET_BITS 21
+#define MAX_VIRTUAL_ADDRESS_BITS 64
+#define MAX_FLAT_PAGE_TABLE_BITS 30
 #define PHYSICAL_MEMORY_FRAMES 128
-#define NUMBER_OF_PAGES 256
-#define PAGE_SIZE 256
-#define FRAME_SIZE PAGE_SIZE
+#define MAX_PHYSICAL_MEMORY_FRAMES (1 << 20)
 #define TLB_SIZE 16
-#define INT_MAX 2147483647
+#define MAX_TLB_SIZE 65536
+#define DEFAULT_BACKING_STORE "BACKING_STORE.bin"
+#define DEFAULT_OUTPUT_FILE "correct.txt"
+#define ADDRESS_CHUNK_SIZE 65536
+#define MAX_PROCESSES 65536
+#define DEFAULT_WORKING_SET_WINDOW 1000
+#define DEFAULT_PFF_THRESHOLD 100
+#define DEFAULT_THRASHING_FAULT_RATE 0.25
+#define DEFAULT_PREFETCH_DEGREE 4
+#define MAX_PREFETCH_DEGREE 64
 
-int page_table[NUMBER_OF_PAGES];
+/*
+    Instrumentation, compiled in with -DVM_INSTRUMENT (make instrument builds it as vm_instrument). Timers around the
+    trace decoder, the TLB probe, the page-table lookup, victim selection and backing-store I/O add up calls and ticks
+    per phase; whole page faults are also timed into a log2 histogram of their latency, and every TLB probe records its
+    depth (the way it hit in, plus one, or every way of the set on a miss) into another. Ticks are the TSC on x86 and
+    nanoseconds elsewhere, and are converted to time against the monotonic clock over the run. perf_counters_start and
+    perf_counters_stop bracket the run with perf_event_open hardware counters where the kernel allows them. The counts
+    are per thread, and are reported for single runs only. Without VM_INSTRUMENT every macro below is empty.
+*/
+#ifdef VM_INSTRUMENT
+#define HISTOGRAM_BUCKETS 48
 
-typedef struct Address
+enum
 {
-    int virtual_address;
-    int page_number;
-    int offset;
-    struct Address *next;
-} Address;
+    PHASE_PARSE,
+    PHASE_TLB_PROBE,
+    PHASE_PAGE_TABLE,
+    PHASE_VICTIM,
+    PHASE_STORE_IO,
+    PHASE_PAGE_FAULT,
+    PHASE_COUNT
+};
 
-typedef struct Frame
-{
-    char data[PAGE_SIZE];
-    int frame_number;
-    int last_used;
-    struct Frame *next;
-} Frame;
+const char *phase_names[] = {"Parse", "TLB Probe", "Page Table Lookup", "Victim Selection", "Backing Store I/O", "Page Fault"};
 
-typedef struct TLB_elements
+typedef struct Instrumentation
 {
-    int page_number;
-    int frame_number;
-} TLB_elements;
+    unsigned long long calls[PHASE_COUNT];
+    unsigned long long ticks[PHASE_COUNT];
+    unsigned long long fault_latency[HISTOGRAM_BUCKETS]; /* bucket b counts 2^(b-1) to 2^b - 1 ticks, 0 counts 0 */
+    unsigned long long probe_depth[HISTOGRAM_BUCKETS];
+    unsigned long long start_ticks;
+    struct timespec start_time;
+    double ns_per_tick; /* measured over the run */
+} Instrumentation;
+
+static __thread Instrumentation instrumentation;
 
-TLB_elements TLB[TLB_SIZE];
+static inline unsigned long long instrument_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
 
-int page_fault_counter = 0;
-int next_victim_frame = 0;
-int total_translated_addresses = 0;
-int tlb_hit_counter = 0;
-int next_tlb_entry = 0;
-int current_time = 0;
+static inline int histogram_bucket(unsigned long long value)
+{
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
 
-void insert_address(Address **address_head, int virtual_address, int page_number, int offset)
+static inline void instrument_record(int phase, unsigned long long start)
 {
-    Address *new = (Address *)malloc(sizeof(Address));
-    if (new != NULL)
+    unsigned long long ticks = instrument_ticks() - start;
+
+    instrumentation.calls[phase]++;
+    instrumentation.ticks[phase] += ticks;
+    if (phase == PHASE_PAGE_FAULT)
     {
-        new->virtual_address = virtual_address;
-        new->page_number = page_number;
-        new->offset = offset;
-        new->next = NULL;
+        instrumentation.fault_latency[histogram_bucket(ticks)]++;
+    }
+}
 
-        if (*address_head == NULL)
-        {
-            *address_head = new;
-        }
-        else
+/* Hardware counters over the run: -1 descriptors are events the kernel or CPU does not offer (or perf is not allowed). */
+#define PERF_COUNTERS 4
+
+const char *perf_counter_names[PERF_COUNTERS] = {"Cycles", "Instructions", "Cache Misses", "dTLB Load Misses"};
+
+typedef struct Perf_counters
+{
+    int fds[PERF_COUNTERS];
+    long long values[PERF_COUNTERS];
+    int opened;
+    int error; /* errno of the first failed open, 0 if all opened */
+} Perf_counters;
+
+static __thread Perf_counters perf_counters;
+
+void perf_counters_start(Perf_counters *counters)
+{
+    for (int i = 0; i < PERF_COUNTERS; i++)
+    {
+        counters->fds[i] = -1;
+        counters->values[i] = -1;
+    }
+    counters->opened = 0;
+    counters->error = 0;
+#ifdef HAVE_PERF_EVENTS
+    static const unsigned int types[PERF_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+    static const unsigned long long configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    for (int i = 0; i < PERF_COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fds[i] < 0)
         {
-            Address *temp = *address_head;
-            while (temp->next != NULL)
-            {
-                temp = temp->next;
-            }
-            temp->next = new;
+            counters->error = counters->error != 0 ? counters->error : errno;
+            continue;
         }
+        counters->opened++;
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
     }
+#else
+    counters->error = ENOSYS;
+#endif
 }
 
-void create_frame(Frame **frame_head, char data[], int frame_number)
+void perf_counters_stop(Perf_counters *counters)
 {
-    Frame *new = (Frame *)malloc(sizeof(Frame));
-    if (new != NULL)
+    for (int i = 0; i < PERF_COUNTERS; i++)
     {
-        memcpy(new->data, data, PAGE_SIZE * sizeof(char));
-        new->frame_number = frame_number;
-        new->last_used = 0;
-        new->next = NULL;
-
-        if (*frame_head == NULL)
+        if (counters->fds[i] < 0)
         {
-            *frame_head = new;
+            continue;
         }
-        else
+#ifdef HAVE_PERF_EVENTS
+        ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+        if (read(counters->fds[i], &counters->values[i], sizeof(counters->values[i])) != (ssize_t)sizeof(counters->values[i]))
         {
-            Frame *temp = *frame_head;
-            while (temp->next != NULL)
-            {
-                temp = temp->next;
-            }
-            temp->next = new;
+            counters->values[i] = -1;
         }
+        close(counters->fds[i]);
+        counters->fds[i] = -1;
     }
 }
 
-void init_physical_memory(Frame **head)
+/* Brackets the main loop of a single run. */
+void instrument_begin_run(void)
 {
-    char initial_data[PAGE_SIZE] = {0};
-    for (int i = 0; i < PHYSICAL_MEMORY_FRAMES; i++)
-    {
-        create_frame(head, initial_data, i);
-    }
+    memset(&instrumentation, 0, sizeof(instrumentation));
+    clock_gettime(CLOCK_MONOTONIC, &instrumentation.start_time);
+    instrumentation.start_ticks = instrument_ticks();
+    perf_counters_start(&perf_counters);
+}
+
+void instrument_end_run(void)
+{
+    struct timespec now;
+
+    perf_counters_stop(&perf_counters);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - instrumentation.start_time.tv_sec) + (now.tv_nsec - instrumentation.start_time.tv_nsec) / 1e9;
+    unsigned long long ticks = instrument_ticks() - instrumentation.start_ticks;
+    instrumentation.ns_per_tick = ticks > 0 ? seconds * 1e9 / ticks : 0;
+}
+
+#define INSTRUMENT_START(timer) unsigned long long timer = instrument_ticks()
+#define INSTRUMENT_STOP(phase, timer) instrument_record(phase, timer)
+#define INSTRUMENT_PROBE_DEPTH(depth) (instrumentation.probe_depth[histogram_bucket(depth)]++)
+#define INSTRUMENT_BEGIN_RUN() instrument_begin_run()
+#define INSTRUMENT_END_RUN() instrument_end_run()
+#else
+#define INSTRUMENT_START(timer) ((void)0)
+#define INSTRUMENT_STOP(phase, timer) ((void)0)
+#define INSTRUMENT_PROBE_DEPTH(depth) ((void)0)
+#define INSTRUMENT_BEGIN_RUN() ((void)0)
+#define INSTRUMENT_END_RUN() ((void)0)
+#endif
+
+/*
+    Address-space geometry, fixed at startup. The shifts and masks used on the hot path are precomputed here: a virtual
+    address splits into page number (va >> offset_bits) & page_mask and offset va & offset_mask.
+*/
+typedef struct Geometry
+{
+    int offset_bits;
+    int virtual_address_bits;
+    size_t page_size;
+    unsigned long long offset_mask;
+    unsigned long long page_mask;
+    unsigned long long number_of_pages;
+    int page_number_bits;
+    unsigned int asid_limit;
+} Geometry;
+
+Geometry geometry;
+
+#define NO_PAGE (~0ULL)
+
+/*
+    Pages of different processes are told apart by a key that puts the ASID above the page-number bits. The TLB tags,
+    the replacement policies and the frame reverse map all work on keys; with a single process a key is just the page
+    number. init_geometry limits ASIDs so that a key never reaches the top bit and cannot collide with NO_PAGE.
+*/
+static inline unsigned long long page_key(unsigned int asid, unsigned long long page_number)
+{
+    return page_number | ((unsigned long long)asid << geometry.page_number_bits);
 }
 
-void init_page_table()
+
+/*
+    The backing store is opened once at startup and kept mapped for the whole run, so filling a frame on a page fault
+    is a memcpy out of the mapping. If the file cannot be mapped, every fault falls back to a single pread. It is
+    read-only unless --writable-store asks for write-backs to reach the file (see the write-back section).
+*/
+typedef struct Backing_store
+{
+    int fd;
+    char *map;
+    size_t size;
+} Backing_store;
+
+Backing_store backing_store = {-1, NULL, 0};
+int writable_store = 0;
+
+typedef struct Address
+{
+    unsigned long long virtual_address;
+    unsigned long long page_number;
+    unsigned long long offset;
+    unsigned int process;
+    int write;
+} Address;
+
+/*
+    The TLB is split into sets of ways entries each: ways == size is fully associative, ways == 1 is direct-mapped. A
+    page can only live in set (page_number mod sets), so a lookup probes at most ways entries. Way i of set s is
+    reported in the output as TLB index s * ways + i. Entries are tagged with the page key, so the ASID is part of the
+    tag and entries of different processes can live side by side; --tlb-flush-on-switch models an untagged TLB instead.
+
+    Entries are kept as structure-of-arrays: the tags of a set are packed together (padded to
+    TLB_TAG_BLOCK so vector loads never straddle into the next set), separately from the frame numbers and use
+    stamps, so the tag probe can compare a whole block of tags at once.
+*/
+#define TLB_INVALID_TAG (~0ULL)
+#define TLB_TAG_BLOCK 4
+
+enum
+{
+    TLB_REPLACEMENT_FIFO,
+    TLB_REPLACEMENT_LRU,
+    TLB_REPLACEMENT_RANDOM
+};
+
+const char *tlb_replacement_names[] = {"fifo", "lru", "random"};
+
+typedef struct Tlb_probe Tlb_probe;
+
+typedef struct Tlb
+{
+    unsigned long long *tags;
+    int *frames;
+    unsigned long long *last_used;
+    int *next_entry;
+    int size;
+    int ways;
+    int stride;
+    int sets;
+    int set_mask;
+    int replacement;
+    unsigned long long clock;
+    unsigned int random_state;
+    Tlb_probe *probe;
+} Tlb;
+
+/*
+    Everything a simulation run changes lives in a Simulator, so several configurations can run side by side over the
+    same trace (see run_sweep). What stays global is fixed for the whole program: the geometry, the backing store, the
+    page-table type and the reporting options.
+
+    Physical memory is a single page-aligned arena indexed by frame number; frame metadata lives in parallel arrays
+    so translating a frame number to its data is a multiply instead of a list walk.
+*/
+typedef struct Replacement_policy Replacement_policy;
+typedef struct Frame_pool Frame_pool;
+typedef struct Process Process;
+typedef struct Page_reader Page_reader;
+typedef struct Store_writer Store_writer;
+typedef struct Huge_pages Huge_pages;
+typedef struct Page_map Page_map;
+typedef struct Interval_writer Interval_writer;
+typedef struct Zswap_pool Zswap_pool;
+
+/* One interval of the time series: the whole machine (asid INTERVAL_ALL_PROCESSES) or a single process. */
+#define INTERVAL_ALL_PROCESSES (~0u)
+
+typedef struct Interval_sample
+{
+    unsigned long long index;
+    unsigned long long accesses;
+    unsigned long long page_faults;
+    unsigned long long tlb_hits;
+    unsigned long long evictions; /* frames taken away, by replacement or release */
+    unsigned int asid;
+    int resident_frames;
+    int thrashing;
+    unsigned int reserved; /* keeps the record free of implicit padding for --interval-format binary */
+} Interval_sample;
+
+typedef struct Simulator
+{
+    Replacement_policy *policy;
+    int frame_allocation;
+    int tlb_flush_on_switch;
+
+    char *physical_memory;
+    unsigned long long *frame_page; /* reverse map: key of the page currently held by each frame, or NO_PAGE */
+    int physical_memory_frames;
+
+    Tlb tlb;
+    Tlb l2_tlb;               /* size 0 unless --l2-tlb-size */
+    unsigned long long l2_tlb_hit_counter;
+    Huge_pages *huge_pages;   /* NULL unless --huge-page-size */
+    Page_reader *page_reader; /* NULL unless --async-io */
+
+    /* Writes: frame_dirty marks frames written since they were loaded, which are written back when they leave memory. */
+    unsigned char *frame_dirty;
+    Store_writer *store_writer;
+    unsigned long long write_accesses;
+    unsigned long long dirty_evictions;
+    unsigned long long writeback_batches;
+    unsigned long long bytes_written;
+    unsigned long long dirty_frames_at_exit;
+    Zswap_pool *zswap;                  /* NULL unless --zswap-pool */
+    unsigned long long zswap_fault_hits;    /* demand faults served from the pool */
+    unsigned long long zswap_reads_avoided; /* of those, the ones with no read of the page already in flight */
+
+    Process *processes;
+    unsigned int process_limit;
+    Process *current_process;
+    unsigned int current_asid;
+    Frame_pool *frame_pools;
+    int frame_pool_count;
+    void *shared_page_table;
+
+    /* Index of the access being translated, and for OPT the index of the next access to the same page. */
+    unsigned long long current_access;
+    const unsigned long long *next_use;
+
+    /*
+        Resident sets. Working-set and PFF allocation keep each process's frames on a list in order of last use (in
+        the process's own virtual time), threaded through resident_prev/next; frame_last_use is NULL otherwise.
+    */
+    int working_set_window;
+    int pff_threshold;
+    unsigned long long *frame_last_use;
+    int *resident_prev;
+    int *resident_next;
+    int resident_frames;
+    int peak_resident_frames;
+    unsigned long long resident_sum;
+    unsigned long long released_frames;
+    unsigned long long replacement_evictions;
+
+    /*
+        Prefetching: after a demand fault, up to prefetch_degree predicted pages are read too. frame_prefetched marks
+        frames holding a prefetched page that has not been used yet (NULL when prefetching is off).
+    */
+    int prefetch;
+    int prefetch_degree;
+    unsigned char *frame_prefetched;
+    Page_map *next_fault; /* Markov predictor: key -> key of the miss that last followed it */
+    unsigned long long prefetch_reads;
+    unsigned long long prefetch_hits;
+
+    /* Interval time series, recorded every interval_length accesses when it is non-zero. */
+    int interval_length;
+    int interval_position;
+    double thrashing_threshold;
+    unsigned long long interval_start_faults;
+    unsigned long long interval_start_tlb_hits;
+    unsigned long long interval_start_evictions;
+    unsigned int *active_processes;
+    unsigned int active_process_count;
+    Interval_sample *intervals;
+    size_t interval_count;
+    size_t interval_capacity;
+    Interval_writer *interval_writer; /* streams the samples instead of keeping them, see --interval-output */
+    unsigned long long thrashing_intervals;
+
+    unsigned long long page_fault_counter;
+    unsigned long long total_translated_addresses;
+    unsigned long long tlb_hit_counter;
+    unsigned long long page_walk_counter;
+    unsigned long long page_walk_references;
+    unsigned long long context_switch_counter;
+    unsigned long long tlb_flush_counter;
+} Simulator;
+
+/* The per-configuration knobs a Simulator is built from; everything else comes from the global options. */
+typedef struct Simulator_config
+{
+    Replacement_policy *policy;
+    int frames;
+    int tlb_size;
+    int tlb_ways;
+    int tlb_replacement;
+    const char *tlb_probe_name;
+    int frame_allocation;
+    int process_count;
+    int tlb_flush_on_switch;
+    int working_set_window;
+    int pff_threshold;
+    int interval_length;
+    double thrashing_threshold;
+    int prefetch;
+    int prefetch_degree;
+} Simulator_config;
+
+int init_geometry(int offset_bits, int virtual_address_bits)
 {
-    for (int i = 0; i < NUMBER_OF_PAGES; i++)
+    if (offset_bits < MIN_OFFSET_BITS || offset_bits > MAX_OFFSET_BITS)
+    {
+        printf("Error: page size must be a power of two between %d and %d bytes\n", 1 << MIN_OFFSET_BITS, 1 << MAX_OFFSET_BITS);
+        return -1;
+    }
+    if (virtual_address_bits <= offset_bits || virtual_address_bits > MAX_VIRTUAL_ADDRESS_BITS)
     {
-        page_table[i] = -1;
+        printf("Error: virtual addresses must be wider than the page offset and at most %d bits\n", MAX_VIRTUAL_ADDRESS_BITS);
+        return -1;
     }
+
+    int page_number_bits = virtual_address_bits - offset_bits;
+    geometry.offset_bits = offset_bits;
+    geometry.virtual_address_bits = virtual_address_bits;
+    geometry.page_size = (size_t)1 << offset_bits;
+    geometry.offset_mask = geometry.page_size - 1;
+    geometry.page_mask = page_number_bits >= 64 ? ~0ULL : (1ULL << page_number_bits) - 1;
+    geometry.number_of_pages = geometry.page_mask + 1;
+    geometry.page_number_bits = page_number_bits;
+    geometry.asid_limit = page_number_bits >= 48 ? 1u << (63 - page_number_bits) : MAX_PROCESSES;
+    return 0;
+}
+
+static inline char *frame_data(Simulator *simulator, int frame_number)
+{
+    return simulator->physical_memory + ((size_t)frame_number << geometry.offset_bits);
 }
 
-void init_tlb()
+int init_physical_memory(Simulator *simulator, int frames)
 {
-    for (int i = 0; i < TLB_SIZE; i++)
+    size_t arena_size = (size_t)frames << geometry.offset_bits;
+
+    simulator->physical_memory = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    simulator->frame_page = malloc(frames * sizeof(unsigned long long));
+    if (simulator->physical_memory == MAP_FAILED || simulator->frame_page == NULL)
+    {
+        printf("Error: could not allocate physical memory\n");
+        if (simulator->physical_memory != MAP_FAILED)
+        {
+            munmap(simulator->physical_memory, arena_size);
+        }
+        free(simulator->frame_page);
+        simulator->physical_memory = NULL;
+        simulator->frame_page = NULL;
+        return -1;
+    }
+
+    for (int i = 0; i < frames; i++)
     {
-        TLB[i].page_number = -1;
-        TLB[i].frame_number = -1;
+        simulator->frame_page[i] = NO_PAGE;
     }
+    simulator->physical_memory_frames = frames;
+    return 0;
 }
 
-int select_victim_frame_fifo()
+void free_physical_memory(Simulator *simulator)
 {
-    if (next_victim_frame >= PHYSICAL_MEMORY_FRAMES)
+    if (simulator->physical_memory != NULL)
     {
-        next_victim_frame = 0;
+        munmap(simulator->physical_memory, (size_t)simulator->physical_memory_frames << geometry.offset_bits);
     }
-    return next_victim_frame++;
+    free(simulator->frame_page);
 }
 
-int select_victim_frame_lru(Frame *head)
+/*
+    Checkpoints (--checkpoint-at, --restore) are written and read by the same code. Every piece of state goes through
+    checkpoint_bytes, which appends it to the file when saving and copies it back out of the mapped file when restoring,
+    so the two directions cannot drift apart. Components with state of their own have a checkpoint hook written the same
+    way (see Replacement_policy and Page_table_type). A restore starts from a simulator freshly built with the same
+    configuration: arrays sized by the configuration already exist and are only overwritten, and the hooks allocate
+    whatever grew during the run. Saving also hashes the state as it goes; a restore checks the hash before reading
+    anything, and every frame, slot or list index read back is bounds-checked, so a damaged file is an error, not a
+    wild pointer.
+*/
+#define CHECKPOINT_CHECKSUM_SEED 0xcbf29ce484222325ULL /* FNV-1a */
+#define CHECKPOINT_CHECKSUM_PRIME 0x100000001b3ULL
+
+typedef struct Checkpoint
 {
-    Frame *current_frame = head;
-    Frame *lru_frame = head;
-    int min_last_used = INT_MAX;
+    int restoring;
+    FILE *file;       /* saving */
+    const char *data; /* restoring: the mapped checkpoint */
+    size_t size;
+    size_t position;
+    int error;
+    unsigned long long checksum; /* saving: of everything written so far */
+} Checkpoint;
 
-    while (current_frame != NULL)
+unsigned long long checkpoint_checksum(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
     {
-        if (current_frame->last_used < min_last_used)
-        {
-            min_last_used = current_frame->last_used;
-            lru_frame = current_frame;
-        }
-        current_frame = current_frame->next;
+        hash = (hash ^ bytes[i]) * CHECKPOINT_CHECKSUM_PRIME;
     }
-
-    return lru_frame->frame_number;
+    return hash;
 }
 
-void load_page_into_frame(Frame *head, int victim_frame, int page_number)
+void checkpoint_bytes(Checkpoint *checkpoint, void *data, size_t size)
 {
-    FILE *backing_store = fopen("BACKING_STORE.bin", "rb");
-    if (backing_store == NULL)
+    if (checkpoint->error || size == 0)
     {
-        printf("Error: could not open backing storage file\n");
         return;
     }
+    if (!checkpoint->restoring)
+    {
+        checkpoint->error = fwrite(data, 1, size, checkpoint->file) != size;
+        checkpoint->checksum = checkpoint_checksum(checkpoint->checksum, data, size);
+    }
+    else if (size > checkpoint->size - checkpoint->position)
+    {
+        checkpoint->error = 1;
+    }
+    else
+    {
+        memcpy(data, checkpoint->data + checkpoint->position, size);
+    }
+    checkpoint->position += size;
+}
 
-    Frame *current_frame = head;
-    int previous_page = -1;
+#define CHECKPOINT_FIELD(checkpoint, field) checkpoint_bytes((checkpoint), &(field), sizeof(field))
 
-    while (current_frame != NULL)
+/* On a restore, fails the checkpoint unless each of the count indices lies in [low, high). */
+void checkpoint_indices(Checkpoint *checkpoint, const int *indices, size_t count, int low, int high)
+{
+    if (!checkpoint->restoring || checkpoint->error)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
     {
-        if (current_frame->frame_number == victim_frame)
+        if (indices[i] < low || indices[i] >= high)
         {
-            fseek(backing_store, page_number * PAGE_SIZE, SEEK_SET);
-            fread(current_frame->data, sizeof(char), PAGE_SIZE, backing_store);
-            current_frame->last_used = current_time++;
-
-            for (int i = 0; i < NUMBER_OF_PAGES; i++)
-            {
-                if (page_table[i] == victim_frame)
-                {
-                    previous_page = i;
-                    break;
-                }
-            }
-            if (previous_page != -1)
-            {
-                page_table[previous_page] = -1;
-            }
-            page_table[page_number] = victim_frame;
-            break;
+            checkpoint->error = 1;
+            return;
         }
-        current_frame = current_frame->next;
     }
-
-    fclose(backing_store);
 }
 
-void handle_page_fault(Frame *frame_head, int page_number, char *replacement_algorithm)
+/*
+    Page tables. The table in use is picked at startup and driven through this interface:
+        init          build an empty table for the current geometry and number of frames
+        lookup        frame holding (asid, page_number), or -1; *references is set to the memory references the walk made
+        map / unmap   install or remove the translation for (asid, page_number)
+        memory_usage  bytes the table currently occupies
+        destroy       release the table
+        checkpoint    save or restore the table (see Checkpoint); NULL if it is rebuilt from the frames' reverse map
+    Every process gets its own table, except for shared types, which have a single table for all ASIDs. Tables that are
+    private to one address space ignore asid.
+*/
+typedef struct Page_table_type
 {
-    int victim_frame;
+    const char *name;
+    void *(*init)(int frames);
+    int (*lookup)(void *table, unsigned int asid, unsigned long long page_number, int *references);
+    void (*map)(void *table, unsigned int asid, unsigned long long page_number, int frame_number);
+    void (*unmap)(void *table, unsigned int asid, unsigned long long page_number);
+    size_t (*memory_usage)(void *table);
+    void (*destroy)(void *table);
+    void (*checkpoint)(void *table, Checkpoint *checkpoint);
+    int shared;
+} Page_table_type;
+
+/*
+    The flat table holds frame + 1 for every page, so a zero entry means not resident. It is an anonymous mapping,
+    which the kernel fills with zero pages lazily: only the parts of the table that are touched take memory.
+*/
+typedef struct Flat_page_table
+{
+    unsigned int *entries;
+    size_t size;
+} Flat_page_table;
 
-    if (strcmp(replacement_algorithm, "fifo") == 0)
+void *flat_page_table_init(int frames)
+{
+    (void)frames;
+    if (geometry.virtual_address_bits - geometry.offset_bits > MAX_FLAT_PAGE_TABLE_BITS)
     {
-        victim_frame = select_victim_frame_fifo();
+        printf("Error: a %d-bit page number is too large for a flat page table\n", geometry.virtual_address_bits - geometry.offset_bits);
+        return NULL;
     }
-    else if (strcmp(replacement_algorithm, "lru") == 0)
+
+    Flat_page_table *table = malloc(sizeof(Flat_page_table));
+    if (table == NULL)
     {
-        victim_frame = select_victim_frame_lru(frame_head);
+        return NULL;
     }
-    else
+    table->size = geometry.number_of_pages * sizeof(unsigned int);
+    table->entries = mmap(NULL, table->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table->entries == MAP_FAILED)
     {
-        printf("Error: unknown replacement algorithm\n");
-        return;
+        free(table);
+        return NULL;
     }
-    load_page_into_frame(frame_head, victim_frame, page_number);
-    page_table[page_number] = victim_frame;
+    return table;
+}
+
+int flat_page_table_lookup(void *table, unsigned int asid, unsigned long long page_number, int *references)
+{
+    (void)asid;
+    *references = 1;
+    return (int)((Flat_page_table *)table)->entries[page_number] - 1;
+}
+
+void flat_page_table_map(void *table, unsigned int asid, unsigned long long page_number, int frame_number)
+{
+    (void)asid;
+    ((Flat_page_table *)table)->entries[page_number] = frame_number + 1;
+}
+
+void flat_page_table_unmap(void *table, unsigned int asid, unsigned long long page_number)
+{
+    (void)asid;
+    ((Flat_page_table *)table)->entries[page_number] = 0;
+}
+
+size_t flat_page_table_memory_usage(void *table)
+{
+    return ((Flat_page_table *)table)->size;
 }
 
-int physical_address_calculator(int frame_number, int offset)
+void flat_page_table_destroy(void *table)
 {
-    return (frame_number << OFFSET_BITS) | offset;
+    munmap(((Flat_page_table *)table)->entries, ((Flat_page_table *)table)->size);
+    free(table);
 }
 
-int value_calculator(Frame *frame_head, int frame_number, int offset)
+/*
+    The radix table splits the page number into 2 to 4 levels, x86-64 style, top level first. Interior nodes hold
+    pointers to the next level and leaves hold frame + 1. Nodes are allocated on the first map below them, so memory
+    follows the working set rather than the size of the address space; a lookup that reaches a missing node stops
+    there. Emptied nodes are kept for reuse.
+*/
+#define MIN_RADIX_LEVELS 2
+#define MAX_RADIX_LEVELS 4
+#define RADIX_BITS_PER_LEVEL 9
+
+typedef struct Radix_page_table
+{
+    int levels;
+    int shift[MAX_RADIX_LEVELS];
+    unsigned long long mask[MAX_RADIX_LEVELS];
+    void **root;
+    size_t memory;
+    int frames;
+} Radix_page_table;
+
+int radix_levels = 0;
+
+void *radix_page_table_init(int frames)
 {
-    int value;
+    Radix_page_table *table = malloc(sizeof(Radix_page_table));
+    int page_number_bits = geometry.virtual_address_bits - geometry.offset_bits;
+    int levels = radix_levels;
 
-    while (frame_head != NULL)
+    if (table == NULL)
     {
-        if (frame_head->frame_number == frame_number)
-        {
-            value = (signed char)frame_head->data[offset];
-            break;
-        }
-        frame_head = frame_head->next;
+        return NULL;
     }
-    return value;
+    table->frames = frames;
+    if (levels == 0)
+    {
+        levels = (page_number_bits + RADIX_BITS_PER_LEVEL - 1) / RADIX_BITS_PER_LEVEL;
+        levels = levels < MIN_RADIX_LEVELS ? MIN_RADIX_LEVELS : levels > MAX_RADIX_LEVELS ? MAX_RADIX_LEVELS : levels;
+    }
+    if (levels > page_number_bits)
+    {
+        levels = page_number_bits;
+    }
+
+    /*
+        Lower levels get ceil(bits / levels) bits each and the root takes whatever is left; levels that would leave
+        the root nothing (5 bits over 4 levels is 2 + 2 + 2) are dropped.
+    */
+    int bits_per_level = (page_number_bits + levels - 1) / levels;
+    while (levels > 1 && (levels - 1) * bits_per_level >= page_number_bits)
+    {
+        levels--;
+        bits_per_level = (page_number_bits + levels - 1) / levels;
+    }
+    int shift = 0;
+    table->levels = levels;
+    for (int level = levels - 1; level >= 0; level--)
+    {
+        int bits = level == 0 ? page_number_bits - shift : bits_per_level;
+        table->shift[level] = shift;
+        table->mask[level] = (1ULL << bits) - 1;
+        shift += bits;
+    }
+
+    table->memory = (table->mask[0] + 1) * sizeof(void *);
+    table->root = calloc(table->mask[0] + 1, sizeof(void *));
+    if (table->root == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+    return table;
 }
 
-void update_tlb(int page_number, int frame_number, int tlb_entry)
+static inline size_t radix_index(Radix_page_table *table, int level, unsigned long long page_number)
 {
-    TLB[tlb_entry].page_number = page_number;
-    TLB[tlb_entry].frame_number = frame_number;
+    return (page_number >> table->shift[level]) & table->mask[level];
 }
 
-void check_tlb(Address *address_head, Frame *frame_head, FILE *output_file, char *replacement_algorithm)
+int radix_page_table_lookup(void *table_pointer, unsigned int asid, unsigned long long page_number, int *references)
 {
-    Address *current_address = address_head;
-    int page_number_to_check;
+    Radix_page_table *table = table_pointer;
+    void **node = table->root;
 
-    while (current_address != NULL)
+    (void)asid;
+    for (int level = 0; level < table->levels - 1; level++)
     {
-        page_number_to_check = current_address->page_number;
-        int tlb_hit = 0;
-        int tlb_index = -1;
-        int frame_number = -1;
-
-        for (int i = 0; i < TLB_SIZE; i++)
+        node = node[radix_index(table, level, page_number)];
+        if (node == NULL)
         {
-            if (TLB[i].page_number == page_number_to_check)
-            {
-                tlb_hit = 1;
-                tlb_hit_counter++;
-                frame_number = TLB[i].frame_number;
-                tlb_index = i;
-                break;
-            }
+            *references = level + 1;
+            return -1;
         }
+    }
+    *references = table->levels;
+    return (int)((unsigned int *)node)[radix_index(table, table->levels - 1, page_number)] - 1;
+}
 
-        if (tlb_hit == 1)
-        {
-            int offset = current_address->offset;
-            int physical_address = physical_address_calculator(frame_number, offset);
-            int value = value_calculator(frame_head, frame_number, offset);
-            fprintf(output_file, "Virtual address: %d TLB: %d Physical address: %d Value: %d\n", current_address->virtual_address, tlb_index, physical_address, value);
+void radix_page_table_map(void *table_pointer, unsigned int asid, unsigned long long page_number, int frame_number)
+{
+    Radix_page_table *table = table_pointer;
+    void **node = table->root;
 
-            Frame *current_frame = frame_head;
-            while (current_frame != NULL)
-            {
-                if (current_frame->frame_number == frame_number)
-                {
-                    current_frame->last_used = current_time++;
-                    break;
-                }
-                current_frame = current_frame->next;
-            }
-        }
-        else
+    (void)asid;
+    for (int level = 0; level < table->levels - 1; level++)
+    {
+        void **slot = &node[radix_index(table, level, page_number)];
+        if (*slot == NULL)
         {
-            if (page_table[page_number_to_check] < 0)
-            {
-                page_fault_counter++;
-                handle_page_fault(frame_head, page_number_to_check, replacement_algorithm);
-            }
-
-            frame_number = page_table[page_number_to_check];
-            int offset = current_address->offset;
-            int physical_address = physical_address_calculator(frame_number, offset);
-            int value = value_calculator(frame_head, frame_number, offset);
-            fprintf(output_file, "Virtual address: %d TLB: %d Physical address: %d Value: %d\n", current_address->virtual_address, next_tlb_entry, physical_address, value);
-
-            update_tlb(page_number_to_check, frame_number, next_tlb_entry);
-            next_tlb_entry = (next_tlb_entry + 1) % TLB_SIZE;
-
-            Frame *current_frame = frame_head;
-            while (current_frame != NULL)
+            size_t entries = table->mask[level + 1] + 1;
+            size_t entry_size = level + 1 == table->levels - 1 ? sizeof(unsigned int) : sizeof(void *);
+            *slot = calloc(entries, entry_size);
+            if (*slot == NULL)
             {
-                if (current_frame->frame_number == frame_number)
-                {
-                    current_frame->last_used = current_time++;
-                    break;
-                }
-                current_frame = current_frame->next;
+                printf("Error: could not allocate page table node\n");
+                exit(1);
             }
+            table->memory += entries * entry_size;
         }
-        current_address = current_address->next;
+        node = *slot;
     }
+    ((unsigned int *)node)[radix_index(table, table->levels - 1, page_number)] = frame_number + 1;
 }
 
-void extract_page_number_and_offset(Address **head, char *address_file)
+void radix_page_table_unmap(void *table_pointer, unsigned int asid, unsigned long long page_number)
 {
-    FILE *addresses_file = fopen(address_file, "r");
-    int virtual_address;
+    Radix_page_table *table = table_pointer;
+    void **node = table->root;
 
-    if (addresses_file == NULL)
+    (void)asid;
+    for (int level = 0; level < table->levels - 1 && node != NULL; level++)
     {
-        printf("Error: could not open addresses file\n");
-        return;
+        node = node[radix_index(table, level, page_number)];
     }
-
-    char address_line[MAX_ADDRESS_LENGTH];
-
-    while (fgets(address_line, sizeof(address_line), addresses_file))
+    if (node != NULL)
     {
-        virtual_address = atoi(address_line);
-        int page_number = (virtual_address >> 8) & 0xFF;
-        int offset = virtual_address & 0xFF;
-        total_translated_addresses++;
-        insert_address(head, virtual_address, page_number, offset);
+        ((unsigned int *)node)[radix_index(table, table->levels - 1, page_number)] = 0;
     }
+}
 
-    fclose(addresses_file);
+size_t radix_page_table_memory_usage(void *table)
+{
+    return ((Radix_page_table *)table)->memory;
 }
 
-int main(int argc, char *argv[])
+static void radix_free_node(Radix_page_table *table, void **node, int level)
 {
-    if (argc != 3)
+    if (level < table->levels - 1)
     {
-        printf("Usage: %s <address_file> <replacement_algorithm>\n", argv[0]);
-        return 1;
+        for (size_t i = 0; i <= table->mask[level]; i++)
+        {
+            if (node[i] != NULL)
+            {
+                radix_free_node(table, node[i], level + 1);
+            }
+        }
     }
+    free(node);
+}
 
-    char *address_file = argv[1];
-    char *replacement_algorithm = argv[2];
+void radix_page_table_destroy(void *table)
+{
+    radix_free_node(table, ((Radix_page_table *)table)->root, 0);
+    free(table);
+}
 
-    Address *address_head = NULL;
-    Frame *frame_head = NULL;
+/* Interior nodes record which children exist, so a restore rebuilds the same nodes, emptied ones included. */
+static void radix_checkpoint_node(Radix_page_table *table, void **node, int level, Checkpoint *checkpoint)
+{
+    size_t entries = table->mask[level] + 1;
 
-    FILE *output_file = fopen("correct.txt", "w");
-    if (output_file == NULL)
+    if (level == table->levels - 1)
     {
-        printf("Error: could not write output file\n");
-        return 0;
+        checkpoint_bytes(checkpoint, node, entries * sizeof(unsigned int));
+        for (size_t i = 0; i < entries && checkpoint->restoring; i++)
+        {
+            checkpoint->error |= ((unsigned int *)node)[i] > (unsigned int)table->frames;
+        }
+        return;
+    }
+    for (size_t i = 0; i < entries && !checkpoint->error; i++)
+    {
+        unsigned char present = node[i] != NULL;
+        CHECKPOINT_FIELD(checkpoint, present);
+        if (!present)
+        {
+            continue;
+        }
+        if (checkpoint->restoring && node[i] == NULL)
+        {
+            size_t child_entries = table->mask[level + 1] + 1;
+            node[i] = calloc(child_entries, level + 1 == table->levels - 1 ? sizeof(unsigned int) : sizeof(void *));
+            if (node[i] == NULL)
+            {
+                checkpoint->error = 1;
+                return;
+            }
+        }
+        radix_checkpoint_node(table, node[i], level + 1, checkpoint);
     }
+}
 
-    init_page_table();
-    init_physical_memory(&frame_head);
-    init_tlb();
-    extract_page_number_and_offset(&address_head, address_file);
-    check_tlb(address_head, frame_head, output_file, replacement_algorithm);
+void radix_page_table_checkpoint(void *table_pointer, Checkpoint *checkpoint)
+{
+    Radix_page_table *table = table_pointer;
+
+    CHECKPOINT_FIELD(checkpoint, table->memory);
+    radix_checkpoint_node(table, table->root, 0, checkpoint);
+}
+
+/*
+    The inverted table has one entry per frame holding the (asid, page number) resident there, plus an open-addressing
+    hash anchor of frame numbers sized to twice the frame count. Its size is bounded by physical memory, not by the
+    virtual address space, which suits sparse 64-bit traces. Collisions probe linearly and removals shift later entries
+    back, so there are no tombstones.
+*/
+typedef struct Inverted_page_table
+{
+    int *slots;
+    size_t slot_mask;
+    unsigned int *frame_asid;
+    unsigned long long *frame_page_number;
+    int frames;
+} Inverted_page_table;
 
-    fprintf(output_file, "Number of Translated Addresses = %d\n", total_translated_addresses);
-    fprintf(output_file, "Page Faults = %d\n", page_fault_counter);
-    fprintf(output_file, "Page Fault Rate = %.3f\n", (float)page_fault_counter / total_translated_addresses);
-    fprintf(output_file, "TLB Hits = %d\n", tlb_hit_counter);
-    fprintf(output_file, "TLB Hit Rate = %.3f\n", (float)tlb_hit_counter / total_translated_addresses);
+void *inverted_page_table_init(int frames)
+{
+    Inverted_page_table *table = malloc(sizeof(Inverted_page_table));
+    size_t slots = 1;
 
-    while (address_head != NULL)
+    if (table == NULL)
     {
-        Address *temp = address_head;
-        address_head = address_head->next;
-        free(temp);
+        return NULL;
     }
-
-    while (frame_head != NULL)
+    while (slots < (size_t)frames * 2)
+    {
+        slots <<= 1;
+    }
+    table->slots = malloc(slots * sizeof(int));
+    table->slot_mask = slots - 1;
+    table->frame_asid = malloc(frames * sizeof(unsigned int));
+    table->frame_page_number = malloc(frames * sizeof(unsigned long long));
+    table->frames = frames;
+    if (table->slots == NULL || table->frame_asid == NULL || table->frame_page_number == NULL)
+    {
+        free(table->slots);
+        free(table->frame_asid);
+        free(table->frame_page_number);
+        free(table);
+        return NULL;
+    }
+    for (size_t i = 0; i < slots; i++)
     {
-        Frame *temp = frame_head;
-        frame_head = frame_head->next;
-        free(temp);
+        table->slots[i] = -1;
     }
+    return table;
+}
+
+static inline size_t inverted_hash(Inverted_page_table *table, unsigned int asid, unsigned long long page_number)
+{
+    unsigned long long key = page_number ^ ((unsigned long long)asid << 48) ^ ((unsigned long long)asid >> 16);
 
-    fclose(output_file);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & table->slot_mask;
+}
+
+/* Returns the slot holding (asid, page_number), or the empty slot where it would go. */
+static inline size_t inverted_find(Inverted_page_table *table, unsigned int asid, unsigned long long page_number, int *references)
+{
+    size_t slot = inverted_hash(table, asid, page_number);
+    int probes = 1;
+
+    for (int frame_number; (frame_number = table->slots[slot]) != -1; slot = (slot + 1) & table->slot_mask, probes++)
+    {
+        if (table->frame_page_number[frame_number] == page_number && table->frame_asid[frame_number] == asid)
+        {
+            break;
+        }
+    }
+    *references = probes;
+    return slot;
+}
+
+int inverted_page_table_lookup(void *table_pointer, unsigned int asid, unsigned long long page_number, int *references)
+{
+    Inverted_page_table *table = table_pointer;
+
+    return table->slots[inverted_find(table, asid, page_number, references)];
+}
+
+void inverted_page_table_map(void *table_pointer, unsigned int asid, unsigned long long page_number, int frame_number)
+{
+    Inverted_page_table *table = table_pointer;
+    int references;
+    size_t slot = inverted_find(table, asid, page_number, &references);
+
+    table->frame_asid[frame_number] = asid;
+    table->frame_page_number[frame_number] = page_number;
+    table->slots[slot] = frame_number;
+}
+
+void inverted_page_table_unmap(void *table_pointer, unsigned int asid, unsigned long long page_number)
+{
+    Inverted_page_table *table = table_pointer;
+    int references;
+    size_t hole = inverted_find(table, asid, page_number, &references);
+
+    if (table->slots[hole] == -1)
+    {
+        return;
+    }
+    for (size_t next = (hole + 1) & table->slot_mask; table->slots[next] != -1; next = (next + 1) & table->slot_mask)
+    {
+        int frame_number = table->slots[next];
+        size_t home = inverted_hash(table, table->frame_asid[frame_number], table->frame_page_number[frame_number]);
+        if (((next - home) & table->slot_mask) >= ((next - hole) & table->slot_mask))
+        {
+            table->slots[hole] = frame_number;
+            hole = next;
+        }
+    }
+    table->slots[hole] = -1;
+}
+
+size_t inverted_page_table_memory_usage(void *table_pointer)
+{
+    Inverted_page_table *table = table_pointer;
+
+    return (table->slot_mask + 1) * sizeof(int) + (size_t)table->frames * (sizeof(unsigned int) + sizeof(unsigned long long));
+}
+
+void inverted_page_table_checkpoint(void *table_pointer, Checkpoint *checkpoint)
+{
+    Inverted_page_table *table = table_pointer;
+
+    checkpoint_bytes(checkpoint, table->slots, (table->slot_mask + 1) * sizeof(int));
+    checkpoint_indices(checkpoint, table->slots, table->slot_mask + 1, -1, table->frames);
+    checkpoint_bytes(checkpoint, table->frame_asid, (size_t)table->frames * sizeof(unsigned int));
+    checkpoint_bytes(checkpoint, table->frame_page_number, (size_t)table->frames * sizeof(unsigned long long));
+}
+
+void inverted_page_table_destroy(void *table_pointer)
+{
+    Inverted_page_table *table = table_pointer;
+
+    free(table->slots);
+    free(table->frame_asid);
+    free(table->frame_page_number);
+    free(table);
+}
+
+Page_table_type page_table_types[] = {
+    {"flat", flat_page_table_init, flat_page_table_lookup, flat_page_table_map, flat_page_table_unmap, flat_page_table_memory_usage, flat_page_table_destroy, NULL, 0},
+    {"radix", radix_page_table_init, radix_page_table_lookup, radix_page_table_map, radix_page_table_unmap, radix_page_table_memory_usage, radix_page_table_destroy, radix_page_table_checkpoint, 0},
+    {"inverted", inverted_page_table_init, inverted_page_table_lookup, inverted_page_table_map, inverted_page_table_unmap, inverted_page_table_memory_usage, inverted_page_table_destroy, inverted_page_table_checkpoint, 1},
+};
+
+Page_table_type *page_table_type = &page_table_types[0];
+
+/*
+    Page-walk cost model: every memory reference a walk makes costs walk_latency cycles. Walks happen on TLB misses
+    only, so a larger or better-placed TLB shows up directly as fewer walk cycles.
+*/
+#define DEFAULT_WALK_LATENCY 100
+
+int walk_latency = DEFAULT_WALK_LATENCY;
+
+Page_table_type *find_page_table_type(char *name)
+{
+    for (size_t i = 0; i < sizeof(page_table_types) / sizeof(page_table_types[0]); i++)
+    {
+        if (strcmp(page_table_types[i].name, name) == 0)
+        {
+            return &page_table_types[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Intrusive doubly-linked lists over small integer node ids (frame numbers, or ARC ghost slots). Several lists may
+    share the same prev/next arrays as long as a node is on at most one of them at a time.
+*/
+typedef struct Node_list
+{
+    int head;
+    int tail;
+    int size;
+    int *prev;
+    int *next;
+} Node_list;
+
+/*
+    Processes. Each ASID in the trace gets its own page table (unless the table type is shared) and its own counters,
+    created the first time the ASID appears. Frames come from a Frame_pool: with global replacement every process draws
+    from one pool spanning physical memory, and a fault may evict another process's page; with local replacement
+    physical memory is split evenly into one pool per process, each with its own replacement-policy instance, so a
+    process only ever evicts its own pages. Policies only see frame numbers relative to their pool.
+
+    Working-set and PFF allocation share one pool like global replacement, but size each resident set to the process's
+    behaviour instead of letting it grow until memory is full. Working set (Denning) releases a page once it has gone
+    working_set_window references of its process unreferenced. Page-fault frequency releases, at a fault, every page not
+    referenced since the previous fault when more than pff_threshold references separate the two. Released frames go
+    to the pool's free list; the replacement policy only picks a victim when the resident sets fill memory.
+*/
+enum
+{
+    FRAME_ALLOCATION_GLOBAL,
+    FRAME_ALLOCATION_LOCAL,
+    FRAME_ALLOCATION_WORKING_SET,
+    FRAME_ALLOCATION_PFF
+};
+
+const char *frame_allocation_names[] = {"global", "local", "ws", "pff"};
+
+typedef struct Frame_pool
+{
+    int first_frame;
+    int frames;
+    int next_unused_frame;
+    int *free_frames;
+    int free_count;
+    void *policy_state;
+} Frame_pool;
+
+typedef struct Process
+{
+    void *page_table;
+    Frame_pool *pool;
+    unsigned long long translated_addresses;
+    unsigned long long page_faults;
+    unsigned long long tlb_hits;
+    Node_list resident;
+    int resident_frames;
+    int peak_resident_frames;
+    unsigned long long last_fault_time;
+    unsigned long long interval_accesses;
+    unsigned long long interval_faults;
+    unsigned long long interval_start_tlb_hits;
+    unsigned long long interval_evictions;
+    unsigned long long last_miss_page; /* prefetch training: the last page that missed, or would have without prefetching */
+    long long miss_stride;
+} Process;
+
+/* Returns the frame holding (asid, page_number), or -1 if it is not resident, charging the walk. */
+static inline int page_table_lookup(Simulator *simulator, unsigned long long page_number)
+{
+    int references;
+    INSTRUMENT_START(timer);
+    int frame_number = page_table_type->lookup(simulator->current_process->page_table, simulator->current_asid, page_number, &references);
+
+    INSTRUMENT_STOP(PHASE_PAGE_TABLE, timer);
+    simulator->page_walk_counter++;
+    simulator->page_walk_references += references;
+    return frame_number;
+}
+
+static inline void page_table_map(Process *process, unsigned int asid, unsigned long long page_number, int frame_number)
+{
+    page_table_type->map(process->page_table, asid, page_number, frame_number);
+}
+
+static inline void page_table_unmap(Process *process, unsigned int asid, unsigned long long page_number)
+{
+    page_table_type->unmap(process->page_table, asid, page_number);
+}
+
+size_t page_table_memory_usage(Simulator *simulator)
+{
+    size_t total = 0;
+
+    if (page_table_type->shared)
+    {
+        return simulator->shared_page_table != NULL ? page_table_type->memory_usage(simulator->shared_page_table) : 0;
+    }
+    for (unsigned int asid = 0; asid < simulator->process_limit; asid++)
+    {
+        if (simulator->processes[asid].page_table != NULL)
+        {
+            total += page_table_type->memory_usage(simulator->processes[asid].page_table);
+        }
+    }
+    return total;
+}
+
+void node_list_init(Node_list *list, int *prev, int *next)
+{
+    list->head = -1;
+    list->tail = -1;
+    list->size = 0;
+    list->prev = prev;
+    list->next = next;
+}
+
+void node_list_push_tail(Node_list *list, int node)
+{
+    list->prev[node] = list->tail;
+    list->next[node] = -1;
+    if (list->tail != -1)
+    {
+        list->next[list->tail] = node;
+    }
+    else
+    {
+        list->head = node;
+    }
+    list->tail = node;
+    list->size++;
+}
+
+void node_list_push_head(Node_list *list, int node)
+{
+    list->prev[node] = -1;
+    list->next[node] = list->head;
+    if (list->head != -1)
+    {
+        list->prev[list->head] = node;
+    }
+    else
+    {
+        list->tail = node;
+    }
+    list->head = node;
+    list->size++;
+}
+
+void node_list_remove(Node_list *list, int node)
+{
+    int prev = list->prev[node];
+    int next = list->next[node];
+
+    if (prev != -1)
+    {
+        list->next[prev] = next;
+    }
+    else
+    {
+        list->head = next;
+    }
+    if (next != -1)
+    {
+        list->prev[next] = prev;
+    }
+    else
+    {
+        list->tail = prev;
+    }
+    list->size--;
+}
+
+int node_list_pop_head(Node_list *list)
+{
+    int node = list->head;
+    if (node != -1)
+    {
+        node_list_remove(list, node);
+    }
+    return node;
+}
+
+/* The links live in the shared prev/next arrays, which their owner checkpoints; nodes is how many there are. */
+void checkpoint_node_list(Checkpoint *checkpoint, Node_list *list, int nodes)
+{
+    CHECKPOINT_FIELD(checkpoint, list->head);
+    CHECKPOINT_FIELD(checkpoint, list->tail);
+    CHECKPOINT_FIELD(checkpoint, list->size);
+    checkpoint_indices(checkpoint, &list->head, 1, -1, nodes);
+    checkpoint_indices(checkpoint, &list->tail, 1, -1, nodes);
+    checkpoint_indices(checkpoint, &list->size, 1, 0, nodes + 1);
+}
+
+void node_list_move_to_tail(Node_list *list, int node)
+{
+    if (list->tail != node)
+    {
+        node_list_remove(list, node);
+        node_list_push_tail(list, node);
+    }
+}
+
+/*
+    Open-addressing hash map from a 64-bit key to a 64-bit value, with linear probing and backward-shift deletion so there are
+    no tombstones. It grows when it passes half full.
+*/
+typedef struct Page_map
+{
+    unsigned long long *keys;
+    long long *values;
+    size_t capacity;
+    size_t count;
+} Page_map;
+
+#define PAGE_MAP_EMPTY (~0ULL)
+
+static inline size_t page_map_hash(unsigned long long key, size_t capacity)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (capacity - 1);
+}
+
+int page_map_init(Page_map *map, size_t expected)
+{
+    map->capacity = 16;
+    while (map->capacity < expected * 2)
+    {
+        map->capacity <<= 1;
+    }
+    map->count = 0;
+    map->keys = malloc(map->capacity * sizeof(unsigned long long));
+    map->values = malloc(map->capacity * sizeof(long long));
+    if (map->keys == NULL || map->values == NULL)
+    {
+        return -1;
+    }
+    memset(map->keys, 0xFF, map->capacity * sizeof(unsigned long long));
+    return 0;
+}
+
+void page_map_free(Page_map *map)
+{
+    free(map->keys);
+    free(map->values);
+}
+
+long long page_map_get(Page_map *map, unsigned long long key)
+{
+    size_t slot = page_map_hash(key, map->capacity);
+
+    while (map->keys[slot] != PAGE_MAP_EMPTY)
+    {
+        if (map->keys[slot] == key)
+        {
+            return map->values[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return -1;
+}
+
+void page_map_put(Page_map *map, unsigned long long key, long long value);
+
+static void page_map_grow(Page_map *map)
+{
+    Page_map bigger;
+
+    bigger.capacity = map->capacity * 2;
+    bigger.count = 0;
+    bigger.keys = malloc(bigger.capacity * sizeof(unsigned long long));
+    bigger.values = malloc(bigger.capacity * sizeof(long long));
+    if (bigger.keys == NULL || bigger.values == NULL)
+    {
+        printf("Error: could not grow page map\n");
+        exit(1);
+    }
+    memset(bigger.keys, 0xFF, bigger.capacity * sizeof(unsigned long long));
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        if (map->keys[i] != PAGE_MAP_EMPTY)
+        {
+            page_map_put(&bigger, map->keys[i], map->values[i]);
+        }
+    }
+    page_map_free(map);
+    *map = bigger;
+}
+
+void page_map_put(Page_map *map, unsigned long long key, long long value)
+{
+    if ((map->count + 1) * 2 > map->capacity)
+    {
+        page_map_grow(map);
+    }
+
+    size_t slot = page_map_hash(key, map->capacity);
+    while (map->keys[slot] != PAGE_MAP_EMPTY && map->keys[slot] != key)
+    {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    if (map->keys[slot] == PAGE_MAP_EMPTY)
+    {
+        map->keys[slot] = key;
+        map->count++;
+    }
+    map->values[slot] = value;
+}
+
+void page_map_remove(Page_map *map, unsigned long long key)
+{
+    size_t mask = map->capacity - 1;
+    size_t slot = page_map_hash(key, map->capacity);
+
+    while (map->keys[slot] != key)
+    {
+        if (map->keys[slot] == PAGE_MAP_EMPTY)
+        {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; map->keys[next] != PAGE_MAP_EMPTY; next = (next + 1) & mask)
+    {
+        size_t home = page_map_hash(map->keys[next], map->capacity);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            map->keys[hole] = map->keys[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
+    }
+    map->keys[hole] = PAGE_MAP_EMPTY;
+    map->count--;
+}
+
+/* The slots are saved as they are, so a restored map probes exactly like the saved one. */
+void checkpoint_page_map(Checkpoint *checkpoint, Page_map *map)
+{
+    size_t capacity = map->capacity;
+
+    CHECKPOINT_FIELD(checkpoint, capacity);
+    CHECKPOINT_FIELD(checkpoint, map->count);
+    if (checkpoint->restoring && (capacity == 0 || (capacity & (capacity - 1)) != 0 || map->count >= capacity))
+    {
+        checkpoint->error = 1;
+    }
+    if (checkpoint->restoring && !checkpoint->error && capacity != map->capacity)
+    {
+        unsigned long long *keys = malloc(capacity * sizeof(unsigned long long));
+        long long *values = malloc(capacity * sizeof(long long));
+        if (keys == NULL || values == NULL)
+        {
+            free(keys);
+            free(values);
+            checkpoint->error = 1;
+            return;
+        }
+        page_map_free(map);
+        map->keys = keys;
+        map->values = values;
+        map->capacity = capacity;
+    }
+    checkpoint_bytes(checkpoint, map->keys, map->capacity * sizeof(unsigned long long));
+    checkpoint_bytes(checkpoint, map->values, map->capacity * sizeof(long long));
+}
+
+/* On a restore, fails the checkpoint unless every value in the map is an index below limit. */
+void checkpoint_page_map_indices(Checkpoint *checkpoint, Page_map *map, long long limit)
+{
+    for (size_t i = 0; i < map->capacity && checkpoint->restoring && !checkpoint->error; i++)
+    {
+        checkpoint->error = map->keys[i] != PAGE_MAP_EMPTY && (map->values[i] < 0 || map->values[i] >= limit);
+    }
+}
+
+/*
+    Binary min-heap over frame numbers with a position index, so a frame's key can be changed or the frame removed in
+    O(log frames). Used by LFU (key = use count, then recency) and OPT (key = inverted next use).
+*/
+typedef struct Frame_heap
+{
+    int *heap;
+    int *position;
+    unsigned long long *key;
+    int size;
+} Frame_heap;
+
+int frame_heap_init(Frame_heap *heap, int frames)
+{
+    heap->heap = malloc(frames * sizeof(int));
+    heap->position = malloc(frames * sizeof(int));
+    heap->key = calloc(frames, sizeof(unsigned long long));
+    heap->size = 0;
+    if (heap->heap == NULL || heap->position == NULL || heap->key == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < frames; i++)
+    {
+        heap->position[i] = -1;
+    }
+    return 0;
+}
+
+void frame_heap_free(Frame_heap *heap)
+{
+    free(heap->heap);
+    free(heap->position);
+    free(heap->key);
+}
+
+static void frame_heap_swap(Frame_heap *heap, int a, int b)
+{
+    int frame_a = heap->heap[a];
+    int frame_b = heap->heap[b];
+
+    heap->heap[a] = frame_b;
+    heap->heap[b] = frame_a;
+    heap->position[frame_b] = a;
+    heap->position[frame_a] = b;
+}
+
+static void frame_heap_sift(Frame_heap *heap, int index)
+{
+    while (index > 0 && heap->key[heap->heap[index]] < heap->key[heap->heap[(index - 1) / 2]])
+    {
+        frame_heap_swap(heap, index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+    for (;;)
+    {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+
+        if (left < heap->size && heap->key[heap->heap[left]] < heap->key[heap->heap[smallest]])
+        {
+            smallest = left;
+        }
+        if (right < heap->size && heap->key[heap->heap[right]] < heap->key[heap->heap[smallest]])
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            break;
+        }
+        frame_heap_swap(heap, index, smallest);
+        index = smallest;
+    }
+}
+
+void frame_heap_set(Frame_heap *heap, int frame_number, unsigned long long key)
+{
+    heap->key[frame_number] = key;
+    if (heap->position[frame_number] == -1)
+    {
+        heap->heap[heap->size] = frame_number;
+        heap->position[frame_number] = heap->size++;
+    }
+    frame_heap_sift(heap, heap->position[frame_number]);
+}
+
+int frame_heap_pop(Frame_heap *heap)
+{
+    if (heap->size == 0)
+    {
+        return -1;
+    }
+
+    int frame_number = heap->heap[0];
+    frame_heap_swap(heap, 0, --heap->size);
+    heap->position[frame_number] = -1;
+    if (heap->size > 0)
+    {
+        frame_heap_sift(heap, 0);
+    }
+    return frame_number;
+}
+
+void frame_heap_remove(Frame_heap *heap, int frame_number)
+{
+    int index = heap->position[frame_number];
+    if (index == -1)
+    {
+        return;
+    }
+
+    frame_heap_swap(heap, index, --heap->size);
+    heap->position[frame_number] = -1;
+    if (index < heap->size)
+    {
+        frame_heap_sift(heap, index);
+    }
+}
+
+/*
+    Page-replacement policies. A policy is resolved once at startup and driven through this table:
+        init          allocate policy state for the given number of frames of a simulator
+        on_access     a resident page was referenced (TLB or page-table hit)
+        on_write      a resident frame was written for the first time since it was loaded; it is now dirty
+        on_fault      a page was just loaded into a frame for the current access
+        on_prefetch   a page was loaded ahead of use; it enters at the lowest priority, first in line for eviction
+        select_victim pick the frame to evict for the faulting page, or for a prefetch when the page is NO_PAGE; only
+                      called once every frame is in use
+        on_remove     a resident frame was released by the allocator (working set or PFF) without a fault
+        destroy       release policy state
+        checkpoint    save or restore the state of a pool of the given number of frames (see Checkpoint)
+    Pages are identified by their key (see page_key) and frames are numbered within the policy's frame pool. Policies
+    with needs_next_use set are given the index of each access's next reference to the same page.
+*/
+typedef struct Replacement_policy
+{
+    const char *name;
+    void *(*init)(Simulator *simulator, int frames);
+    void (*on_access)(void *state, int frame_number);
+    void (*on_write)(void *state, int frame_number);
+    void (*on_fault)(void *state, int frame_number, unsigned long long page_number);
+    void (*on_prefetch)(void *state, int frame_number, unsigned long long page_number);
+    int (*select_victim)(void *state, unsigned long long page_number);
+    void (*on_remove)(void *state, int frame_number);
+    void (*destroy)(void *state);
+    void (*checkpoint)(void *state, int frames, Checkpoint *checkpoint);
+    int needs_next_use;
+} Replacement_policy;
+
+#define NEVER_USED_AGAIN (~0ULL)
+
+typedef struct List_policy
+{
+    Node_list list;
+    int *prev;
+    int *next;
+    unsigned char *modified; /* CFLRU only */
+    int window;
+} List_policy;
+
+void *list_policy_init(Simulator *simulator, int frames)
+{
+    (void)simulator;
+    List_policy *state = malloc(sizeof(List_policy));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    state->prev = malloc(frames * sizeof(int));
+    state->next = malloc(frames * sizeof(int));
+    state->modified = NULL;
+    state->window = 0;
+    if (state->prev == NULL || state->next == NULL)
+    {
+        free(state->prev);
+        free(state->next);
+        free(state);
+        return NULL;
+    }
+    node_list_init(&state->list, state->prev, state->next);
+    return state;
+}
+
+void list_policy_checkpoint(void *state, int frames, Checkpoint *checkpoint)
+{
+    List_policy *list_policy = state;
+
+    checkpoint_node_list(checkpoint, &list_policy->list, frames);
+    checkpoint_bytes(checkpoint, list_policy->prev, frames * sizeof(int));
+    checkpoint_bytes(checkpoint, list_policy->next, frames * sizeof(int));
+    checkpoint_indices(checkpoint, list_policy->prev, frames, -1, frames);
+    checkpoint_indices(checkpoint, list_policy->next, frames, -1, frames);
+    if (list_policy->modified != NULL)
+    {
+        checkpoint_bytes(checkpoint, list_policy->modified, frames);
+    }
+}
+
+void list_policy_destroy(void *state)
+{
+    List_policy *list_policy = state;
+
+    free(list_policy->prev);
+    free(list_policy->next);
+    free(list_policy->modified);
+    free(list_policy);
+}
+
+void list_policy_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    (void)page_number;
+    node_list_push_tail(&((List_policy *)state)->list, frame_number);
+}
+
+int list_policy_select_victim(void *state, unsigned long long page_number)
+{
+    (void)page_number;
+    return node_list_pop_head(&((List_policy *)state)->list);
+}
+
+void list_policy_on_prefetch(void *state, int frame_number, unsigned long long page_number)
+{
+    (void)page_number;
+    node_list_push_head(&((List_policy *)state)->list, frame_number);
+}
+
+void list_policy_on_remove(void *state, int frame_number)
+{
+    node_list_remove(&((List_policy *)state)->list, frame_number);
+}
+
+void fifo_on_access(void *state, int frame_number)
+{
+    (void)state;
+    (void)frame_number;
+}
+
+void lru_on_access(void *state, int frame_number)
+{
+    node_list_move_to_tail(&((List_policy *)state)->list, frame_number);
+}
+
+/* Policies that do not tell clean frames from dirty ones. */
+void ignore_write(void *state, int frame_number)
+{
+    (void)state;
+    (void)frame_number;
+}
+
+/*
+    CFLRU (clean-first LRU) keeps LRU order, but first looks for a clean page among the window least recently used
+    frames (a quarter of them) and evicts the oldest one found; only when the whole window is dirty does it evict the
+    LRU page and pay for its write-back.
+*/
+void *cflru_init(Simulator *simulator, int frames)
+{
+    List_policy *state = list_policy_init(simulator, frames);
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    state->modified = calloc(frames, 1);
+    state->window = frames / 4 > 0 ? frames / 4 : 1;
+    if (state->modified == NULL)
+    {
+        free(state->prev);
+        free(state->next);
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+void cflru_on_write(void *state, int frame_number)
+{
+    ((List_policy *)state)->modified[frame_number] = 1;
+}
+
+void cflru_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    ((List_policy *)state)->modified[frame_number] = 0;
+    list_policy_on_fault(state, frame_number, page_number);
+}
+
+void cflru_on_prefetch(void *state, int frame_number, unsigned long long page_number)
+{
+    ((List_policy *)state)->modified[frame_number] = 0;
+    list_policy_on_prefetch(state, frame_number, page_number);
+}
+
+int cflru_select_victim(void *state, unsigned long long page_number)
+{
+    List_policy *lru = state;
+    int frame_number = lru->list.head;
+
+    (void)page_number;
+    for (int i = 0; i < lru->window && frame_number != -1; i++, frame_number = lru->next[frame_number])
+    {
+        if (!lru->modified[frame_number])
+        {
+            node_list_remove(&lru->list, frame_number);
+            return frame_number;
+        }
+    }
+    return node_list_pop_head(&lru->list);
+}
+
+/*
+    CLOCK keeps one reference bit per frame and a hand sweeping the frames in order. A hit only sets the bit (and only
+    when it is clear), so there is no per-hit list or timestamp update.
+*/
+typedef struct Clock_policy
+{
+    unsigned char *referenced;
+    unsigned char *modified;
+    int frames;
+    int hand;
+} Clock_policy;
+
+void *clock_init(Simulator *simulator, int frames)
+{
+    (void)simulator;
+    Clock_policy *state = malloc(sizeof(Clock_policy));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    state->referenced = calloc(frames, 1);
+    state->modified = calloc(frames, 1);
+    state->frames = frames;
+    state->hand = 0;
+    if (state->referenced == NULL || state->modified == NULL)
+    {
+        free(state->referenced);
+        free(state->modified);
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+void clock_checkpoint(void *state, int frames, Checkpoint *checkpoint)
+{
+    Clock_policy *clock = state;
+
+    checkpoint_bytes(checkpoint, clock->referenced, frames);
+    checkpoint_bytes(checkpoint, clock->modified, frames);
+    CHECKPOINT_FIELD(checkpoint, clock->hand);
+    checkpoint_indices(checkpoint, &clock->hand, 1, 0, frames);
+}
+
+void clock_destroy(void *state)
+{
+    Clock_policy *clock = state;
+
+    free(clock->referenced);
+    free(clock->modified);
+    free(clock);
+}
+
+void clock_on_access(void *state, int frame_number)
+{
+    Clock_policy *clock = state;
+
+    if (!clock->referenced[frame_number])
+    {
+        clock->referenced[frame_number] = 1;
+    }
+}
+
+void clock_on_write(void *state, int frame_number)
+{
+    ((Clock_policy *)state)->modified[frame_number] = 1;
+}
+
+void clock_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    Clock_policy *clock = state;
+
+    (void)page_number;
+    clock->referenced[frame_number] = 1;
+    clock->modified[frame_number] = 0;
+}
+
+int clock_select_victim(void *state, unsigned long long page_number)
+{
+    Clock_policy *clock = state;
+
+    (void)page_number;
+    while (clock->referenced[clock->hand])
+    {
+        clock->referenced[clock->hand] = 0;
+        clock->hand = (clock->hand + 1) % clock->frames;
+    }
+
+    int victim_frame = clock->hand;
+    clock->hand = (clock->hand + 1) % clock->frames;
+    return victim_frame;
+}
+
+void clock_on_remove(void *state, int frame_number)
+{
+    Clock_policy *clock = state;
+
+    clock->referenced[frame_number] = 0;
+    clock->modified[frame_number] = 0;
+}
+
+void clock_on_prefetch(void *state, int frame_number, unsigned long long page_number)
+{
+    (void)page_number;
+    clock_on_remove(state, frame_number);
+}
+
+/*
+    Enhanced second chance orders frames by the (referenced, modified) pair and evicts from the lowest class found by
+    the sweep: (0,0), then (0,1) while clearing reference bits, and repeats, so a clean page is evicted ahead of a dirty
+    one of the same reference class. Frames loaded for reads stay clean, so on a read-only trace only the (0,0) and
+    (1,0) classes occur.
+*/
+int esc_select_victim(void *state, unsigned long long page_number)
+{
+    Clock_policy *clock = state;
+
+    (void)page_number;
+    for (;;)
+    {
+        for (int i = 0; i < clock->frames; i++)
+        {
+            int frame_number = (clock->hand + i) % clock->frames;
+            if (!clock->referenced[frame_number] && !clock->modified[frame_number])
+            {
+                clock->hand = (frame_number + 1) % clock->frames;
+                return frame_number;
+            }
+        }
+        for (int i = 0; i < clock->frames; i++)
+        {
+            int frame_number = (clock->hand + i) % clock->frames;
+            if (!clock->referenced[frame_number])
+            {
+                clock->hand = (frame_number + 1) % clock->frames;
+                return frame_number;
+            }
+            clock->referenced[frame_number] = 0;
+        }
+    }
+}
+
+/*
+    LFU evicts the frame with the fewest references since it was loaded, breaking ties by least recent use. The key packs
+    a saturating 24-bit count above a 40-bit access index.
+*/
+#define LFU_COUNT_SHIFT 40
+#define LFU_MAX_COUNT ((1ULL << (64 - LFU_COUNT_SHIFT)) - 1)
+
+/* Heap policies key frames by something derived from the access index, so they keep a pointer to their simulator. */
+typedef struct Heap_policy
+{
+    Frame_heap heap;
+    const Simulator *simulator;
+} Heap_policy;
+
+static inline unsigned long long lfu_key(const Heap_policy *policy, unsigned long long count)
+{
+    return (count << LFU_COUNT_SHIFT) | (policy->simulator->current_access & ((1ULL << LFU_COUNT_SHIFT) - 1));
+}
+
+void *heap_policy_init(Simulator *simulator, int frames)
+{
+    Heap_policy *policy = malloc(sizeof(Heap_policy));
+    if (policy == NULL)
+    {
+        return NULL;
+    }
+    if (frame_heap_init(&policy->heap, frames) != 0)
+    {
+        frame_heap_free(&policy->heap);
+        free(policy);
+        return NULL;
+    }
+    policy->simulator = simulator;
+    return policy;
+}
+
+void heap_policy_checkpoint(void *state, int frames, Checkpoint *checkpoint)
+{
+    Frame_heap *heap = &((Heap_policy *)state)->heap;
+
+    checkpoint_bytes(checkpoint, heap->heap, frames * sizeof(int));
+    checkpoint_bytes(checkpoint, heap->position, frames * sizeof(int));
+    checkpoint_bytes(checkpoint, heap->key, frames * sizeof(unsigned long long));
+    CHECKPOINT_FIELD(checkpoint, heap->size);
+    checkpoint_indices(checkpoint, &heap->size, 1, 0, frames + 1);
+    checkpoint_indices(checkpoint, heap->heap, heap->size, 0, frames);
+    checkpoint_indices(checkpoint, heap->position, frames, -1, heap->size);
+}
+
+void heap_policy_destroy(void *state)
+{
+    frame_heap_free(&((Heap_policy *)state)->heap);
+    free(state);
+}
+
+int heap_policy_select_victim(void *state, unsigned long long page_number)
+{
+    (void)page_number;
+    return frame_heap_pop(&((Heap_policy *)state)->heap);
+}
+
+/* Key 0 sorts below every LFU count and every OPT next use, so a prefetched page is the first candidate until used. */
+void heap_policy_on_prefetch(void *state, int frame_number, unsigned long long page_number)
+{
+    (void)page_number;
+    frame_heap_set(&((Heap_policy *)state)->heap, frame_number, 0);
+}
+
+void heap_policy_on_remove(void *state, int frame_number)
+{
+    frame_heap_remove(&((Heap_policy *)state)->heap, frame_number);
+}
+
+void lfu_on_access(void *state, int frame_number)
+{
+    Heap_policy *policy = state;
+    unsigned long long count = policy->heap.key[frame_number] >> LFU_COUNT_SHIFT;
+
+    frame_heap_set(&policy->heap, frame_number, lfu_key(policy, count < LFU_MAX_COUNT ? count + 1 : count));
+}
+
+void lfu_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    Heap_policy *policy = state;
+
+    (void)page_number;
+    frame_heap_set(&policy->heap, frame_number, lfu_key(policy, 1));
+}
+
+/*
+    Belady's OPT evicts the page whose next reference is furthest in the future. It needs the whole trace up front (see
+    compute_next_use) and exists to give a lower bound on the fault count.
+*/
+void opt_on_access(void *state, int frame_number)
+{
+    Heap_policy *policy = state;
+
+    frame_heap_set(&policy->heap, frame_number, ~policy->simulator->next_use[policy->simulator->current_access]);
+}
+
+void opt_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    (void)page_number;
+    opt_on_access(state, frame_number);
+}
+
+/*
+    ARC (Megiddo and Modha) splits resident pages between T1 (seen once recently) and T2 (seen at least twice), and
+    remembers recently evicted pages in the ghost lists B1 and B2. A fault on a ghost moves the target size p of T1
+    towards whichever list would have kept the page. Resident nodes are frame numbers; ghost nodes are numbered from
+    frames up and are found by page through a hash map.
+*/
+enum
+{
+    ARC_NONE,
+    ARC_T1,
+    ARC_T2,
+    ARC_B1,
+    ARC_B2,
+    ARC_T1_PREFETCHED
+};
+
+typedef struct Arc_policy
+{
+    int capacity;
+    int target_t1;
+    Node_list t1, t2, b1, b2;
+    int *prev;
+    int *next;
+    unsigned long long *node_page;
+    unsigned char *node_list;
+    int *free_ghosts;
+    int free_ghost_count;
+    Page_map ghosts;
+    unsigned long long prepared_page;
+    int ghost_hit;
+} Arc_policy;
+
+void *arc_init(Simulator *simulator, int frames)
+{
+    (void)simulator;
+    Arc_policy *arc = malloc(sizeof(Arc_policy));
+    if (arc == NULL)
+    {
+        return NULL;
+    }
+
+    int nodes = 2 * frames + 1;
+    arc->capacity = frames;
+    arc->target_t1 = 0;
+    arc->prev = malloc(nodes * sizeof(int));
+    arc->next = malloc(nodes * sizeof(int));
+    arc->node_page = malloc(nodes * sizeof(unsigned long long));
+    arc->node_list = calloc(nodes, 1);
+    arc->free_ghosts = malloc((frames + 1) * sizeof(int));
+    arc->ghosts.keys = NULL;
+    arc->ghosts.values = NULL;
+    if (arc->prev == NULL || arc->next == NULL || arc->node_page == NULL || arc->node_list == NULL ||
+        arc->free_ghosts == NULL || page_map_init(&arc->ghosts, frames + 1) != 0)
+    {
+        free(arc->prev);
+        free(arc->next);
+        free(arc->node_page);
+        free(arc->node_list);
+        free(arc->free_ghosts);
+        page_map_free(&arc->ghosts);
+        free(arc);
+        return NULL;
+    }
+    node_list_init(&arc->t1, arc->prev, arc->next);
+    node_list_init(&arc->t2, arc->prev, arc->next);
+    node_list_init(&arc->b1, arc->prev, arc->next);
+    node_list_init(&arc->b2, arc->prev, arc->next);
+    arc->free_ghost_count = frames + 1;
+    for (int i = 0; i <= frames; i++)
+    {
+        arc->free_ghosts[i] = nodes - 1 - i;
+    }
+    arc->prepared_page = NO_PAGE;
+    arc->ghost_hit = ARC_NONE;
+    return arc;
+}
+
+void arc_checkpoint(void *state, int frames, Checkpoint *checkpoint)
+{
+    Arc_policy *arc = state;
+    size_t nodes = 2 * (size_t)frames + 1;
+
+    CHECKPOINT_FIELD(checkpoint, arc->target_t1);
+    checkpoint_indices(checkpoint, &arc->target_t1, 1, 0, frames + 1);
+    checkpoint_node_list(checkpoint, &arc->t1, (int)nodes);
+    checkpoint_node_list(checkpoint, &arc->t2, (int)nodes);
+    checkpoint_node_list(checkpoint, &arc->b1, (int)nodes);
+    checkpoint_node_list(checkpoint, &arc->b2, (int)nodes);
+    checkpoint_bytes(checkpoint, arc->prev, nodes * sizeof(int));
+    checkpoint_bytes(checkpoint, arc->next, nodes * sizeof(int));
+    checkpoint_indices(checkpoint, arc->prev, nodes, -1, (int)nodes);
+    checkpoint_indices(checkpoint, arc->next, nodes, -1, (int)nodes);
+    checkpoint_bytes(checkpoint, arc->node_page, nodes * sizeof(unsigned long long));
+    checkpoint_bytes(checkpoint, arc->node_list, nodes);
+    for (size_t i = 0; i < nodes && checkpoint->restoring; i++)
+    {
+        checkpoint->error |= arc->node_list[i] > ARC_T1_PREFETCHED;
+    }
+    checkpoint_bytes(checkpoint, arc->free_ghosts, (frames + 1) * sizeof(int));
+    CHECKPOINT_FIELD(checkpoint, arc->free_ghost_count);
+    checkpoint_indices(checkpoint, &arc->free_ghost_count, 1, 0, frames + 2);
+    checkpoint_indices(checkpoint, arc->free_ghosts, arc->free_ghost_count, frames, (int)nodes);
+    checkpoint_page_map(checkpoint, &arc->ghosts);
+    checkpoint_page_map_indices(checkpoint, &arc->ghosts, (long long)nodes);
+    CHECKPOINT_FIELD(checkpoint, arc->prepared_page);
+    CHECKPOINT_FIELD(checkpoint, arc->ghost_hit);
+}
+
+void arc_destroy(void *state)
+{
+    Arc_policy *arc = state;
+
+    free(arc->prev);
+    free(arc->next);
+    free(arc->node_page);
+    free(arc->node_list);
+    free(arc->free_ghosts);
+    page_map_free(&arc->ghosts);
+    free(arc);
+}
+
+static void arc_drop_ghost(Arc_policy *arc, Node_list *list)
+{
+    int node = node_list_pop_head(list);
+    if (node != -1)
+    {
+        page_map_remove(&arc->ghosts, arc->node_page[node]);
+        arc->node_list[node] = ARC_NONE;
+        arc->free_ghosts[arc->free_ghost_count++] = node;
+    }
+}
+
+static void arc_remember(Arc_policy *arc, int frame_number, Node_list *list, int list_id)
+{
+    if (arc->free_ghost_count == 0)
+    {
+        arc_drop_ghost(arc, arc->b1.size > 0 ? &arc->b1 : &arc->b2);
+    }
+
+    int node = arc->free_ghosts[--arc->free_ghost_count];
+    arc->node_page[node] = arc->node_page[frame_number];
+    arc->node_list[node] = list_id;
+    node_list_push_tail(list, node);
+    page_map_put(&arc->ghosts, arc->node_page[node], node);
+}
+
+/* Adapt p and trim the ghost lists for a fault on page_number; done once per fault. */
+static void arc_prepare(Arc_policy *arc, unsigned long long page_number)
+{
+    if (arc->prepared_page == page_number)
+    {
+        return;
+    }
+    arc->prepared_page = page_number;
+
+    int node = (int)page_map_get(&arc->ghosts, page_number);
+    arc->ghost_hit = node == -1 ? ARC_NONE : arc->node_list[node];
+
+    if (arc->ghost_hit == ARC_B1)
+    {
+        int delta = arc->b2.size > arc->b1.size ? arc->b2.size / arc->b1.size : 1;
+        arc->target_t1 = arc->target_t1 + delta < arc->capacity ? arc->target_t1 + delta : arc->capacity;
+    }
+    else if (arc->ghost_hit == ARC_B2)
+    {
+        int delta = arc->b1.size > arc->b2.size ? arc->b1.size / arc->b2.size : 1;
+        arc->target_t1 = arc->target_t1 - delta > 0 ? arc->target_t1 - delta : 0;
+    }
+    else if (arc->t1.size + arc->b1.size >= arc->capacity)
+    {
+        if (arc->t1.size < arc->capacity)
+        {
+            arc_drop_ghost(arc, &arc->b1);
+        }
+    }
+    else if (arc->t1.size + arc->t2.size + arc->b1.size + arc->b2.size >= 2 * arc->capacity)
+    {
+        arc_drop_ghost(arc, &arc->b2);
+    }
+}
+
+int arc_select_victim(void *state, unsigned long long page_number)
+{
+    Arc_policy *arc = state;
+    int victim_frame;
+
+    if (page_number != NO_PAGE)
+    {
+        arc_prepare(arc, page_number);
+    }
+
+    if (arc->ghost_hit == ARC_NONE && arc->t1.size >= arc->capacity)
+    {
+        victim_frame = node_list_pop_head(&arc->t1);
+        arc->node_list[victim_frame] = ARC_NONE;
+        return victim_frame;
+    }
+
+    int from_t1 = arc->t1.size > 0 && (arc->t1.size > arc->target_t1 || (arc->ghost_hit == ARC_B2 && arc->t1.size == arc->target_t1));
+    if (arc->t2.size == 0)
+    {
+        from_t1 = 1;
+    }
+
+    if (from_t1)
+    {
+        victim_frame = node_list_pop_head(&arc->t1);
+        arc_remember(arc, victim_frame, &arc->b1, ARC_B1);
+    }
+    else
+    {
+        victim_frame = node_list_pop_head(&arc->t2);
+        arc_remember(arc, victim_frame, &arc->b2, ARC_B2);
+    }
+    arc->node_list[victim_frame] = ARC_NONE;
+    return victim_frame;
+}
+
+void arc_on_fault(void *state, int frame_number, unsigned long long page_number)
+{
+    Arc_policy *arc = state;
+
+    arc_prepare(arc, page_number);
+    arc->node_page[frame_number] = page_number;
+
+    /* Prefetch victims chosen since arc_prepare may have pushed this page's ghost out. */
+    int node = arc->ghost_hit != ARC_NONE ? (int)page_map_get(&arc->ghosts, page_number) : -1;
+    if (node != -1)
+    {
+        node_list_remove(arc->node_list[node] == ARC_B1 ? &arc->b1 : &arc->b2, node);
+        page_map_remove(&arc->ghosts, page_number);
+        arc->node_list[node] = ARC_NONE;
+        arc->free_ghosts[arc->free_ghost_count++] = node;
+        node_list_push_tail(&arc->t2, frame_number);
+        arc->node_list[frame_number] = ARC_T2;
+    }
+    else
+    {
+        node_list_push_tail(&arc->t1, frame_number);
+        arc->node_list[frame_number] = ARC_T1;
+    }
+    arc->prepared_page = NO_PAGE;
+}
+
+/*
+    A prefetched page enters T1 at its LRU end and its first use moves it to the MRU end of T1, as a first reference
+    would; a ghost of it is forgotten without adapting p, since the read was not a fault.
+*/
+void arc_on_prefetch(void *state, int frame_number, unsigned long long page_number)
+{
+    Arc_policy *arc = state;
+    int node = (int)page_map_get(&arc->ghosts, page_number);
+
+    if (node != -1)
+    {
+        node_list_remove(arc->node_list[node] == ARC_B1 ? &arc->b1 : &arc->b2, node);
+        page_map_remove(&arc->ghosts, page_number);
+        arc->node_list[node] = ARC_NONE;
+        arc->free_ghosts[arc->free_ghost_count++] = node;
+    }
+    arc->node_page[frame_number] = page_number;
+    node_list_push_head(&arc->t1, frame_number);
+    arc->node_list[frame_number] = ARC_T1_PREFETCHED;
+}
+
+/* A released page simply leaves T1 or T2; it is not remembered as a ghost because no replacement decision made it go. */
+void arc_on_remove(void *state, int frame_number)
+{
+    Arc_policy *arc = state;
+
+    if (arc->node_list[frame_number] == ARC_T1 || arc->node_list[frame_number] == ARC_T1_PREFETCHED)
+    {
+        node_list_remove(&arc->t1, frame_number);
+    }
+    else if (arc->node_list[frame_number] == ARC_T2)
+    {
+        node_list_remove(&arc->t2, frame_number);
+    }
+    arc->node_list[frame_number] = ARC_NONE;
+}
+
+void arc_on_access(void *state, int frame_number)
+{
+    Arc_policy *arc = state;
+
+    if (arc->node_list[frame_number] == ARC_T1)
+    {
+        node_list_remove(&arc->t1, frame_number);
+        node_list_push_tail(&arc->t2, frame_number);
+        arc->node_list[frame_number] = ARC_T2;
+    }
+    else if (arc->node_list[frame_number] == ARC_T1_PREFETCHED)
+    {
+        node_list_move_to_tail(&arc->t1, frame_number);
+        arc->node_list[frame_number] = ARC_T1;
+    }
+    else
+    {
+        node_list_move_to_tail(&arc->t2, frame_number);
+    }
+}
+
+Replacement_policy replacement_policies[] = {
+    {"fifo", list_policy_init, fifo_on_access, ignore_write, list_policy_on_fault, list_policy_on_prefetch, list_policy_select_victim, list_policy_on_remove, list_policy_destroy, list_policy_checkpoint, 0},
+    {"lru", list_policy_init, lru_on_access, ignore_write, list_policy_on_fault, list_policy_on_prefetch, list_policy_select_victim, list_policy_on_remove, list_policy_destroy, list_policy_checkpoint, 0},
+    {"cflru", cflru_init, lru_on_access, cflru_on_write, cflru_on_fault, cflru_on_prefetch, cflru_select_victim, list_policy_on_remove, list_policy_destroy, list_policy_checkpoint, 0},
+    {"clock", clock_init, clock_on_access, clock_on_write, clock_on_fault, clock_on_prefetch, clock_select_victim, clock_on_remove, clock_destroy, clock_checkpoint, 0},
+    {"esc", clock_init, clock_on_access, clock_on_write, clock_on_fault, clock_on_prefetch, esc_select_victim, clock_on_remove, clock_destroy, clock_checkpoint, 0},
+    {"lfu", heap_policy_init, lfu_on_access, ignore_write, lfu_on_fault, heap_policy_on_prefetch, heap_policy_select_victim, heap_policy_on_remove, heap_policy_destroy, heap_policy_checkpoint, 0},
+    {"arc", arc_init, arc_on_access, ignore_write, arc_on_fault, arc_on_prefetch, arc_select_victim, arc_on_remove, arc_destroy, arc_checkpoint, 0},
+    {"opt", heap_policy_init, opt_on_access, ignore_write, opt_on_fault, heap_policy_on_prefetch, heap_policy_select_victim, heap_policy_on_remove, heap_policy_destroy, heap_policy_checkpoint, 1},
+};
+
+Replacement_policy *find_replacement_policy(char *name)
+{
+    for (size_t i = 0; i < sizeof(replacement_policies) / sizeof(replacement_policies[0]); i++)
+    {
+        if (strcmp(replacement_policies[i].name, name) == 0)
+        {
+            return &replacement_policies[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Tag probes: return the way in tags[0, count) equal to tag, or -1. count is always a multiple of TLB_TAG_BLOCK and
+    the padding holds TLB_INVALID_TAG, which no page number can match. The kernel is picked once by init_tlb.
+*/
+int tlb_probe_scalar(const unsigned long long *tags, int count, unsigned long long tag)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (tags[i] == tag)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+int tlb_probe_sse2(const unsigned long long *tags, int count, unsigned long long tag)
+{
+    __m128i key = _mm_set1_epi64x((long long)tag);
+
+    for (int i = 0; i < count; i += 2)
+    {
+        __m128i equal = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(tags + i)), key);
+        equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(equal));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2"))) int tlb_probe_avx2(const unsigned long long *tags, int count, unsigned long long tag)
+{
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+
+    for (int i = 0; i < count; i += 4)
+    {
+        __m256i equal = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *)(tags + i)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return -1;
+}
+#elif defined(__aarch64__)
+int tlb_probe_neon(const unsigned long long *tags, int count, unsigned long long tag)
+{
+    uint64x2_t key = vdupq_n_u64(tag);
+
+    for (int i = 0; i < count; i += 2)
+    {
+        uint64x2_t equal = vceqq_u64(vld1q_u64((const uint64_t *)(tags + i)), key);
+        if (vgetq_lane_u64(equal, 0))
+        {
+            return i;
+        }
+        if (vgetq_lane_u64(equal, 1))
+        {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+#endif
+
+typedef struct Tlb_probe
+{
+    const char *name;
+    int (*probe)(const unsigned long long *tags, int count, unsigned long long tag);
+} Tlb_probe;
+
+Tlb_probe tlb_probes[] = {
+    {"scalar", tlb_probe_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse2", tlb_probe_sse2},
+    {"avx2", tlb_probe_avx2},
+#elif defined(__aarch64__)
+    {"neon", tlb_probe_neon},
+#endif
+};
+
+/* "auto" (or NULL) picks the widest kernel the CPU supports; direct-mapped and 2-way sets always use scalar. */
+Tlb_probe *find_tlb_probe(const char *name, int ways)
+{
+    if (name == NULL || strcmp(name, "auto") == 0)
+    {
+        Tlb_probe *best = &tlb_probes[0];
+        if (ways <= 2)
+        {
+            return best;
+        }
+        for (size_t i = 1; i < sizeof(tlb_probes) / sizeof(tlb_probes[0]); i++)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            if (tlb_probes[i].probe == tlb_probe_avx2 && !__builtin_cpu_supports("avx2"))
+            {
+                continue;
+            }
+#endif
+            best = &tlb_probes[i];
+        }
+        return best;
+    }
+
+    for (size_t i = 0; i < sizeof(tlb_probes) / sizeof(tlb_probes[0]); i++)
+    {
+        if (strcmp(tlb_probes[i].name, name) == 0)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            if (tlb_probes[i].probe == tlb_probe_avx2 && !__builtin_cpu_supports("avx2"))
+            {
+                return NULL;
+            }
+#endif
+            return &tlb_probes[i];
+        }
+    }
+    return NULL;
+}
+
+/* Whether a TLB of size entries and ways ways (0 for fully associative) can be built; shared with the reference engine. */
+int check_tlb_geometry(int size, int ways)
+{
+    if (ways == 0)
+    {
+        ways = size;
+    }
+    if (size < 1 || size > MAX_TLB_SIZE || ways < 1 || ways > size || size % ways != 0)
+    {
+        printf("Error: TLB size must be between 1 and %d and a multiple of its associativity\n", MAX_TLB_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+int init_tlb(Tlb *tlb, int size, int ways, int replacement, const char *probe_name)
+{
+    memset(tlb, 0, sizeof(Tlb));
+    if (check_tlb_geometry(size, ways) != 0)
+    {
+        return -1;
+    }
+    if (ways == 0)
+    {
+        ways = size;
+    }
+
+    tlb->probe = find_tlb_probe(probe_name, ways);
+    if (tlb->probe == NULL)
+    {
+        printf("Error: TLB probe %s is not available\n", probe_name);
+        return -1;
+    }
+
+    tlb->size = size;
+    tlb->ways = ways;
+    tlb->stride = (ways + TLB_TAG_BLOCK - 1) / TLB_TAG_BLOCK * TLB_TAG_BLOCK;
+    tlb->sets = size / ways;
+    tlb->set_mask = (tlb->sets & (tlb->sets - 1)) == 0 ? tlb->sets - 1 : -1;
+    tlb->replacement = replacement;
+    tlb->random_state = 2463534242u;
+
+    size_t slots = (size_t)tlb->sets * tlb->stride;
+    tlb->tags = aligned_alloc(32, slots * sizeof(unsigned long long));
+    tlb->frames = malloc(slots * sizeof(int));
+    tlb->last_used = calloc(slots, sizeof(unsigned long long));
+    tlb->next_entry = calloc(tlb->sets, sizeof(int));
+    if (tlb->tags == NULL || tlb->frames == NULL || tlb->last_used == NULL || tlb->next_entry == NULL)
+    {
+        printf("Error: could not allocate TLB\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < slots; i++)
+    {
+        tlb->tags[i] = TLB_INVALID_TAG;
+        tlb->frames[i] = -1;
+    }
+    return 0;
+}
+
+void free_tlb(Tlb *tlb)
+{
+    free(tlb->tags);
+    free(tlb->frames);
+    free(tlb->last_used);
+    free(tlb->next_entry);
+}
+
+/* frames bounds the frame numbers of valid entries; empty slots hold whatever was last evicted from them. */
+void checkpoint_tlb(Checkpoint *checkpoint, Tlb *tlb, int frames)
+{
+    size_t slots = (size_t)tlb->sets * tlb->stride;
+
+    checkpoint_bytes(checkpoint, tlb->tags, slots * sizeof(unsigned long long));
+    checkpoint_bytes(checkpoint, tlb->frames, slots * sizeof(int));
+    for (size_t i = 0; i < slots && checkpoint->restoring && !checkpoint->error; i++)
+    {
+        checkpoint->error = tlb->tags[i] != TLB_INVALID_TAG && (tlb->frames[i] < 0 || tlb->frames[i] >= frames);
+    }
+    checkpoint_bytes(checkpoint, tlb->last_used, slots * sizeof(unsigned long long));
+    checkpoint_bytes(checkpoint, tlb->next_entry, tlb->sets * sizeof(int));
+    checkpoint_indices(checkpoint, tlb->next_entry, tlb->sets, 0, tlb->ways);
+    CHECKPOINT_FIELD(checkpoint, tlb->clock);
+    CHECKPOINT_FIELD(checkpoint, tlb->random_state);
+}
+
+static inline int tlb_set_of(const Tlb *tlb, unsigned long long key)
+{
+    return (int)(tlb->set_mask >= 0 ? key & tlb->set_mask : key % tlb->sets);
+}
+
+/* Returns the index of the entry holding the page with this key, or -1 on a miss. */
+int tlb_lookup(Tlb *tlb, unsigned long long key, int *frame_number)
+{
+    INSTRUMENT_START(timer);
+    int set_number = tlb_set_of(tlb, key);
+    int base = set_number * tlb->stride;
+    int way = tlb->probe->probe(tlb->tags + base, tlb->stride, key);
+
+    INSTRUMENT_STOP(PHASE_TLB_PROBE, timer);
+    INSTRUMENT_PROBE_DEPTH(way < 0 ? tlb->ways : way + 1);
+    if (way < 0)
+    {
+        return -1;
+    }
+    tlb->last_used[base + way] = ++tlb->clock;
+    *frame_number = tlb->frames[base + way];
+    return set_number * tlb->ways + way;
+}
+
+/*
+    Picks the entry that the page with this key will be cached in. FIFO keeps a round-robin pointer per set and, like
+    the hardware it models, does not look for invalid entries first; LRU and random fill an invalid way before evicting.
+*/
+int tlb_select_entry(Tlb *tlb, unsigned long long key)
+{
+    int set_number = tlb_set_of(tlb, key);
+    int base = set_number * tlb->stride;
+    int way = 0;
+
+    if (tlb->replacement == TLB_REPLACEMENT_FIFO)
+    {
+        way = tlb->next_entry[set_number];
+        tlb->next_entry[set_number] = (way + 1) % tlb->ways;
+        return set_number * tlb->ways + way;
+    }
+
+    for (int i = 0; i < tlb->ways; i++)
+    {
+        if (tlb->tags[base + i] == TLB_INVALID_TAG)
+        {
+            return set_number * tlb->ways + i;
+        }
+    }
+
+    if (tlb->replacement == TLB_REPLACEMENT_LRU)
+    {
+        for (int i = 1; i < tlb->ways; i++)
+        {
+            if (tlb->last_used[base + i] < tlb->last_used[base + way])
+            {
+                way = i;
+            }
+        }
+    }
+    else
+    {
+        tlb->random_state ^= tlb->random_state << 13;
+        tlb->random_state ^= tlb->random_state >> 17;
+        tlb->random_state ^= tlb->random_state << 5;
+        way = tlb->random_state % tlb->ways;
+    }
+    return set_number * tlb->ways + way;
+}
+
+void update_tlb(Tlb *tlb, unsigned long long key, int frame_number, int tlb_entry)
+{
+    int slot = tlb_entry / tlb->ways * tlb->stride + tlb_entry % tlb->ways;
+
+    tlb->tags[slot] = key;
+    tlb->frames[slot] = frame_number;
+    tlb->last_used[slot] = ++tlb->clock;
+}
+
+void invalidate_tlb_entry(Tlb *tlb, unsigned long long key)
+{
+    int base = tlb_set_of(tlb, key) * tlb->stride;
+    int way = tlb->probe->probe(tlb->tags + base, tlb->stride, key);
+
+    if (way >= 0)
+    {
+        tlb->tags[base + way] = TLB_INVALID_TAG;
+        tlb->frames[base + way] = -1;
+    }
+}
+
+/* Drops every entry, as an untagged TLB must on a context switch. The FIFO pointers keep their place. */
+void flush_tlb(Tlb *tlb)
+{
+    for (size_t i = 0; i < (size_t)tlb->sets * tlb->stride; i++)
+    {
+        tlb->tags[i] = TLB_INVALID_TAG;
+        tlb->frames[i] = -1;
+    }
+}
+
+/* Drops the entries of every page whose key shifted right by order equals region. */
+void invalidate_tlb_region(Tlb *tlb, unsigned long long region, int order)
+{
+    for (size_t i = 0; i < (size_t)tlb->sets * tlb->stride; i++)
+    {
+        if (tlb->tags[i] != TLB_INVALID_TAG && tlb->tags[i] >> order == region)
+        {
+            tlb->tags[i] = TLB_INVALID_TAG;
+            tlb->frames[i] = -1;
+        }
+    }
+}
+
+/*
+    Huge pages (--huge-page-size). A huge page covers an aligned region of 2^order base pages and is mapped by a single
+    TLB entry, tagged with the region number and HUGE_TLB_TAG so it cannot match a base page. Huge entries live in a
+    TLB of their own (--huge-tlb separate, fully associative) or share the base TLB (--huge-tlb unified), where a miss
+    on the base page probes again for its region.
+
+    Promotion follows khugepaged: a region whose base pages are all resident is promoted once it has taken
+    --promote-threshold accesses (by default one per base page) since it filled up. Its base entries are dropped, and
+    the next TLB miss in the region installs the huge entry. Evicting or releasing any base page of a promoted region
+    demotes it, splitting it back into base pages, and drops the huge entry. The model is one of TLB reach: frames are
+    not moved to make a huge page physically contiguous, so a huge-entry hit reads the page's frame from the page table
+    (not charged as a walk) and reports the physical address of that frame.
+
+    To show what huge pages buy, a shadow TLB of the same shape as the base TLB is run on base pages only, with the
+    same invalidations and flushes; its hits are reported next to the real ones.
+*/
+#define HUGE_TLB_TAG (1ULL << 63)
+#define DEFAULT_HUGE_TLB_SIZE 8
+#define MAX_HUGE_PAGE_BITS 30
+#define HUGE_REGION_RESIDENT_MASK 0x7FFFFFFFLL
+#define HUGE_REGION_PROMOTED (1LL << 31)
+#define HUGE_REGION_ACCESS_SHIFT 32
+
+int huge_page_bits = 0;
+int huge_tlb_separate = 1;
+int huge_tlb_size = DEFAULT_HUGE_TLB_SIZE;
+int promote_threshold = 0;
+
+typedef struct Huge_pages
+{
+    int order;
+    int threshold;
+    Tlb tlb;      /* huge entries with a separate TLB */
+    Tlb base_tlb; /* shadow TLB of base pages only */
+    Page_map regions; /* region -> resident base pages | HUGE_REGION_PROMOTED | accesses since it filled up << 32 */
+    unsigned long long promotions;
+    unsigned long long demotions;
+    unsigned long long huge_tlb_hits;
+    unsigned long long base_tlb_hits;
+} Huge_pages;
+
+void free_huge_pages(Huge_pages *huge)
+{
+    if (huge == NULL)
+    {
+        return;
+    }
+    free_tlb(&huge->tlb);
+    free_tlb(&huge->base_tlb);
+    page_map_free(&huge->regions);
+    free(huge);
+}
+
+Huge_pages *init_huge_pages(const Tlb *base_tlb, const char *probe_name)
+{
+    Huge_pages *huge = calloc(1, sizeof(Huge_pages));
+    if (huge == NULL)
+    {
+        printf("Error: could not allocate huge-page tracking\n");
+        return NULL;
+    }
+    huge->order = huge_page_bits - geometry.offset_bits;
+    huge->threshold = promote_threshold > 0 ? promote_threshold : 1 << huge->order;
+    if ((huge_tlb_separate && init_tlb(&huge->tlb, huge_tlb_size, 0, base_tlb->replacement, probe_name) != 0) ||
+        init_tlb(&huge->base_tlb, base_tlb->size, base_tlb->ways, base_tlb->replacement, probe_name) != 0)
+    {
+        free_huge_pages(huge);
+        return NULL;
+    }
+    if (page_map_init(&huge->regions, 1024) != 0)
+    {
+        printf("Error: could not allocate huge-page tracking\n");
+        free_huge_pages(huge);
+        return NULL;
+    }
+    return huge;
+}
+
+static inline Tlb *huge_tlb(Simulator *simulator)
+{
+    return huge_tlb_separate ? &simulator->huge_pages->tlb : &simulator->tlb;
+}
+
+static inline unsigned long long huge_tag(const Huge_pages *huge, unsigned long long key)
+{
+    return (key >> huge->order) | HUGE_TLB_TAG;
+}
+
+static inline int huge_region_promoted(Simulator *simulator, unsigned long long key)
+{
+    Huge_pages *huge = simulator->huge_pages;
+    long long state = page_map_get(&huge->regions, key >> huge->order);
+
+    return state != -1 && (state & HUGE_REGION_PROMOTED) != 0;
+}
+
+/* A base page of the region came into (delta 1) or left (delta -1) memory. */
+void huge_page_residency(Simulator *simulator, unsigned long long key, int delta)
+{
+    Huge_pages *huge = simulator->huge_pages;
+    unsigned long long region = key >> huge->order;
+    long long state = page_map_get(&huge->regions, region);
+    long long resident = state == -1 ? 0 : state & HUGE_REGION_RESIDENT_MASK;
+
+    if (delta < 0)
+    {
+        if (state != -1 && (state & HUGE_REGION_PROMOTED) != 0)
+        {
+            invalidate_tlb_entry(huge_tlb(simulator), huge_tag(huge, key));
+            huge->demotions++;
+        }
+        invalidate_tlb_entry(&huge->base_tlb, key);
+        state = resident - 1;
+    }
+    else
+    {
+        state = resident + 1;
+    }
+    if (state == 0)
+    {
+        page_map_remove(&huge->regions, region);
+    }
+    else
+    {
+        page_map_put(&huge->regions, region, state);
+    }
+}
+
+/* Called after every access with huge pages on: counts it towards promotion and replays it on the shadow TLB. */
+void huge_page_access(Simulator *simulator, unsigned long long key)
+{
+    Huge_pages *huge = simulator->huge_pages;
+    unsigned long long region = key >> huge->order;
+    long long state = page_map_get(&huge->regions, region);
+    int frame_number;
+
+    if (tlb_lookup(&huge->base_tlb, key, &frame_number) >= 0)
+    {
+        huge->base_tlb_hits++;
+    }
+    else
+    {
+        update_tlb(&huge->base_tlb, key, -1, tlb_select_entry(&huge->base_tlb, key));
+    }
+
+    /* A missing region (-1) has every bit set, so it is ruled out before the bits are read. */
+    if (state == -1 || (state & HUGE_REGION_PROMOTED) || (state & HUGE_REGION_RESIDENT_MASK) != 1LL << huge->order)
+    {
+        return;
+    }
+    state += 1LL << HUGE_REGION_ACCESS_SHIFT;
+    if (state >> HUGE_REGION_ACCESS_SHIFT >= huge->threshold)
+    {
+        state = (state & HUGE_REGION_RESIDENT_MASK) | HUGE_REGION_PROMOTED;
+        invalidate_tlb_region(&simulator->tlb, region, huge->order);
+        if (simulator->l2_tlb.size > 0)
+        {
+            invalidate_tlb_region(&simulator->l2_tlb, region, huge->order);
+        }
+        huge->promotions++;
+    }
+    page_map_put(&huge->regions, region, state);
+}
+
+/*
+    After a miss in the base TLB: probes for the huge entry of the page's region and returns the TLB index to report
+    (past the base entries for a separate huge TLB), or -1.
+*/
+int huge_tlb_lookup(Simulator *simulator, unsigned long long key, unsigned long long page_number, int *frame_number)
+{
+    Huge_pages *huge = simulator->huge_pages;
+    Tlb *tlb = huge_tlb(simulator);
+    int references;
+    int index = tlb_lookup(tlb, huge_tag(huge, key), frame_number);
+
+    if (index < 0)
+    {
+        return -1;
+    }
+    *frame_number = page_table_type->lookup(simulator->current_process->page_table, simulator->current_asid, page_number, &references);
+    huge->huge_tlb_hits++;
+    return tlb == &simulator->tlb ? index : simulator->tlb.size + index;
+}
+
+/*
+    Two-level TLB (--l2-tlb-size). The TLB above is the L1; an L1 miss probes a second-level TLB before walking the page
+    table. Inclusive: every translation filled into the L1 is also filled into the L2, and an entry the L2 evicts is
+    dropped from the L1 too. Exclusive: the L2 only holds what the L1 evicted (a victim TLB); an L2 hit moves the entry
+    up and the L1 victim down. Huge-page entries stay in the L1 level.
+
+    AMAT charges every access an L1 lookup and a memory reference, every L1 miss an L2 lookup, every walk its memory
+    references and every fault a backing-store read of --fault-latency cycles. Memory references cost --walk-latency.
+*/
+#define DEFAULT_L1_TLB_LATENCY 1
+#define DEFAULT_L2_TLB_LATENCY 8
+#define DEFAULT_FAULT_LATENCY 100000
+
+enum
+{
+    TLB_INCLUSIVE,
+    TLB_EXCLUSIVE
+};
+
+const char *tlb_inclusion_names[] = {"inclusive", "exclusive"};
+
+int l2_tlb_size = 0;
+int l2_tlb_ways = 0;
+int tlb_inclusion = TLB_INCLUSIVE;
+int l1_tlb_latency = DEFAULT_L1_TLB_LATENCY;
+int l2_tlb_latency = DEFAULT_L2_TLB_LATENCY;
+int fault_latency = DEFAULT_FAULT_LATENCY;
+
+/* The tag in entry tlb_entry (TLB_INVALID_TAG if it is free), and its frame. */
+static inline unsigned long long tlb_entry_tag(const Tlb *tlb, int tlb_entry, int *frame_number)
+{
+    int slot = tlb_entry / tlb->ways * tlb->stride + tlb_entry % tlb->ways;
+
+    *frame_number = tlb->frames[slot];
+    return tlb->tags[slot];
+}
+
+static void fill_l2_tlb(Simulator *simulator, unsigned long long tag, int frame_number)
+{
+    Tlb *l2 = &simulator->l2_tlb;
+    int l2_entry = tlb_select_entry(l2, tag);
+    int evicted_frame;
+    unsigned long long evicted = tlb_entry_tag(l2, l2_entry, &evicted_frame);
+
+    update_tlb(l2, tag, frame_number, l2_entry);
+    if (tlb_inclusion == TLB_INCLUSIVE && evicted != TLB_INVALID_TAG && evicted != tag)
+    {
+        invalidate_tlb_entry(&simulator->tlb, evicted);
+    }
+}
+
+/* Installs tag in L1 entry tlb_entry and keeps the L2 in step; from_l2 is set when the L2 supplied the translation. */
+void fill_tlb_hierarchy(Simulator *simulator, unsigned long long tag, int frame_number, int tlb_entry, int from_l2)
+{
+    int victim_frame;
+    unsigned long long victim = tlb_entry_tag(&simulator->tlb, tlb_entry, &victim_frame);
+
+    update_tlb(&simulator->tlb, tag, frame_number, tlb_entry);
+    if (simulator->l2_tlb.size == 0)
+    {
+        return;
+    }
+    if (tlb_inclusion == TLB_INCLUSIVE)
+    {
+        if (!from_l2 && !(tag & HUGE_TLB_TAG))
+        {
+            fill_l2_tlb(simulator, tag, frame_number);
+        }
+    }
+    else if (victim != TLB_INVALID_TAG && victim != tag && !(victim & HUGE_TLB_TAG))
+    {
+        fill_l2_tlb(simulator, victim, victim_frame);
+    }
+}
+
+/* On an L1 miss: the frame from the L2, or -1. An exclusive L2 gives the entry up to the L1. */
+static inline int l2_tlb_lookup(Simulator *simulator, unsigned long long key)
+{
+    int frame_number;
+
+    if (tlb_lookup(&simulator->l2_tlb, key, &frame_number) < 0)
+    {
+        return -1;
+    }
+    if (tlb_inclusion == TLB_EXCLUSIVE)
+    {
+        invalidate_tlb_entry(&simulator->l2_tlb, key);
+    }
+    simulator->l2_tlb_hit_counter++;
+    return frame_number;
+}
+
+/* The page left memory: its translation is dropped from every TLB level. */
+static inline void invalidate_translation(Simulator *simulator, unsigned long long key)
+{
+    invalidate_tlb_entry(&simulator->tlb, key);
+    if (simulator->l2_tlb.size > 0)
+    {
+        invalidate_tlb_entry(&simulator->l2_tlb, key);
+    }
+}
+
+/* Bytes of address space the valid entries of tlb map. */
+unsigned long long tlb_reach(const Tlb *tlb, int order)
+{
+    unsigned long long reach = 0;
+
+    for (size_t i = 0; i < (size_t)tlb->sets * tlb->stride; i++)
+    {
+        if (tlb->tags[i] != TLB_INVALID_TAG)
+        {
+            reach += (tlb->tags[i] & HUGE_TLB_TAG ? 1ULL << order : 1) << geometry.offset_bits;
+        }
+    }
+    return reach;
+}
+
+int open_backing_store(char *path)
+{
+    struct stat file_status;
+
+    backing_store.fd = open(path, writable_store ? O_RDWR : O_RDONLY);
+    if (backing_store.fd < 0 || fstat(backing_store.fd, &file_status) != 0)
+    {
+        printf("Error: could not open backing storage file\n");
+        return -1;
+    }
+
+    backing_store.size = file_status.st_size;
+    backing_store.map = NULL;
+    if (backing_store.size > 0)
+    {
+        char *map = writable_store ? mmap(NULL, backing_store.size, PROT_READ | PROT_WRITE, MAP_SHARED, backing_store.fd, 0)
+                                   : mmap(NULL, backing_store.size, PROT_READ, MAP_PRIVATE, backing_store.fd, 0);
+        if (map != MAP_FAILED)
+        {
+            backing_store.map = map;
+        }
+    }
+    return 0;
+}
+
+void read_page_from_backing_store(unsigned long long page_number, char *destination)
+{
+    size_t page_size = geometry.page_size;
+    size_t position = (size_t)(page_number << geometry.offset_bits);
+    size_t length = 0;
+    INSTRUMENT_START(timer);
+
+    if (backing_store.map != NULL)
+    {
+        if (position < backing_store.size)
+        {
+            length = backing_store.size - position < page_size ? backing_store.size - position : page_size;
+            memcpy(destination, backing_store.map + position, length);
+        }
+    }
+    else
+    {
+        ssize_t bytes_read = position < backing_store.size ? pread(backing_store.fd, destination, page_size, position) : 0;
+        length = bytes_read > 0 ? (size_t)bytes_read : 0;
+    }
+
+    if (length < page_size)
+    {
+        memset(destination + length, 0, page_size - length);
+    }
+    INSTRUMENT_STOP(PHASE_STORE_IO, timer);
+}
+
+void close_backing_store()
+{
+    if (backing_store.map != NULL)
+    {
+        munmap(backing_store.map, backing_store.size);
+    }
+    if (backing_store.fd >= 0)
+    {
+        close(backing_store.fd);
+    }
+}
+
+/*
+    Asynchronous backing-store reads (--async-io). check_tlb looks ahead in the current chunk of the trace and submits
+    the read of every upcoming page that is not resident into a staging slot, keeping up to --io-depth reads in
+    flight. A page that was resident when scanned but is evicted before its access is submitted at eviction time.
+    Reads complete in any order; when the fault for a page is handled, its slot is waited for and copied into the
+    victim frame. Which page goes into which frame is still decided in trace order, so the results are identical to
+    synchronous reads. A fault with no read in flight (the slots were all busy) reads synchronously.
+
+    Reads go through the file descriptor rather than the mapping, so they reach the device the way a pager's would.
+    io_uring is driven through its raw system calls; where it cannot be set up, a pool of threads issues pread calls.
+*/
+#define DEFAULT_IO_DEPTH 32
+#define MAX_IO_DEPTH 4096
+#define DEFAULT_IO_THREADS 4
+
+enum
+{
+    ASYNC_IO_OFF,
+    ASYNC_IO_URING,
+    ASYNC_IO_THREADS
+};
+
+const char *async_io_names[] = {"off", "uring", "threads"};
+
+int async_io = ASYNC_IO_OFF;
+int io_depth = DEFAULT_IO_DEPTH;
+int io_threads = DEFAULT_IO_THREADS;
+
+enum
+{
+    IO_SLOT_FREE,
+    IO_SLOT_PENDING,
+    IO_SLOT_READY
+};
+
+typedef struct Io_slot
+{
+    unsigned long long page_number;
+    char *buffer;
+    int state;
+    int stale; /* a write-back of the page overtook the read */
+    ssize_t result;
+} Io_slot;
+
+#ifdef HAVE_IO_URING
+typedef struct Io_ring
+{
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned unsubmitted;
+} Io_ring;
+#endif
+
+typedef struct Page_reader
+{
+    int engine;
+    int depth;
+    Io_slot *slots;
+    char *buffers;
+    size_t buffers_size;
+    int *free_slots;
+    int free_count;
+    Page_map in_flight; /* key -> slot of every read that has not been consumed yet */
+    Page_map upcoming;  /* key -> access index, for scanned accesses whose page was resident when scanned */
+    Page_map newer;     /* keys of pages whose latest contents are not in the file, which are never read ahead */
+#ifdef HAVE_IO_URING
+    Io_ring ring;
+#endif
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int *queue;
+    int queue_head;
+    int queue_count;
+    int stopping;
+
+    unsigned long long submitted;
+    unsigned long long used;
+    unsigned long long wasted; /* completed reads not used: stale, failed, or the page came from the zswap pool */
+    unsigned long long synchronous;
+    double wait_seconds;
+} Page_reader;
+
+#ifdef HAVE_IO_URING
+static int io_ring_init(Io_ring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(Io_ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void io_ring_destroy(Io_ring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+}
+
+/* Queues a read; it reaches the kernel at the next io_ring_submit. There are never more reads than ring entries. */
+static void io_ring_queue_read(Io_ring *ring, int slot_index, char *buffer, size_t length, unsigned long long position)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = backing_store.fd;
+    sqe->addr = (unsigned long long)(uintptr_t)buffer;
+    sqe->len = (unsigned)length;
+    sqe->off = position;
+    sqe->user_data = (unsigned long long)slot_index;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+}
+
+static int io_ring_submit(Io_ring *ring, int wait)
+{
+    while (ring->unsubmitted > 0 || wait)
+    {
+        int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted < 0)
+        {
+            return -1;
+        }
+        ring->unsubmitted -= (unsigned)submitted;
+        wait = 0;
+    }
+    return 0;
+}
+
+/* Marks every completed read ready. */
+static void io_ring_reap(Page_reader *reader)
+{
+    Io_ring *ring = &reader->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        Io_slot *slot = &reader->slots[cqe->user_data];
+        slot->result = cqe->res;
+        slot->state = IO_SLOT_READY;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+static void *io_worker(void *argument)
+{
+    Page_reader *reader = argument;
+
+    pthread_mutex_lock(&reader->lock);
+    for (;;)
+    {
+        while (reader->queue_count == 0 && !reader->stopping)
+        {
+            pthread_cond_wait(&reader->work, &reader->lock);
+        }
+        if (reader->queue_count == 0)
+        {
+            break;
+        }
+
+        Io_slot *slot = &reader->slots[reader->queue[reader->queue_head]];
+        reader->queue_head = (reader->queue_head + 1) % reader->depth;
+        reader->queue_count--;
+        pthread_mutex_unlock(&reader->lock);
+
+        ssize_t result = pread(backing_store.fd, slot->buffer, geometry.page_size, (off_t)(slot->page_number << geometry.offset_bits));
+
+        pthread_mutex_lock(&reader->lock);
+        slot->result = result;
+        slot->state = IO_SLOT_READY;
+        pthread_cond_signal(&reader->done);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+static int start_io_threads(Page_reader *reader)
+{
+    reader->threads = malloc(io_threads * sizeof(pthread_t));
+    reader->queue = malloc(reader->depth * sizeof(int));
+    if (reader->threads == NULL || reader->queue == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->work, NULL);
+    pthread_cond_init(&reader->done, NULL);
+    reader->engine = ASYNC_IO_THREADS;
+    for (int i = 0; i < io_threads; i++)
+    {
+        if (pthread_create(&reader->threads[i], NULL, io_worker, reader) != 0)
+        {
+            return -1;
+        }
+        reader->thread_count++;
+    }
+    return 0;
+}
+
+/* Waits for reads still in flight, then tears the reader down. */
+void free_page_reader(Page_reader *reader)
+{
+    if (reader == NULL)
+    {
+        return;
+    }
+#ifdef HAVE_IO_URING
+    if (reader->engine == ASYNC_IO_URING)
+    {
+        for (;;)
+        {
+            int pending = 0;
+            for (int i = 0; i < reader->depth; i++)
+            {
+                pending += reader->slots[i].state == IO_SLOT_PENDING;
+            }
+            if (pending == 0 || io_ring_submit(&reader->ring, 1) != 0)
+            {
+                break;
+            }
+            io_ring_reap(reader);
+        }
+        io_ring_destroy(&reader->ring);
+    }
+#endif
+    if (reader->engine == ASYNC_IO_THREADS)
+    {
+        pthread_mutex_lock(&reader->lock);
+        reader->stopping = 1;
+        pthread_cond_broadcast(&reader->work);
+        pthread_mutex_unlock(&reader->lock);
+        for (int i = 0; i < reader->thread_count; i++)
+        {
+            pthread_join(reader->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->work);
+        pthread_cond_destroy(&reader->done);
+    }
+    if (reader->buffers != NULL)
+    {
+        munmap(reader->buffers, reader->buffers_size);
+    }
+    free(reader->threads);
+    free(reader->queue);
+    free(reader->slots);
+    free(reader->free_slots);
+    page_map_free(&reader->in_flight);
+    page_map_free(&reader->upcoming);
+    page_map_free(&reader->newer);
+    free(reader);
+}
+
+/* engine is ASYNC_IO_URING or ASYNC_IO_THREADS; io_uring falls back to threads when the kernel refuses it. */
+Page_reader *init_page_reader(int engine, int depth)
+{
+    Page_reader *reader = calloc(1, sizeof(Page_reader));
+    if (reader == NULL)
+    {
+        printf("Error: could not allocate asynchronous I/O\n");
+        return NULL;
+    }
+    reader->depth = depth;
+    reader->buffers_size = (size_t)depth << geometry.offset_bits;
+    reader->buffers = mmap(NULL, reader->buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    reader->slots = calloc(depth, sizeof(Io_slot));
+    reader->free_slots = malloc(depth * sizeof(int));
+    if (reader->buffers == MAP_FAILED)
+    {
+        reader->buffers = NULL;
+    }
+    if (reader->buffers == NULL || reader->slots == NULL || reader->free_slots == NULL || page_map_init(&reader->in_flight, depth) != 0 ||
+        page_map_init(&reader->upcoming, depth) != 0 || page_map_init(&reader->newer, 16) != 0)
+    {
+        printf("Error: could not allocate asynchronous I/O\n");
+        free_page_reader(reader);
+        return NULL;
+    }
+    for (int i = 0; i < depth; i++)
+    {
+        reader->slots[i].buffer = reader->buffers + ((size_t)i << geometry.offset_bits);
+        reader->free_slots[i] = depth - 1 - i;
+    }
+    reader->free_count = depth;
+
+#ifdef HAVE_IO_URING
+    if (engine == ASYNC_IO_URING)
+    {
+        if (io_ring_init(&reader->ring, (unsigned)depth) == 0)
+        {
+            reader->engine = ASYNC_IO_URING;
+            return reader;
+        }
+        io_ring_destroy(&reader->ring);
+    }
+#endif
+    (void)engine;
+    if (start_io_threads(reader) != 0)
+    {
+        printf("Error: could not start asynchronous I/O threads\n");
+        free_page_reader(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+/*
+    Starts reading page_number for key unless it is already in flight. Pages past the end of the store need no read,
+    and pages written back since the run started may not be in the file yet; they are read synchronously.
+*/
+void page_reader_submit(Page_reader *reader, unsigned long long key, unsigned long long page_number)
+{
+    unsigned long long position = page_number << geometry.offset_bits;
+
+    if (reader->free_count == 0 || position >= backing_store.size || page_map_get(&reader->in_flight, key) != -1 ||
+        (reader->newer.count > 0 && page_map_get(&reader->newer, key) != -1))
+    {
+        return;
+    }
+
+    int slot_index = reader->free_slots[--reader->free_count];
+    Io_slot *slot = &reader->slots[slot_index];
+    slot->page_number = page_number;
+    slot->state = IO_SLOT_PENDING;
+    slot->stale = 0;
+    page_map_put(&reader->in_flight, key, slot_index);
+    reader->submitted++;
+#ifdef HAVE_IO_URING
+    if (reader->engine == ASYNC_IO_URING)
+    {
+        io_ring_queue_read(&reader->ring, slot_index, slot->buffer, geometry.page_size, position);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&reader->lock);
+    reader->queue[(reader->queue_head + reader->queue_count) % reader->depth] = slot_index;
+    reader->queue_count++;
+    pthread_cond_signal(&reader->work);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/*
+    A page left memory; if the look-ahead saw it resident on its way to an upcoming access, read it again now, unless
+    it went into the zswap pool (pooled), which will serve it.
+*/
+void page_reader_evicted(Page_reader *reader, unsigned long long key, unsigned long long current_access, int pooled)
+{
+    long long access = page_map_get(&reader->upcoming, key);
+
+    if (access != -1)
+    {
+        page_map_remove(&reader->upcoming, key);
+        if ((unsigned long long)access > current_access && !pooled)
+        {
+            page_reader_submit(reader, key, key & geometry.page_mask);
+        }
+    }
+}
+
+/*
+    The page is being written back: a read of it still in flight would hand out its old contents, so it is dropped when
+    taken. Until marked current again the page is not read ahead.
+*/
+void page_reader_invalidate(Page_reader *reader, unsigned long long key)
+{
+    long long slot_index = page_map_get(&reader->in_flight, key);
+
+    if (slot_index != -1)
+    {
+        reader->slots[slot_index].stale = 1;
+    }
+    page_map_put(&reader->newer, key, 1);
+}
+
+/* The file holds the latest contents of the page again. */
+void page_reader_mark_current(Page_reader *reader, unsigned long long key)
+{
+    page_map_remove(&reader->newer, key);
+}
+
+/*
+    Hands the reads queued by page_reader_submit to the kernel in one system call, once a quarter of the depth has
+    built up; waiting for a read submits whatever is still queued.
+*/
+void page_reader_flush(Page_reader *reader)
+{
+#ifdef HAVE_IO_URING
+    if (reader->engine == ASYNC_IO_URING && reader->ring.unsubmitted * 4 >= (unsigned)reader->depth)
+    {
+        io_ring_submit(&reader->ring, 0);
+    }
+#else
+    (void)reader;
+#endif
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Blocks until the read in slot completes (or the ring fails), charging the time to wait_seconds. */
+static void wait_for_slot(Page_reader *reader, Io_slot *slot)
+{
+    struct timespec start;
+
+#ifdef HAVE_IO_URING
+    if (reader->engine == ASYNC_IO_URING)
+    {
+        io_ring_reap(reader);
+        if (slot->state != IO_SLOT_READY)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            while (slot->state != IO_SLOT_READY && io_ring_submit(&reader->ring, 1) == 0)
+            {
+                io_ring_reap(reader);
+            }
+            reader->wait_seconds += seconds_since(&start);
+        }
+        return;
+    }
+#endif
+    pthread_mutex_lock(&reader->lock);
+    if (slot->state != IO_SLOT_READY)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (slot->state != IO_SLOT_READY)
+        {
+            pthread_cond_wait(&reader->done, &reader->lock);
+        }
+        reader->wait_seconds += seconds_since(&start);
+    }
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/*
+    Copies the read of key into destination once it completes and frees its slot. Returns 0 when no read was
+    submitted for key, or it failed or went stale, so the caller reads synchronously. A NULL destination discards the
+    read, for a page found elsewhere.
+*/
+int page_reader_take(Page_reader *reader, unsigned long long key, char *destination)
+{
+    long long slot_index = page_map_get(&reader->in_flight, key);
+    if (slot_index == -1)
+    {
+        return 0;
+    }
+
+    Io_slot *slot = &reader->slots[slot_index];
+    wait_for_slot(reader, slot);
+
+    page_map_remove(&reader->in_flight, key);
+    if (slot->state != IO_SLOT_READY)
+    {
+        return 0; /* the ring failed; the slot stays out of use since the kernel may still write to it */
+    }
+
+    int served = slot->result >= 0 && !slot->stale && destination != NULL;
+    if (served)
+    {
+        size_t length = (size_t)slot->result;
+        memcpy(destination, slot->buffer, length);
+        memset(destination + length, 0, geometry.page_size - length);
+        reader->used++;
+    }
+    else
+    {
+        reader->wasted++;
+    }
+    slot->state = IO_SLOT_FREE;
+    reader->free_slots[reader->free_count++] = (int)slot_index;
+    return served;
+}
+
+/*
+    Write-back. A write access stores into its frame and marks it dirty, and a dirty frame is written back when its page
+    leaves memory. Write-backs are copied into a queue of --writeback-batch pages that is flushed to the store, sorted by
+    page number, when it fills and at the end of the run, so the store sees runs of neighbouring pages rather than one
+    write per eviction. Until it is flushed, a queued page is read back out of the queue.
+
+    Every process reads the same store, but its writes are its own: written pages are kept by page key. By default the
+    backing store is a read-only input shared by every simulator of a sweep, so written pages become private copies
+    held by the simulator, and later reads of the page come from the copy. With --writable-store (single-process
+    traces only) the file is opened read-write and mapped shared: write-backs go into the mapping, leaving the kernel
+    to write them to the device, and the frames still dirty at the end of the run are written back as well. Pages that
+    do not fit within the file stay private copies; the file is never extended.
+*/
+#define DEFAULT_WRITEBACK_BATCH 16
+#define MAX_WRITEBACK_BATCH 4096
+
+int writeback_batch = DEFAULT_WRITEBACK_BATCH;
+
+typedef struct Writeback_entry
+{
+    unsigned long long key;
+    int slot;
+} Writeback_entry;
+
+typedef struct Store_writer
+{
+    Writeback_entry *queue;
+    char *buffers; /* one page per queue slot */
+    int capacity;
+    int count;
+    Page_map queued; /* key -> queue slot */
+    Page_map copies; /* key -> index of its private copy */
+    char *copy_data;
+    size_t copy_count;
+    size_t copy_capacity;
+} Store_writer;
+
+void free_store_writer(Store_writer *writer)
+{
+    if (writer == NULL)
+    {
+        return;
+    }
+    free(writer->queue);
+    free(writer->buffers);
+    page_map_free(&writer->queued);
+    page_map_free(&writer->copies);
+    free(writer->copy_data);
+    free(writer);
+}
+
+Store_writer *init_store_writer(int capacity)
+{
+    Store_writer *writer = calloc(1, sizeof(Store_writer));
+    if (writer == NULL)
+    {
+        printf("Error: could not allocate write-back queue\n");
+        return NULL;
+    }
+    writer->capacity = capacity;
+    writer->queue = malloc(capacity * sizeof(Writeback_entry));
+    writer->buffers = malloc((size_t)capacity << geometry.offset_bits);
+    if (writer->queue == NULL || writer->buffers == NULL || page_map_init(&writer->queued, capacity) != 0 ||
+        page_map_init(&writer->copies, 16) != 0)
+    {
+        printf("Error: could not allocate write-back queue\n");
+        free_store_writer(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/* The private copy of a page, created on first use. Like page_map_put, running out of memory here ends the program. */
+static char *private_copy(Store_writer *writer, unsigned long long key)
+{
+    long long index = page_map_get(&writer->copies, key);
+
+    if (index == -1)
+    {
+        if (writer->copy_count == writer->copy_capacity)
+        {
+            size_t capacity = writer->copy_capacity > 0 ? writer->copy_capacity * 2 : 16;
+            char *copy_data = realloc(writer->copy_data, capacity << geometry.offset_bits);
+            if (copy_data == NULL)
+            {
+                printf("Error: could not grow private page copies\n");
+                exit(1);
+            }
+            writer->copy_data = copy_data;
+            writer->copy_capacity = capacity;
+        }
+        index = (long long)writer->copy_count++;
+        page_map_put(&writer->copies, key, index);
+    }
+    return writer->copy_data + ((size_t)index << geometry.offset_bits);
+}
+
+static void write_page_to_store(Simulator *simulator, unsigned long long key, const char *data)
+{
+    size_t page_size = geometry.page_size;
+    size_t position = (size_t)((key & geometry.page_mask) << geometry.offset_bits);
+    INSTRUMENT_START(timer);
+
+    if (writable_store && position + page_size <= backing_store.size)
+    {
+        if (backing_store.map != NULL)
+        {
+            memcpy(backing_store.map + position, data, page_size);
+        }
+        else if (pwrite(backing_store.fd, data, page_size, position) != (ssize_t)page_size)
+        {
+            printf("Error: could not write to the backing store\n");
+            exit(1);
+        }
+        if (simulator->page_reader != NULL)
+        {
+            page_reader_mark_current(simulator->page_reader, key);
+        }
+    }
+    else
+    {
+        memcpy(private_copy(simulator->store_writer, key), data, page_size);
+    }
+    INSTRUMENT_STOP(PHASE_STORE_IO, timer);
+    simulator->bytes_written += page_size;
+}
+
+static int compare_writeback_entries(const void *a, const void *b)
+{
+    unsigned long long first = ((const Writeback_entry *)a)->key;
+    unsigned long long second = ((const Writeback_entry *)b)->key;
+
+    return first < second ? -1 : first > second;
+}
+
+void flush_writebacks(Simulator *simulator)
+{
+    Store_writer *writer = simulator->store_writer;
+
+    if (writer->count == 0)
+    {
+        return;
+    }
+    qsort(writer->queue, writer->count, sizeof(Writeback_entry), compare_writeback_entries);
+    for (int i = 0; i < writer->count; i++)
+    {
+        Writeback_entry *entry = &writer->queue[i];
+        write_page_to_store(simulator, entry->key, writer->buffers + ((size_t)entry->slot << geometry.offset_bits));
+        page_map_remove(&writer->queued, entry->key);
+    }
+    writer->count = 0;
+    simulator->writeback_batches++;
+}
+
+/* Queues the contents of a dirty frame that is about to be reused or released. */
+static void write_back_frame(Simulator *simulator, int frame_number)
+{
+    Store_writer *writer = simulator->store_writer;
+    unsigned long long key = simulator->frame_page[frame_number];
+    long long slot = page_map_get(&writer->queued, key);
+
+    if (slot == -1)
+    {
+        if (writer->count == writer->capacity)
+        {
+            flush_writebacks(simulator);
+        }
+        slot = writer->count;
+        writer->queue[writer->count].key = key;
+        writer->queue[writer->count++].slot = (int)slot;
+        page_map_put(&writer->queued, key, slot);
+    }
+    memcpy(writer->buffers + ((size_t)slot << geometry.offset_bits), frame_data(simulator, frame_number), geometry.page_size);
+    if (simulator->page_reader != NULL)
+    {
+        page_reader_invalidate(simulator->page_reader, key);
+    }
+    simulator->frame_dirty[frame_number] = 0;
+    simulator->dirty_evictions++;
+}
+
+/* Fills destination from a queued write-back or a private copy of the page; returns 0 if the store file is current. */
+static int read_written_page(Simulator *simulator, unsigned long long key, char *destination)
+{
+    Store_writer *writer = simulator->store_writer;
+    const char *source;
+    long long index;
+
+    if (simulator->dirty_evictions == 0)
+    {
+        return 0;
+    }
+    if ((index = page_map_get(&writer->queued, key)) != -1)
+    {
+        source = writer->buffers + ((size_t)index << geometry.offset_bits);
+    }
+    else if ((index = page_map_get(&writer->copies, key)) != -1)
+    {
+        source = writer->copy_data + ((size_t)index << geometry.offset_bits);
+    }
+    else
+    {
+        return 0;
+    }
+    memcpy(destination, source, geometry.page_size);
+    return 1;
+}
+
+/*
+    Compressed swap tier (--zswap-pool), modelled on Linux zswap. A page leaving memory is compressed into a pool of
+    at most --zswap-pool bytes, and a fault looks in the pool before the backing store; a page found there is
+    decompressed and dropped from the pool (loads are exclusive). Dirty pages are written back before they are
+    compressed, so the pool only ever caches current contents, and dropping the oldest entries to make room (as zswap
+    writes its LRU end back to swap) needs no write. Pages that do not shrink to 7/8 of their size are rejected and
+    only go to the store. The codec is LZ4's block format: a token with 4-bit literal and match lengths, the literals,
+    a 16-bit little-endian offset and match lengths from 4 bytes, found greedily through a hash of the next 4 bytes.
+
+    Every compression and decompression costs --zswap-latency cycles, so a fault served from the pool saves a
+    backing-store read of --fault-latency cycles less its decompression, and each page stored costs one compression.
+*/
+#define DEFAULT_ZSWAP_LATENCY 3000
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 /* the format ends with at least this many literals */
+#define LZ4_MATCH_LIMIT 12  /* and no match starts closer than this to the end */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12   /* at most; a page of 2^n bytes hashes into 2^(n-2) slots, so a small page clears a small table */
+#define LZ4_SKIP_SHIFT 6    /* after 2^6 misses in a row, probe every other position, and so on */
+
+size_t zswap_pool_size = 0;
+int zswap_latency = DEFAULT_ZSWAP_LATENCY;
+
+static inline unsigned int lz4_read32(const unsigned char *data)
+{
+    unsigned int value;
+
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline unsigned int lz4_hash(unsigned int sequence, int hash_bits)
+{
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+/* How many bytes from a and b agree, up to limit; eight at a time, the first difference found from the low bits. */
+static inline size_t lz4_common_length(const unsigned char *a, const unsigned char *b, size_t limit)
+{
+    size_t length = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (length + 8 <= limit)
+    {
+        unsigned long long x;
+        unsigned long long y;
+        memcpy(&x, a + length, 8);
+        memcpy(&y, b + length, 8);
+        if (x != y)
+        {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+#endif
+    while (length < limit && a[length] == b[length])
+    {
+        length++;
+    }
+    return length;
+}
+
+/* Appends the bytes extending a length field that reached 15; returns the new output size, or 0 if out of room. */
+static size_t lz4_write_length(unsigned char *output, size_t size, size_t capacity, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (size == capacity)
+        {
+            return 0;
+        }
+        output[size++] = 255;
+    }
+    if (size == capacity)
+    {
+        return 0;
+    }
+    output[size++] = (unsigned char)length;
+    return size;
+}
+
+/*
+    Appends a sequence: the literals, then (unless last) a match of match_length bytes offset bytes back. Returns the new
+    output size, or 0 if it does not fit in capacity.
+*/
+static size_t lz4_write_sequence(unsigned char *output, size_t size, size_t capacity, const unsigned char *literals,
+                                 size_t literal_count, size_t offset, size_t match_length, int last)
+{
+    size_t token = size++;
+    size_t match_code = last ? 0 : match_length - LZ4_MIN_MATCH;
+
+    if (token >= capacity)
+    {
+        return 0;
+    }
+    output[token] = (unsigned char)((literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15));
+    if (literal_count >= 15 && (size = lz4_write_length(output, size, capacity, literal_count - 15)) == 0)
+    {
+        return 0;
+    }
+    if (capacity - size < literal_count)
+    {
+        return 0;
+    }
+    memcpy(output + size, literals, literal_count);
+    size += literal_count;
+    if (last)
+    {
+        return size;
+    }
+    if (capacity - size < 2)
+    {
+        return 0;
+    }
+    output[size++] = (unsigned char)offset;
+    output[size++] = (unsigned char)(offset >> 8);
+    if (match_code >= 15 && (size = lz4_write_length(output, size, capacity, match_code - 15)) == 0)
+    {
+        return 0;
+    }
+    return size;
+}
+
+/*
+    Compresses length bytes into output; returns the compressed size, or 0 if it would not fit in capacity. table has
+    2^hash_bits entries.
+*/
+size_t lz4_compress(const unsigned char *input, size_t length, unsigned char *output, size_t capacity, unsigned int *table, int hash_bits)
+{
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t size = 0;
+    unsigned int misses = 0;
+
+    memset(table, 0, sizeof(unsigned int) << hash_bits); /* positions + 1, so 0 is empty */
+    while (length >= LZ4_MATCH_LIMIT && position <= length - LZ4_MATCH_LIMIT)
+    {
+        unsigned int sequence = lz4_read32(input + position);
+        unsigned int *slot = &table[lz4_hash(sequence, hash_bits)];
+        size_t candidate = *slot;
+
+        *slot = (unsigned int)position + 1;
+        if (candidate == 0 || position - (candidate - 1) > LZ4_MAX_OFFSET || lz4_read32(input + candidate - 1) != sequence)
+        {
+            position += 1 + (misses++ >> LZ4_SKIP_SHIFT);
+            continue;
+        }
+        candidate--;
+        misses = 0;
+
+        size_t end = position + LZ4_MIN_MATCH;
+        end += lz4_common_length(input + end, input + candidate + LZ4_MIN_MATCH, length - LZ4_LAST_LITERALS - end);
+        size = lz4_write_sequence(output, size, capacity, input + anchor, position - anchor, position - candidate, end - position, 0);
+        if (size == 0)
+        {
+            return 0;
+        }
+        position = anchor = end;
+    }
+    return lz4_write_sequence(output, size, capacity, input + anchor, length - anchor, 0, 0, 1);
+}
+
+/* Reads the bytes extending a length field that reached 15; returns -1 if the input ends first. */
+static int lz4_read_length(const unsigned char *input, size_t size, size_t *position, size_t *length)
+{
+    unsigned char byte;
+
+    do
+    {
+        if (*position == size)
+        {
+            return -1;
+        }
+        byte = input[(*position)++];
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/* Decompresses size bytes into output; returns 0 if they decode to exactly length bytes, -1 if they are malformed. */
+int lz4_decompress(const unsigned char *input, size_t size, unsigned char *output, size_t length)
+{
+    size_t position = 0;
+    size_t written = 0;
+
+    while (position < size)
+    {
+        unsigned char token = input[position++];
+        size_t literal_count = token >> 4;
+        size_t match_length = token & 15;
+
+        if ((literal_count == 15 && lz4_read_length(input, size, &position, &literal_count) != 0) ||
+            literal_count > size - position || literal_count > length - written)
+        {
+            return -1;
+        }
+        memcpy(output + written, input + position, literal_count);
+        position += literal_count;
+        written += literal_count;
+        if (position == size)
+        {
+            break; /* the last sequence has no match */
+        }
+
+        if (size - position < 2)
+        {
+            return -1;
+        }
+        size_t offset = input[position] | (size_t)input[position + 1] << 8;
+        position += 2;
+        if (match_length == 15 && lz4_read_length(input, size, &position, &match_length) != 0)
+        {
+            return -1;
+        }
+        match_length += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > written || match_length > length - written)
+        {
+            return -1;
+        }
+        /* An overlapping match repeats its last offset bytes; each copy doubles the run it can copy from next. */
+        for (size_t copied = 0; copied < match_length;)
+        {
+            size_t chunk = match_length - copied < offset + copied ? match_length - copied : offset + copied;
+            memcpy(output + written + copied, output + written - offset, chunk);
+            copied += chunk;
+        }
+        written += match_length;
+    }
+    return written == length ? 0 : -1;
+}
+
+/* Entries are numbered slots on a list from the oldest store to the newest; a freed slot is reused by the next store. */
+typedef struct Zswap_pool
+{
+    size_t capacity;
+    size_t used;
+    size_t peak;
+    Page_map index; /* key -> slot */
+    unsigned long long *keys;
+    unsigned char **data;
+    unsigned int *sizes;
+    int *prev;
+    int *next;
+    Node_list order;
+    int *free_slots;
+    int free_count;
+    int slot_count;
+    int slot_capacity;
+    unsigned char *buffer; /* one page, the compressor's output */
+    unsigned int *table;
+    int hash_bits;
+    unsigned long long compressions;
+    unsigned long long stored_pages;
+    unsigned long long rejected_pages;
+    unsigned long long pool_evictions;
+    unsigned long long lookups;
+    unsigned long long hits;
+    unsigned long long bytes_stored; /* before and after compression, over every page stored */
+    unsigned long long bytes_compressed;
+} Zswap_pool;
+
+void free_zswap_pool(Zswap_pool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    for (int node = pool->order.head; node != -1; node = pool->next[node])
+    {
+        free(pool->data[node]);
+    }
+    page_map_free(&pool->index);
+    free(pool->keys);
+    free(pool->data);
+    free(pool->sizes);
+    free(pool->prev);
+    free(pool->next);
+    free(pool->free_slots);
+    free(pool->buffer);
+    free(pool->table);
+    free(pool);
+}
+
+Zswap_pool *init_zswap_pool(size_t capacity)
+{
+    Zswap_pool *pool = calloc(1, sizeof(Zswap_pool));
+    int hash_bits = geometry.offset_bits - 2 < LZ4_HASH_BITS ? geometry.offset_bits - 2 : LZ4_HASH_BITS;
+
+    if (pool != NULL)
+    {
+        /* Before anything can fail, so free_zswap_pool sees an empty order rather than a head of 0. */
+        node_list_init(&pool->order, NULL, NULL);
+    }
+    if (pool == NULL || page_map_init(&pool->index, 64) != 0 || (pool->buffer = malloc(geometry.page_size)) == NULL ||
+        (pool->table = malloc(sizeof(unsigned int) << hash_bits)) == NULL)
+    {
+        printf("Error: could not allocate the zswap pool\n");
+        free_zswap_pool(pool);
+        return NULL;
+    }
+    pool->capacity = capacity;
+    pool->hash_bits = hash_bits;
+    return pool;
+}
+
+static void zswap_drop(Zswap_pool *pool, int slot)
+{
+    page_map_remove(&pool->index, pool->keys[slot]);
+    node_list_remove(&pool->order, slot);
+    free(pool->data[slot]);
+    pool->used -= pool->sizes[slot];
+    pool->free_slots[pool->free_count++] = slot;
+}
+
+/* A free slot, growing the slot arrays when none is left. Like page_map_put, running out of memory ends the program. */
+static int zswap_new_slot(Zswap_pool *pool)
+{
+    if (pool->free_count > 0)
+    {
+        return pool->free_slots[--pool->free_count];
+    }
+    if (pool->slot_count == pool->slot_capacity)
+    {
+        int capacity = pool->slot_capacity > 0 ? pool->slot_capacity * 2 : 64;
+        unsigned long long *keys = realloc(pool->keys, capacity * sizeof(unsigned long long));
+        pool->keys = keys != NULL ? keys : pool->keys;
+        unsigned char **data = realloc(pool->data, capacity * sizeof(unsigned char *));
+        pool->data = data != NULL ? data : pool->data;
+        unsigned int *sizes = realloc(pool->sizes, capacity * sizeof(unsigned int));
+        pool->sizes = sizes != NULL ? sizes : pool->sizes;
+        int *prev = realloc(pool->prev, capacity * sizeof(int));
+        pool->prev = prev != NULL ? prev : pool->prev;
+        int *next = realloc(pool->next, capacity * sizeof(int));
+        pool->next = next != NULL ? next : pool->next;
+        int *free_slots = realloc(pool->free_slots, capacity * sizeof(int));
+        pool->free_slots = free_slots != NULL ? free_slots : pool->free_slots;
+        if (keys == NULL || data == NULL || sizes == NULL || prev == NULL || next == NULL || free_slots == NULL)
+        {
+            printf("Error: could not grow the zswap pool\n");
+            exit(1);
+        }
+        pool->order.prev = prev;
+        pool->order.next = next;
+        pool->slot_capacity = capacity;
+    }
+    return pool->slot_count++;
+}
+
+/* Compresses data into the pool's buffer; returns the compressed size, 0 if the page did not shrink enough. */
+static size_t zswap_compress(Zswap_pool *pool, const char *data)
+{
+    pool->compressions++;
+    return lz4_compress((const unsigned char *)data, geometry.page_size, pool->buffer, geometry.page_size - geometry.page_size / 8,
+                        pool->table, pool->hash_bits);
+}
+
+/* Adds the page with key, which zswap_compress left as size bytes in the buffer, dropping the oldest pages to make room. */
+static void zswap_insert(Zswap_pool *pool, unsigned long long key, size_t size)
+{
+    long long existing = page_map_get(&pool->index, key);
+
+    if (existing != -1)
+    {
+        zswap_drop(pool, (int)existing);
+    }
+    if (size == 0 || size > pool->capacity)
+    {
+        pool->rejected_pages++;
+        return;
+    }
+    while (pool->used + size > pool->capacity)
+    {
+        zswap_drop(pool, pool->order.head);
+        pool->pool_evictions++;
+    }
+
+    int slot = zswap_new_slot(pool);
+    if ((pool->data[slot] = malloc(size)) == NULL)
+    {
+        printf("Error: could not grow the zswap pool\n");
+        exit(1);
+    }
+    memcpy(pool->data[slot], pool->buffer, size);
+    pool->keys[slot] = key;
+    pool->sizes[slot] = (unsigned int)size;
+    page_map_put(&pool->index, key, slot);
+    node_list_push_tail(&pool->order, slot);
+    pool->used += size;
+    pool->peak = pool->used > pool->peak ? pool->used : pool->peak;
+    pool->stored_pages++;
+    pool->bytes_stored += geometry.page_size;
+    pool->bytes_compressed += size;
+}
+
+/* Compresses the page with key, which is leaving memory with the current contents data, into the pool. */
+void zswap_store(Zswap_pool *pool, unsigned long long key, const char *data)
+{
+    zswap_insert(pool, key, zswap_compress(pool, data));
+}
+
+/* Fills destination with the page with key and takes it out of the pool; returns 0 if the pool does not hold it. */
+int zswap_load(Zswap_pool *pool, unsigned long long key, char *destination)
+{
+    long long slot = page_map_get(&pool->index, key);
+
+    pool->lookups++;
+    if (slot == -1)
+    {
+        return 0;
+    }
+    if (lz4_decompress(pool->data[slot], pool->sizes[slot], (unsigned char *)destination, geometry.page_size) != 0)
+    {
+        printf("Error: a compressed page in the zswap pool is corrupt\n");
+        exit(1);
+    }
+    zswap_drop(pool, (int)slot);
+    pool->hits++;
+    return 1;
+}
+
+/* Whether a fault on key would be served by the pool; pool may be NULL. */
+static inline int zswap_holds(Zswap_pool *pool, unsigned long long key)
+{
+    return pool != NULL && page_map_get(&pool->index, key) != -1;
+}
+
+/*
+    A write access adds one to the byte it addresses and reports the value it stored, so written data can be told apart
+    when the page comes back from the store.
+*/
+static inline int write_value(Simulator *simulator, Frame_pool *pool, int frame_number, unsigned long long offset)
+{
+    char *byte = frame_data(simulator, frame_number) + offset;
+
+    *byte = (char)(*byte + 1);
+    simulator->write_accesses++;
+    if (!simulator->frame_dirty[frame_number])
+    {
+        simulator->frame_dirty[frame_number] = 1;
+        simulator->policy->on_write(pool->policy_state, frame_number - pool->first_frame);
+    }
+    return (signed char)*byte;
+}
+
+/* End of the run: the queue is flushed, and with --writable-store so are the frames still dirty. */
+void sync_store(Simulator *simulator)
+{
+    flush_writebacks(simulator);
+    for (int frame_number = 0; frame_number < simulator->physical_memory_frames; frame_number++)
+    {
+        if (simulator->frame_dirty[frame_number])
+        {
+            simulator->dirty_frames_at_exit++;
+            if (writable_store)
+            {
+                write_page_to_store(simulator, simulator->frame_page[frame_number], frame_data(simulator, frame_number));
+                simulator->frame_dirty[frame_number] = 0;
+            }
+        }
+    }
+}
+
+static inline void add_resident_frame(Simulator *simulator, Process *process, int frame_number)
+{
+    if (simulator->resident_prev != NULL)
+    {
+        simulator->frame_last_use[frame_number] = process->translated_addresses;
+        node_list_push_tail(&process->resident, frame_number);
+    }
+    if (++process->resident_frames > process->peak_resident_frames)
+    {
+        process->peak_resident_frames = process->resident_frames;
+    }
+    if (++simulator->resident_frames > simulator->peak_resident_frames)
+    {
+        simulator->peak_resident_frames = simulator->resident_frames;
+    }
+    if (simulator->huge_pages != NULL)
+    {
+        huge_page_residency(simulator, simulator->frame_page[frame_number], 1);
+    }
+}
+
+static inline void remove_resident_frame(Simulator *simulator, Process *process, int frame_number)
+{
+    if (simulator->resident_prev != NULL)
+    {
+        node_list_remove(&process->resident, frame_number);
+    }
+    process->resident_frames--;
+    process->interval_evictions++;
+    simulator->resident_frames--;
+    if (simulator->huge_pages != NULL)
+    {
+        huge_page_residency(simulator, simulator->frame_page[frame_number], -1);
+    }
+}
+
+/* Where load_page_into_frame found the page. */
+enum
+{
+    LOADED_FROM_STORE,
+    LOADED_FROM_ZSWAP_AFTER_READ, /* the pool served it, but a read ahead of it had already gone to the store */
+    LOADED_FROM_ZSWAP
+};
+
+/*
+    The previous owner of the frame, found through the reverse map, may be another process under global replacement.
+    The pool is looked in first; a read ahead of a page it holds is discarded. The victim is compressed before the load
+    overwrites it but only inserted after, so making room for it cannot drop the page that is faulting.
+*/
+int load_page_into_frame(Simulator *simulator, int victim_frame, unsigned long long page_number)
+{
+    unsigned long long previous_key = simulator->frame_page[victim_frame];
+    Page_reader *reader = simulator->page_reader;
+    unsigned long long key = page_key(simulator->current_asid, page_number);
+    char *destination = frame_data(simulator, victim_frame);
+
+    if (simulator->frame_dirty[victim_frame])
+    {
+        write_back_frame(simulator, victim_frame);
+    }
+    int store_victim = simulator->zswap != NULL && previous_key != NO_PAGE;
+    size_t victim_size = store_victim ? zswap_compress(simulator->zswap, destination) : 0;
+    int cached = simulator->zswap != NULL && zswap_load(simulator->zswap, key, destination);
+    if (store_victim)
+    {
+        zswap_insert(simulator->zswap, previous_key, victim_size);
+    }
+    int in_flight = reader != NULL && page_map_get(&reader->in_flight, key) != -1;
+    int served = in_flight && page_reader_take(reader, key, cached ? NULL : destination);
+    if (!cached && !read_written_page(simulator, key, destination) && !served)
+    {
+        read_page_from_backing_store(page_number, destination);
+        if (reader != NULL)
+        {
+            reader->synchronous++;
+        }
+    }
+
+    if (previous_key != NO_PAGE)
+    {
+        unsigned int owner = (unsigned int)(previous_key >> geometry.page_number_bits);
+        simulator->replacement_evictions++;
+        page_table_unmap(&simulator->processes[owner], owner, previous_key & geometry.page_mask);
+        invalidate_translation(simulator, previous_key);
+        remove_resident_frame(simulator, &simulator->processes[owner], victim_frame);
+        if (reader != NULL)
+        {
+            page_reader_evicted(reader, previous_key, simulator->current_access, zswap_holds(simulator->zswap, previous_key));
+        }
+    }
+    page_table_map(simulator->current_process, simulator->current_asid, page_number, victim_frame);
+    simulator->frame_page[victim_frame] = key;
+    add_resident_frame(simulator, simulator->current_process, victim_frame);
+    return !cached ? LOADED_FROM_STORE : in_flight ? LOADED_FROM_ZSWAP_AFTER_READ : LOADED_FROM_ZSWAP;
+}
+
+/* Gives a resident frame back to its pool's free list without a replacement decision (working set and PFF). */
+void release_frame(Simulator *simulator, int frame_number)
+{
+    unsigned long long key = simulator->frame_page[frame_number];
+    unsigned int owner = (unsigned int)(key >> geometry.page_number_bits);
+    Process *process = &simulator->processes[owner];
+    Frame_pool *pool = process->pool;
+
+    if (simulator->frame_dirty[frame_number])
+    {
+        write_back_frame(simulator, frame_number);
+    }
+    if (simulator->zswap != NULL)
+    {
+        zswap_store(simulator->zswap, key, frame_data(simulator, frame_number));
+    }
+    page_table_unmap(process, owner, key & geometry.page_mask);
+    invalidate_translation(simulator, key);
+    remove_resident_frame(simulator, process, frame_number);
+    if (simulator->frame_prefetched != NULL)
+    {
+        simulator->frame_prefetched[frame_number] = 0;
+    }
+    if (simulator->page_reader != NULL)
+    {
+        page_reader_evicted(simulator->page_reader, key, simulator->current_access, zswap_holds(simulator->zswap, key));
+    }
+    simulator->frame_page[frame_number] = NO_PAGE;
+    simulator->policy->on_remove(pool->policy_state, frame_number - pool->first_frame);
+    pool->free_frames[pool->free_count++] = frame_number - pool->first_frame;
+    simulator->released_frames++;
+}
+
+/* Releases the process's least recently used frames while their last use is before horizon. */
+static void release_frames_unused_since(Simulator *simulator, Process *process, unsigned long long horizon)
+{
+    while (process->resident.size > 0 && simulator->frame_last_use[process->resident.head] < horizon)
+    {
+        release_frame(simulator, process->resident.head);
+    }
+}
+
+/*
+    Called after every access under working-set or PFF allocation: the frame moves to the back of its process's
+    resident list, and the working set drops pages last referenced working_set_window or more references ago.
+*/
+static inline void track_resident_use(Simulator *simulator, Process *process, int frame_number)
+{
+    unsigned long long now = process->translated_addresses;
+
+    simulator->frame_last_use[frame_number] = now;
+    node_list_move_to_tail(&process->resident, frame_number);
+    if (simulator->frame_allocation == FRAME_ALLOCATION_WORKING_SET && now >= (unsigned long long)simulator->working_set_window)
+    {
+        release_frames_unused_since(simulator, process, now - simulator->working_set_window + 1);
+    }
+}
+
+/* PFF runs at each fault of the current process, before the missing page is brought in. */
+static void adjust_page_fault_frequency(Simulator *simulator, Process *process)
+{
+    unsigned long long now = process->translated_addresses;
+
+    if (process->last_fault_time != 0 && now - process->last_fault_time > (unsigned long long)simulator->pff_threshold)
+    {
+        release_frames_unused_since(simulator, process, process->last_fault_time);
+    }
+    process->last_fault_time = now;
+}
+
+/*
+    Picks the pool-relative frame a page will be loaded into: a released frame, a never-used one, or a victim. A victim
+    counts as an eviction only when load_page_into_frame replaces it, since prefetch_pages may turn it down.
+*/
+static int take_pool_frame(Simulator *simulator, Frame_pool *pool, unsigned long long key)
+{
+    if (pool->free_count > 0)
+    {
+        return pool->free_frames[--pool->free_count];
+    }
+    if (pool->next_unused_frame < pool->frames)
+    {
+        return pool->next_unused_frame++;
+    }
+    INSTRUMENT_START(timer);
+    int victim_frame = simulator->policy->select_victim(pool->policy_state, key);
+    INSTRUMENT_STOP(PHASE_VICTIM, timer);
+    return victim_frame;
+}
+
+/*
+    Prefetch predictors, trained on the miss stream the process would see without prefetching (its demand faults and
+    first uses of prefetched pages):
+        sequential  the next prefetch_degree pages after the fault
+        stride      once two consecutive misses are the same distance apart, the next prefetch_degree pages at that stride
+        markov      a next-miss table: the page that missed after this one last time, then the one after that, and so on
+*/
+enum
+{
+    PREFETCH_NONE,
+    PREFETCH_SEQUENTIAL,
+    PREFETCH_STRIDE,
+    PREFETCH_MARKOV
+};
+
+const char *prefetch_names[] = {"none", "sequential", "stride", "markov"};
+
+static void train_prefetcher(Simulator *simulator, Process *process, unsigned long long page_number)
+{
+    if (process->last_miss_page != NO_PAGE)
+    {
+        process->miss_stride = (long long)(page_number - process->last_miss_page);
+        if (simulator->next_fault != NULL)
+        {
+            page_map_put(simulator->next_fault, page_key(simulator->current_asid, process->last_miss_page), (long long)page_number);
+        }
+    }
+    process->last_miss_page = page_number;
+}
+
+/* Fills candidates with the pages to read after a fault on page_number; returns how many, before filtering. */
+static int predict_prefetch(Simulator *simulator, Process *process, unsigned long long page_number, unsigned long long *candidates)
+{
+    long long stride = 1;
+    int count = 0;
+
+    if (simulator->prefetch == PREFETCH_MARKOV)
+    {
+        long long next = (long long)page_number;
+        while (count < simulator->prefetch_degree &&
+               (next = page_map_get(simulator->next_fault, page_key(simulator->current_asid, (unsigned long long)next))) != -1)
+        {
+            candidates[count++] = (unsigned long long)next;
+        }
+        return count;
+    }
+    if (simulator->prefetch == PREFETCH_STRIDE)
+    {
+        long long previous_stride = process->miss_stride;
+        if (process->last_miss_page == NO_PAGE || (long long)(page_number - process->last_miss_page) != previous_stride || previous_stride == 0)
+        {
+            return 0;
+        }
+        stride = previous_stride;
+    }
+    for (int i = 1; i <= simulator->prefetch_degree; i++)
+    {
+        candidates[count++] = page_number + (unsigned long long)(stride * i);
+    }
+    return count;
+}
+
+/*
+    After the demand page of a fault is loaded and before the policy sees it, reads the predicted pages that are valid
+    and not resident. Their frames are all taken before any is handed to the policy, so one prefetched page never
+    evicts another, and the demand frame is out of the policy's reach meanwhile. Returns the pool-relative frames.
+*/
+static int prefetch_pages(Simulator *simulator, unsigned long long page_number, int demand_frame, int *frames, unsigned long long *keys)
+{
+    Process *process = simulator->current_process;
+    Frame_pool *pool = process->pool;
+    unsigned long long candidates[MAX_PREFETCH_DEGREE];
+    int count = predict_prefetch(simulator, process, page_number, candidates);
+    int loaded = 0;
+
+    for (int i = 0; i < count && loaded < pool->frames - 1; i++)
+    {
+        unsigned long long candidate = candidates[i];
+        int references;
+        int duplicate = candidate == page_number;
+
+        for (int j = 0; j < loaded && !duplicate; j++)
+        {
+            duplicate = keys[j] == page_key(simulator->current_asid, candidate);
+        }
+        if (duplicate || candidate >= geometry.number_of_pages ||
+            page_table_type->lookup(process->page_table, simulator->current_asid, candidate, &references) >= 0)
+        {
+            continue;
+        }
+
+        int frame_number = take_pool_frame(simulator, pool, NO_PAGE);
+        for (int j = 0; j < loaded && frame_number != demand_frame; j++)
+        {
+            if (frames[j] == frame_number)
+            {
+                frame_number = demand_frame;
+            }
+        }
+        if (frame_number == demand_frame)
+        {
+            break; /* a CLOCK hand that came all the way round */
+        }
+        load_page_into_frame(simulator, pool->first_frame + frame_number, candidate);
+        simulator->frame_prefetched[pool->first_frame + frame_number] = 1;
+        frames[loaded] = frame_number;
+        keys[loaded++] = page_key(simulator->current_asid, candidate);
+    }
+    simulator->prefetch_reads += loaded;
+    return loaded;
+}
+
+/* Brings a page of the current process in from its frame pool and returns the frame it now occupies. */
+int handle_page_fault(Simulator *simulator, unsigned long long page_number)
+{
+    Frame_pool *pool = simulator->current_process->pool;
+    unsigned long long key = page_key(simulator->current_asid, page_number);
+    int victim_frame = take_pool_frame(simulator, pool, key);
+
+    int source = load_page_into_frame(simulator, pool->first_frame + victim_frame, page_number);
+
+    simulator->zswap_fault_hits += source != LOADED_FROM_STORE;
+    simulator->zswap_reads_avoided += source == LOADED_FROM_ZSWAP;
+    if (simulator->frame_prefetched == NULL)
+    {
+        simulator->policy->on_fault(pool->policy_state, victim_frame, key);
+        return pool->first_frame + victim_frame;
+    }
+
+    int frames[MAX_PREFETCH_DEGREE];
+    unsigned long long keys[MAX_PREFETCH_DEGREE];
+    int prefetched = prefetch_pages(simulator, page_number, victim_frame, frames, keys);
+
+    train_prefetcher(simulator, simulator->current_process, page_number);
+    simulator->frame_prefetched[pool->first_frame + victim_frame] = 0;
+    simulator->policy->on_fault(pool->policy_state, victim_frame, key);
+    for (int i = 0; i < prefetched; i++)
+    {
+        simulator->policy->on_prefetch(pool->policy_state, frames[i], keys[i]);
+    }
+    return pool->first_frame + victim_frame;
+}
+
+int init_frame_pools(Simulator *simulator, int frames, int pools)
+{
+    int first_frame = 0;
+
+    simulator->frame_pools = calloc(pools, sizeof(Frame_pool));
+    if (simulator->frame_pools == NULL)
+    {
+        printf("Error: could not allocate frame pools\n");
+        return -1;
+    }
+    simulator->frame_pool_count = pools;
+    for (int i = 0; i < pools; i++)
+    {
+        Frame_pool *pool = &simulator->frame_pools[i];
+        pool->first_frame = first_frame;
+        pool->frames = frames / pools + (i < frames % pools);
+        pool->free_frames = malloc(pool->frames * sizeof(int));
+        if (pool->free_frames == NULL)
+        {
+            printf("Error: could not allocate frame pools\n");
+            return -1;
+        }
+        pool->policy_state = simulator->policy->init(simulator, pool->frames);
+        if (pool->policy_state == NULL)
+        {
+            printf("Error: could not initialize replacement algorithm\n");
+            return -1;
+        }
+        first_frame += pool->frames;
+    }
+    return 0;
+}
+
+void free_frame_pools(Simulator *simulator)
+{
+    for (int i = 0; i < simulator->frame_pool_count; i++)
+    {
+        if (simulator->frame_pools[i].policy_state != NULL)
+        {
+            simulator->policy->destroy(simulator->frame_pools[i].policy_state);
+        }
+        free(simulator->frame_pools[i].free_frames);
+    }
+    free(simulator->frame_pools);
+}
+
+/* limit is one more than the highest ASID the trace may use. A shared page table is built up front. */
+int init_processes(Simulator *simulator, unsigned int limit)
+{
+    simulator->processes = calloc(limit, sizeof(Process));
+    if (simulator->processes == NULL)
+    {
+        printf("Error: could not allocate process table\n");
+        return -1;
+    }
+    simulator->process_limit = limit;
+    if (simulator->interval_length > 0)
+    {
+        simulator->active_processes = malloc(limit * sizeof(unsigned int));
+        if (simulator->active_processes == NULL)
+        {
+            printf("Error: could not allocate process table\n");
+            return -1;
+        }
+    }
+    if (page_table_type->shared)
+    {
+        simulator->shared_page_table = page_table_type->init(simulator->physical_memory_frames);
+        if (simulator->shared_page_table == NULL)
+        {
+            printf("Error: could not allocate page table\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void free_processes(Simulator *simulator)
+{
+    for (unsigned int asid = 0; asid < simulator->process_limit && !page_table_type->shared; asid++)
+    {
+        if (simulator->processes[asid].page_table != NULL)
+        {
+            page_table_type->destroy(simulator->processes[asid].page_table);
+        }
+    }
+    if (simulator->shared_page_table != NULL)
+    {
+        page_table_type->destroy(simulator->shared_page_table);
+    }
+    free(simulator->processes);
+    free(simulator->active_processes);
+}
+
+/* Makes asid the running process, creating it on first use, and charges the context switch. */
+int switch_process(Simulator *simulator, unsigned int asid)
+{
+    Process *process = &simulator->processes[asid];
+
+    if (process->page_table == NULL)
+    {
+        if (writable_store && asid != 0)
+        {
+            printf("Error: --writable-store needs a single-process trace\n");
+            return -1;
+        }
+        process->page_table = page_table_type->shared ? simulator->shared_page_table : page_table_type->init(simulator->physical_memory_frames);
+        process->pool = &simulator->frame_pools[simulator->frame_allocation == FRAME_ALLOCATION_LOCAL ? asid : 0];
+        if (process->page_table == NULL)
+        {
+            return -1;
+        }
+        if (simulator->resident_prev != NULL)
+        {
+            node_list_init(&process->resident, simulator->resident_prev, simulator->resident_next);
+        }
+        if (simulator->active_processes != NULL)
+        {
+            simulator->active_processes[simulator->active_process_count++] = asid;
+        }
+        process->last_miss_page = NO_PAGE;
+    }
+    if (simulator->current_process != NULL)
+    {
+        simulator->context_switch_counter++;
+        if (simulator->tlb_flush_on_switch)
+        {
+            flush_tlb(&simulator->tlb);
+            if (simulator->l2_tlb.size > 0)
+            {
+                flush_tlb(&simulator->l2_tlb);
+            }
+            if (simulator->huge_pages != NULL)
+            {
+                flush_tlb(huge_tlb(simulator));
+                flush_tlb(&simulator->huge_pages->base_tlb);
+            }
+            simulator->tlb_flush_counter++;
+        }
+    }
+    simulator->current_process = process;
+    simulator->current_asid = asid;
+    return 0;
+}
+
+/*
+    Interval output (--interval-output). Instead of being kept for the report, samples are streamed to a file by a
+    background thread: the translation loop fills one of INTERVAL_BUFFERS buffers of INTERVAL_BUFFER_SAMPLES samples and
+    hands it over when it is full, so it only waits when every buffer is still queued behind a slow disk. CSV has a
+    header line and one row per sample, with process "all" for the whole machine. The binary format is a 16-byte header
+    (INTERVAL_MAGIC, then u32 version and u32 record size) followed by Interval_sample records as laid out in memory, in the
+    host's byte order.
+*/
+#define INTERVAL_BUFFERS 4
+#define INTERVAL_BUFFER_SAMPLES 4096
+#define INTERVAL_MAGIC "VMSERIE"
+#define INTERVAL_VERSION 1
+
+enum
+{
+    INTERVAL_FORMAT_CSV,
+    INTERVAL_FORMAT_BINARY
+};
+
+const char *interval_format_names[] = {"csv", "binary"};
+
+typedef struct Interval_writer
+{
+    FILE *file;
+    int format;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued_cond;  /* a buffer was queued, or the writer is closing */
+    pthread_cond_t written_cond; /* a buffer was written and is free again */
+    Interval_sample *buffers[INTERVAL_BUFFERS];
+    size_t counts[INTERVAL_BUFFERS];
+    int filling; /* buffer the translation loop appends to */
+    int queued;  /* full buffers waiting for the thread, oldest at filling - queued */
+    int closing;
+    int error;
+} Interval_writer;
+
+static void write_interval_samples(Interval_writer *writer, const Interval_sample *samples, size_t count)
+{
+    if (writer->format == INTERVAL_FORMAT_BINARY)
+    {
+        writer->error |= fwrite(samples, sizeof(Interval_sample), count, writer->file) != count;
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const Interval_sample *sample = &samples[i];
+        if (sample->asid == INTERVAL_ALL_PROCESSES)
+        {
+            fprintf(writer->file, "%llu,all,", sample->index);
+        }
+        else
+        {
+            fprintf(writer->file, "%llu,%u,", sample->index, sample->asid);
+        }
+        fprintf(writer->file, "%llu,%llu,%.4f,%llu,%.4f,%d,%llu,%d\n", sample->accesses, sample->page_faults,
+                (double)sample->page_faults / sample->accesses, sample->tlb_hits, (double)sample->tlb_hits / sample->accesses,
+                sample->resident_frames, sample->evictions, sample->thrashing);
+    }
+    writer->error |= ferror(writer->file) != 0;
+}
+
+static void *interval_writer_thread(void *argument)
+{
+    Interval_writer *writer = argument;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (writer->queued == 0 && !writer->closing)
+        {
+            pthread_cond_wait(&writer->queued_cond, &writer->lock);
+        }
+        if (writer->queued == 0)
+        {
+            break;
+        }
+        int oldest = (writer->filling - writer->queued + INTERVAL_BUFFERS) % INTERVAL_BUFFERS;
+        pthread_mutex_unlock(&writer->lock);
+        write_interval_samples(writer, writer->buffers[oldest], writer->counts[oldest]);
+        pthread_mutex_lock(&writer->lock);
+        writer->counts[oldest] = 0;
+        writer->queued--;
+        pthread_cond_signal(&writer->written_cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+Interval_writer *open_interval_writer(const char *path, int format)
+{
+    Interval_writer *writer = calloc(1, sizeof(Interval_writer));
+
+    if (writer == NULL || (writer->file = fopen(path, format == INTERVAL_FORMAT_BINARY ? "wb" : "w")) == NULL)
+    {
+        printf("Error: could not write interval output file\n");
+        free(writer);
+        return NULL;
+    }
+    writer->format = format;
+    for (int i = 0; i < INTERVAL_BUFFERS; i++)
+    {
+        if ((writer->buffers[i] = malloc(INTERVAL_BUFFER_SAMPLES * sizeof(Interval_sample))) == NULL)
+        {
+            printf("Error: could not allocate interval buffers\n");
+            writer->closing = -1;
+        }
+    }
+    if (format == INTERVAL_FORMAT_BINARY)
+    {
+        unsigned int fields[2] = {INTERVAL_VERSION, (unsigned int)sizeof(Interval_sample)};
+        fwrite(INTERVAL_MAGIC, sizeof(INTERVAL_MAGIC), 1, writer->file);
+        fwrite(fields, sizeof(fields), 1, writer->file);
+    }
+    else
+    {
+        fprintf(writer->file, "interval,process,accesses,page_faults,page_fault_rate,tlb_hits,tlb_hit_rate,resident_frames,evictions,thrashing\n");
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued_cond, NULL);
+    pthread_cond_init(&writer->written_cond, NULL);
+    if (writer->closing != 0 || pthread_create(&writer->thread, NULL, interval_writer_thread, writer) != 0)
+    {
+        if (writer->closing == 0)
+        {
+            printf("Error: could not start the interval writer\n");
+        }
+        for (int i = 0; i < INTERVAL_BUFFERS; i++)
+        {
+            free(writer->buffers[i]);
+        }
+        fclose(writer->file);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/* Hands the buffer being filled to the thread, waiting only if every other buffer is still queued. */
+static void queue_interval_buffer(Interval_writer *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (writer->queued == INTERVAL_BUFFERS - 1)
+    {
+        pthread_cond_wait(&writer->written_cond, &writer->lock);
+    }
+    writer->queued++;
+    writer->filling = (writer->filling + 1) % INTERVAL_BUFFERS;
+    pthread_cond_signal(&writer->queued_cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static inline Interval_sample *next_interval_slot(Interval_writer *writer)
+{
+    if (writer->counts[writer->filling] == INTERVAL_BUFFER_SAMPLES)
+    {
+        queue_interval_buffer(writer);
+    }
+    return &writer->buffers[writer->filling][writer->counts[writer->filling]++];
+}
+
+/* Writes out what is left and closes the file; returns -1 if any write failed. NULL is a no-op. */
+int close_interval_writer(Interval_writer *writer)
+{
+    if (writer == NULL)
+    {
+        return 0;
+    }
+    if (writer->counts[writer->filling] > 0)
+    {
+        queue_interval_buffer(writer);
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = 1;
+    pthread_cond_signal(&writer->queued_cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int status = fclose(writer->file) != 0 || writer->error ? -1 : 0;
+    for (int i = 0; i < INTERVAL_BUFFERS; i++)
+    {
+        free(writer->buffers[i]);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued_cond);
+    pthread_cond_destroy(&writer->written_cond);
+    free(writer);
+    if (status != 0)
+    {
+        printf("Error: could not write interval output file\n");
+    }
+    return status;
+}
+
+static int append_interval_sample(Simulator *simulator, unsigned int asid, unsigned long long accesses, unsigned long long page_faults,
+                                  unsigned long long tlb_hits, unsigned long long evictions, int resident_frames, int memory_full)
+{
+    Interval_sample *sample;
+
+    if (simulator->interval_writer != NULL)
+    {
+        sample = next_interval_slot(simulator->interval_writer);
+    }
+    else if (simulator->interval_count == simulator->interval_capacity)
+    {
+        size_t capacity = simulator->interval_capacity > 0 ? 2 * simulator->interval_capacity : 256;
+        Interval_sample *intervals = realloc(simulator->intervals, capacity * sizeof(Interval_sample));
+        if (intervals == NULL)
+        {
+            printf("Error: could not allocate interval statistics\n");
+            return -1;
+        }
+        simulator->intervals = intervals;
+        simulator->interval_capacity = capacity;
+        sample = &simulator->intervals[simulator->interval_count++];
+    }
+    else
+    {
+        sample = &simulator->intervals[simulator->interval_count++];
+    }
+    sample->index = (simulator->current_access - 1) / simulator->interval_length;
+    sample->accesses = accesses;
+    sample->page_faults = page_faults;
+    sample->tlb_hits = tlb_hits;
+    sample->evictions = evictions;
+    sample->asid = asid;
+    sample->resident_frames = resident_frames;
+    sample->thrashing = memory_full && accesses > 0 && (double)page_faults / accesses >= simulator->thrashing_threshold;
+    sample->reserved = 0;
+    if (sample->thrashing && asid == INTERVAL_ALL_PROCESSES)
+    {
+        simulator->thrashing_intervals++;
+    }
+    return 0;
+}
+
+/*
+    Closes the current interval: one sample for the whole machine and one per process that ran in it. An interval is
+    flagged as thrashing when its fault rate reaches thrashing_threshold while there is no free frame left to grow
+    into (in the process's pool, or anywhere for the machine-wide sample).
+*/
+int record_interval(Simulator *simulator)
+{
+    unsigned long long accesses = (unsigned long long)simulator->interval_position;
+    unsigned long long page_faults = simulator->page_fault_counter - simulator->interval_start_faults;
+    unsigned long long tlb_hits = simulator->tlb_hit_counter - simulator->interval_start_tlb_hits;
+    unsigned long long evictions = simulator->replacement_evictions + simulator->released_frames - simulator->interval_start_evictions;
+
+    if (append_interval_sample(simulator, INTERVAL_ALL_PROCESSES, accesses, page_faults, tlb_hits, evictions,
+                               simulator->resident_frames, simulator->resident_frames == simulator->physical_memory_frames) != 0)
+    {
+        return -1;
+    }
+    for (unsigned int i = 0; i < simulator->active_process_count; i++)
+    {
+        unsigned int asid = simulator->active_processes[i];
+        Process *process = &simulator->processes[asid];
+        Frame_pool *pool = process->pool;
+
+        if (process->interval_accesses > 0 &&
+            append_interval_sample(simulator, asid, process->interval_accesses, process->interval_faults,
+                                   process->tlb_hits - process->interval_start_tlb_hits, process->interval_evictions,
+                                   process->resident_frames, pool->free_count == 0 && pool->next_unused_frame == pool->frames) != 0)
+        {
+            return -1;
+        }
+        process->interval_accesses = 0;
+        process->interval_faults = 0;
+        process->interval_start_tlb_hits = process->tlb_hits;
+        process->interval_evictions = 0;
+    }
+    simulator->interval_position = 0;
+    simulator->interval_start_faults = simulator->page_fault_counter;
+    simulator->interval_start_tlb_hits = simulator->tlb_hit_counter;
+    simulator->interval_start_evictions = simulator->replacement_evictions + simulator->released_frames;
+    return 0;
+}
+
+/*
+    Builds a simulator for one configuration. On failure the simulator is left in a state free_simulator can clean up.
+    next_use must be filled in before the run if the policy needs it.
+*/
+int init_simulator(Simulator *simulator, const Simulator_config *config)
+{
+    memset(simulator, 0, sizeof(Simulator));
+    simulator->policy = config->policy;
+    simulator->frame_allocation = config->frame_allocation;
+    simulator->tlb_flush_on_switch = config->tlb_flush_on_switch;
+    simulator->working_set_window = config->working_set_window;
+    simulator->pff_threshold = config->pff_threshold;
+    simulator->interval_length = config->interval_length;
+    simulator->thrashing_threshold = config->thrashing_threshold;
+    simulator->prefetch = config->prefetch;
+    simulator->prefetch_degree = config->prefetch_degree;
+
+    if (config->frame_allocation == FRAME_ALLOCATION_WORKING_SET || config->frame_allocation == FRAME_ALLOCATION_PFF)
+    {
+        simulator->frame_last_use = calloc(config->frames, sizeof(unsigned long long));
+        simulator->resident_prev = malloc(config->frames * sizeof(int));
+        simulator->resident_next = malloc(config->frames * sizeof(int));
+        if (simulator->frame_last_use == NULL || simulator->resident_prev == NULL || simulator->resident_next == NULL)
+        {
+            printf("Error: could not allocate resident-set tracking\n");
+            return -1;
+        }
+    }
+    if (config->prefetch != PREFETCH_NONE)
+    {
+        simulator->frame_prefetched = calloc(config->frames, 1);
+        if (config->prefetch == PREFETCH_MARKOV)
+        {
+            simulator->next_fault = calloc(1, sizeof(Page_map));
+        }
+        if (simulator->frame_prefetched == NULL || (config->prefetch == PREFETCH_MARKOV &&
+                                                    (simulator->next_fault == NULL || page_map_init(simulator->next_fault, 1024) != 0)))
+        {
+            printf("Error: could not allocate prefetcher\n");
+            return -1;
+        }
+    }
+    simulator->frame_dirty = calloc(config->frames, 1);
+    if (simulator->frame_dirty == NULL)
+    {
+        printf("Error: could not allocate dirty-page tracking\n");
+        return -1;
+    }
+    if ((simulator->store_writer = init_store_writer(writeback_batch)) == NULL)
+    {
+        return -1;
+    }
+    if (zswap_pool_size > 0 && (simulator->zswap = init_zswap_pool(zswap_pool_size)) == NULL)
+    {
+        return -1;
+    }
+    if (init_physical_memory(simulator, config->frames) != 0 ||
+        init_tlb(&simulator->tlb, config->tlb_size, config->tlb_ways, config->tlb_replacement, config->tlb_probe_name) != 0 ||
+        init_frame_pools(simulator, config->frames, config->frame_allocation == FRAME_ALLOCATION_LOCAL ? config->process_count : 1) != 0 ||
+        init_processes(simulator, config->process_count > 0 ? (unsigned int)config->process_count : geometry.asid_limit) != 0)
+    {
+        return -1;
+    }
+    if (l2_tlb_size > 0 && init_tlb(&simulator->l2_tlb, l2_tlb_size, l2_tlb_ways, config->tlb_replacement, config->tlb_probe_name) != 0)
+    {
+        return -1;
+    }
+    if (huge_page_bits != 0 && (simulator->huge_pages = init_huge_pages(&simulator->tlb, config->tlb_probe_name)) == NULL)
+    {
+        return -1;
+    }
+    if (async_io != ASYNC_IO_OFF && (simulator->page_reader = init_page_reader(async_io, io_depth)) == NULL)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void free_simulator(Simulator *simulator)
+{
+    free_page_reader(simulator->page_reader);
+    free_store_writer(simulator->store_writer);
+    free_zswap_pool(simulator->zswap);
+    free(simulator->frame_dirty);
+    free_frame_pools(simulator);
+    free_processes(simulator);
+    free_huge_pages(simulator->huge_pages);
+    free_tlb(&simulator->l2_tlb);
+    free_tlb(&simulator->tlb);
+    free_physical_memory(simulator);
+    free(simulator->frame_last_use);
+    free(simulator->resident_prev);
+    free(simulator->resident_next);
+    free(simulator->intervals);
+    close_interval_writer(simulator->interval_writer);
+    free(simulator->frame_prefetched);
+    if (simulator->next_fault != NULL)
+    {
+        page_map_free(simulator->next_fault);
+        free(simulator->next_fault);
+    }
+}
+
+/*
+    Checkpoint files (--checkpoint-at, --restore). A run with --checkpoint-at n stops after n accesses and saves its
+    state. --restore loads it into a simulator built from the same options, skips the first n accesses of the trace and
+    carries on, so the two runs together print exactly what one uninterrupted run would, and one warmed-up state can
+    seed any number of runs. The file is a Checkpoint_header, the state in checkpoint_simulator order, and physical
+    memory last, from a page boundary on. A restore maps that part of the file privately in place of the frame arena,
+    so memory is copy-on-write and only the frames the rest of the run writes are ever copied. Whatever shapes the
+    machine must match between the two runs (checked through the header); latencies, reporting options and the trace
+    may differ. Huge pages, asynchronous I/O, intervals, sampling, the writable store and the zswap pool are not
+    saved.
+*/
+#define CHECKPOINT_MAGIC "VMCHKPT"
+#define CHECKPOINT_VERSION 3
+
+typedef struct Checkpoint_header
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int process_limit;
+    char policy[16];
+    int offset_bits;
+    int virtual_address_bits;
+    int page_table;
+    int radix_levels;
+    int frames;
+    int tlb_size;
+    int tlb_ways;
+    int tlb_replacement;
+    int l2_tlb_size;
+    int l2_tlb_ways;
+    int tlb_inclusion;
+    int frame_allocation;
+    int tlb_flush_on_switch;
+    int working_set_window;
+    int pff_threshold;
+    int prefetch;
+    int prefetch_degree;
+    int writeback_batch;
+    unsigned long long access_index; /* accesses simulated before the checkpoint */
+    unsigned long long memory_offset;
+    unsigned long long state_size; /* bytes of state after the header */
+    unsigned long long state_checksum;
+} Checkpoint_header;
+
+static void fill_checkpoint_header(const Simulator *simulator, Checkpoint_header *header)
+{
+    memset(header, 0, sizeof(Checkpoint_header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header->version = CHECKPOINT_VERSION;
+    header->process_limit = simulator->process_limit;
+    strncpy(header->policy, simulator->policy->name, sizeof(header->policy) - 1);
+    header->offset_bits = geometry.offset_bits;
+    header->virtual_address_bits = geometry.virtual_address_bits;
+    header->page_table = (int)(page_table_type - page_table_types);
+    header->radix_levels = radix_levels;
+    header->frames = simulator->physical_memory_frames;
+    header->tlb_size = simulator->tlb.size;
+    header->tlb_ways = simulator->tlb.ways;
+    header->tlb_replacement = simulator->tlb.replacement;
+    header->l2_tlb_size = simulator->l2_tlb.size;
+    header->l2_tlb_ways = simulator->l2_tlb.ways;
+    header->tlb_inclusion = tlb_inclusion;
+    header->frame_allocation = simulator->frame_allocation;
+    header->tlb_flush_on_switch = simulator->tlb_flush_on_switch;
+    header->working_set_window = simulator->working_set_window;
+    header->pff_threshold = simulator->pff_threshold;
+    header->prefetch = simulator->prefetch;
+    header->prefetch_degree = simulator->prefetch_degree;
+    header->writeback_batch = writeback_batch;
+    header->access_index = simulator->current_access;
+}
+
+/* Only processes that have appeared are saved. Their page tables follow them, unless the table is rebuilt. */
+static void checkpoint_processes(Simulator *simulator, Checkpoint *checkpoint)
+{
+    unsigned int created = 0;
+
+    for (unsigned int asid = 0; asid < simulator->process_limit; asid++)
+    {
+        created += simulator->processes[asid].page_table != NULL;
+    }
+    CHECKPOINT_FIELD(checkpoint, created);
+    for (unsigned int i = 0, asid = 0; i < created && !checkpoint->error; i++, asid++)
+    {
+        while (!checkpoint->restoring && simulator->processes[asid].page_table == NULL)
+        {
+            asid++;
+        }
+        CHECKPOINT_FIELD(checkpoint, asid);
+        if (asid >= simulator->process_limit)
+        {
+            checkpoint->error = 1;
+            return;
+        }
+
+        /* Field by field, so the file holds neither host pointers nor padding. */
+        Process *process = &simulator->processes[asid];
+        CHECKPOINT_FIELD(checkpoint, process->translated_addresses);
+        CHECKPOINT_FIELD(checkpoint, process->page_faults);
+        CHECKPOINT_FIELD(checkpoint, process->tlb_hits);
+        CHECKPOINT_FIELD(checkpoint, process->resident_frames);
+        CHECKPOINT_FIELD(checkpoint, process->peak_resident_frames);
+        CHECKPOINT_FIELD(checkpoint, process->last_fault_time);
+        CHECKPOINT_FIELD(checkpoint, process->interval_accesses);
+        CHECKPOINT_FIELD(checkpoint, process->interval_faults);
+        CHECKPOINT_FIELD(checkpoint, process->interval_start_tlb_hits);
+        CHECKPOINT_FIELD(checkpoint, process->interval_evictions);
+        CHECKPOINT_FIELD(checkpoint, process->last_miss_page);
+        CHECKPOINT_FIELD(checkpoint, process->miss_stride);
+        checkpoint_node_list(checkpoint, &process->resident, simulator->physical_memory_frames);
+        checkpoint_indices(checkpoint, &process->resident_frames, 1, 0, simulator->physical_memory_frames + 1);
+        if (checkpoint->restoring && !checkpoint->error)
+        {
+            process->page_table = page_table_type->shared ? simulator->shared_page_table : page_table_type->init(simulator->physical_memory_frames);
+            process->pool = &simulator->frame_pools[simulator->frame_allocation == FRAME_ALLOCATION_LOCAL ? asid : 0];
+            process->resident.prev = simulator->resident_prev;
+            process->resident.next = simulator->resident_next;
+            if (process->page_table == NULL)
+            {
+                checkpoint->error = 1;
+                return;
+            }
+        }
+        if (!page_table_type->shared && page_table_type->checkpoint != NULL)
+        {
+            page_table_type->checkpoint(process->page_table, checkpoint);
+        }
+    }
+    if (page_table_type->shared && page_table_type->checkpoint != NULL)
+    {
+        page_table_type->checkpoint(simulator->shared_page_table, checkpoint);
+    }
+    /* Every resident frame must belong to a restored process; tables without a hook are rebuilt from the frames. */
+    if (checkpoint->restoring)
+    {
+        for (int frame_number = 0; frame_number < simulator->physical_memory_frames && !checkpoint->error; frame_number++)
+        {
+            unsigned long long key = simulator->frame_page[frame_number];
+            unsigned int owner = (unsigned int)(key >> geometry.page_number_bits);
+            if (key == NO_PAGE)
+            {
+                continue;
+            }
+            if (owner >= simulator->process_limit || simulator->processes[owner].page_table == NULL)
+            {
+                checkpoint->error = 1;
+                return;
+            }
+            if (page_table_type->checkpoint == NULL)
+            {
+                page_table_map(&simulator->processes[owner], owner, key & geometry.page_mask, frame_number);
+            }
+        }
+    }
+}
+
+static void checkpoint_store_writer(Store_writer *writer, Checkpoint *checkpoint)
+{
+    CHECKPOINT_FIELD(checkpoint, writer->count);
+    if (writer->count < 0 || writer->count > writer->capacity)
+    {
+        checkpoint->error = 1;
+        return;
+    }
+    checkpoint_bytes(checkpoint, writer->queue, writer->count * sizeof(Writeback_entry));
+    for (int i = 0; i < writer->count && checkpoint->restoring; i++)
+    {
+        checkpoint->error |= writer->queue[i].slot < 0 || writer->queue[i].slot >= writer->capacity;
+    }
+    checkpoint_bytes(checkpoint, writer->buffers, (size_t)writer->capacity << geometry.offset_bits);
+    checkpoint_page_map(checkpoint, &writer->queued);
+    checkpoint_page_map_indices(checkpoint, &writer->queued, writer->capacity);
+    checkpoint_page_map(checkpoint, &writer->copies);
+    CHECKPOINT_FIELD(checkpoint, writer->copy_count);
+    if (checkpoint->restoring && writer->copy_count > checkpoint->size >> geometry.offset_bits)
+    {
+        checkpoint->error = 1;
+        return;
+    }
+    checkpoint_page_map_indices(checkpoint, &writer->copies, (long long)writer->copy_count);
+    if (checkpoint->restoring && !checkpoint->error && writer->copy_count > writer->copy_capacity)
+    {
+        char *copy_data = realloc(writer->copy_data, writer->copy_count << geometry.offset_bits);
+        if (copy_data == NULL)
+        {
+            checkpoint->error = 1;
+            return;
+        }
+        writer->copy_data = copy_data;
+        writer->copy_capacity = writer->copy_count;
+    }
+    checkpoint_bytes(checkpoint, writer->copy_data, writer->copy_count << geometry.offset_bits);
+}
+
+/* Everything a run changes, except physical memory, which save_checkpoint and restore_checkpoint handle themselves. */
+static void checkpoint_simulator(Simulator *simulator, Checkpoint *checkpoint)
+{
+    size_t frames = (size_t)simulator->physical_memory_frames;
+    long long current = simulator->current_process != NULL ? simulator->current_process - simulator->processes : -1;
+
+    CHECKPOINT_FIELD(checkpoint, simulator->current_access);
+    CHECKPOINT_FIELD(checkpoint, simulator->current_asid);
+    CHECKPOINT_FIELD(checkpoint, current);
+    CHECKPOINT_FIELD(checkpoint, simulator->page_fault_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->total_translated_addresses);
+    CHECKPOINT_FIELD(checkpoint, simulator->tlb_hit_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->l2_tlb_hit_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->page_walk_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->page_walk_references);
+    CHECKPOINT_FIELD(checkpoint, simulator->context_switch_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->tlb_flush_counter);
+    CHECKPOINT_FIELD(checkpoint, simulator->write_accesses);
+    CHECKPOINT_FIELD(checkpoint, simulator->dirty_evictions);
+    CHECKPOINT_FIELD(checkpoint, simulator->writeback_batches);
+    CHECKPOINT_FIELD(checkpoint, simulator->bytes_written);
+    CHECKPOINT_FIELD(checkpoint, simulator->resident_frames);
+    CHECKPOINT_FIELD(checkpoint, simulator->peak_resident_frames);
+    CHECKPOINT_FIELD(checkpoint, simulator->resident_sum);
+    CHECKPOINT_FIELD(checkpoint, simulator->released_frames);
+    CHECKPOINT_FIELD(checkpoint, simulator->replacement_evictions);
+    CHECKPOINT_FIELD(checkpoint, simulator->prefetch_reads);
+    CHECKPOINT_FIELD(checkpoint, simulator->prefetch_hits);
+
+    checkpoint_bytes(checkpoint, simulator->frame_page, frames * sizeof(unsigned long long));
+    checkpoint_bytes(checkpoint, simulator->frame_dirty, frames);
+    if (simulator->frame_last_use != NULL)
+    {
+        checkpoint_bytes(checkpoint, simulator->frame_last_use, frames * sizeof(unsigned long long));
+        checkpoint_bytes(checkpoint, simulator->resident_prev, frames * sizeof(int));
+        checkpoint_bytes(checkpoint, simulator->resident_next, frames * sizeof(int));
+        checkpoint_indices(checkpoint, simulator->resident_prev, frames, -1, (int)frames);
+        checkpoint_indices(checkpoint, simulator->resident_next, frames, -1, (int)frames);
+    }
+    if (simulator->frame_prefetched != NULL)
+    {
+        checkpoint_bytes(checkpoint, simulator->frame_prefetched, frames);
+    }
+    if (simulator->next_fault != NULL)
+    {
+        checkpoint_page_map(checkpoint, simulator->next_fault);
+    }
+    checkpoint_tlb(checkpoint, &simulator->tlb, (int)frames);
+    if (simulator->l2_tlb.size > 0)
+    {
+        checkpoint_tlb(checkpoint, &simulator->l2_tlb, (int)frames);
+    }
+    for (int i = 0; i < simulator->frame_pool_count; i++)
+    {
+        Frame_pool *pool = &simulator->frame_pools[i];
+        CHECKPOINT_FIELD(checkpoint, pool->next_unused_frame);
+        CHECKPOINT_FIELD(checkpoint, pool->free_count);
+        checkpoint_indices(checkpoint, &pool->next_unused_frame, 1, 0, pool->frames + 1);
+        checkpoint_indices(checkpoint, &pool->free_count, 1, 0, pool->frames + 1);
+        checkpoint_bytes(checkpoint, pool->free_frames, pool->frames * sizeof(int));
+        checkpoint_indices(checkpoint, pool->free_frames, pool->free_count, 0, pool->frames);
+        simulator->policy->checkpoint(pool->policy_state, pool->frames, checkpoint);
+    }
+    checkpoint_processes(simulator, checkpoint);
+    checkpoint_store_writer(simulator->store_writer, checkpoint);
+    if (checkpoint->restoring && !checkpoint->error)
+    {
+        if (current < -1 || current >= (long long)simulator->process_limit ||
+            simulator->resident_frames < 0 || simulator->resident_frames > (int)frames)
+        {
+            checkpoint->error = 1;
+            return;
+        }
+        simulator->current_process = current >= 0 ? &simulator->processes[current] : NULL;
+    }
+}
+
+int save_checkpoint(Simulator *simulator, const char *path)
+{
+    Checkpoint checkpoint = {0, fopen(path, "wb"), NULL, 0, 0, 0, 0};
+    Checkpoint_header header;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t arena_size = (size_t)simulator->physical_memory_frames << geometry.offset_bits;
+
+    if (checkpoint.file == NULL)
+    {
+        printf("Error: could not write checkpoint file\n");
+        return -1;
+    }
+    fill_checkpoint_header(simulator, &header);
+    CHECKPOINT_FIELD(&checkpoint, header);
+    checkpoint.checksum = CHECKPOINT_CHECKSUM_SEED;
+    checkpoint_simulator(simulator, &checkpoint);
+    header.state_size = checkpoint.position - sizeof(header);
+    header.state_checksum = checkpoint.checksum;
+
+    /* The arena starts and ends on a page boundary, so restore_checkpoint can map it and never touch past the end. */
+    header.memory_offset = (checkpoint.position + page - 1) / page * page;
+    if (!checkpoint.error && fseek(checkpoint.file, (long)header.memory_offset, SEEK_SET) == 0)
+    {
+        checkpoint_bytes(&checkpoint, simulator->physical_memory, arena_size);
+        checkpoint.error |= fflush(checkpoint.file) != 0 ||
+                            ftruncate(fileno(checkpoint.file), (off_t)(header.memory_offset + (arena_size + page - 1) / page * page)) != 0 ||
+                            fseek(checkpoint.file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, checkpoint.file) != 1;
+    }
+    else
+    {
+        checkpoint.error = 1;
+    }
+    if (fclose(checkpoint.file) != 0 || checkpoint.error)
+    {
+        printf("Error: could not write checkpoint file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Loads a checkpoint into a simulator just built by init_simulator; *access_index is where the saved run stopped. */
+int restore_checkpoint(Simulator *simulator, const char *path, unsigned long long *access_index)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    const char *data = MAP_FAILED;
+    Checkpoint_header header, expected;
+    size_t arena_size = (size_t)simulator->physical_memory_frames << geometry.offset_bits;
+
+    if (fd < 0 || fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(Checkpoint_header) ||
+        (data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        printf("Error: could not read checkpoint file\n");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    fill_checkpoint_header(simulator, &expected);
+    expected.access_index = header.access_index;
+    expected.memory_offset = header.memory_offset;
+    expected.state_size = header.state_size;
+    expected.state_checksum = header.state_checksum;
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION)
+    {
+        printf("Error: %s is not a checkpoint of this version\n", path);
+        munmap((void *)data, status.st_size);
+        close(fd);
+        return -1;
+    }
+    if (memcmp(&header, &expected, sizeof(header)) != 0)
+    {
+        printf("Error: the checkpoint was taken with different machine options or algorithm\n");
+        munmap((void *)data, status.st_size);
+        close(fd);
+        return -1;
+    }
+
+    /* Nothing is applied from a state section that does not hash to what was saved. */
+    Checkpoint checkpoint = {1, NULL, data, sizeof(header) + header.state_size, sizeof(header), 0, 0};
+    checkpoint.error = header.state_size > (size_t)status.st_size - sizeof(header) ||
+                       checkpoint_checksum(CHECKPOINT_CHECKSUM_SEED, data + sizeof(header), header.state_size) != header.state_checksum;
+    checkpoint_simulator(simulator, &checkpoint);
+    if (checkpoint.error || header.memory_offset > (size_t)status.st_size || arena_size > (size_t)status.st_size - header.memory_offset ||
+        mmap(simulator->physical_memory, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)header.memory_offset) == MAP_FAILED)
+    {
+        printf("Error: the checkpoint is truncated or corrupt\n");
+        munmap((void *)data, status.st_size);
+        close(fd);
+        return -1;
+    }
+    munmap((void *)data, status.st_size);
+    close(fd);
+    *access_index = header.access_index;
+    return 0;
+}
+
+/*
+    Output is formatted by hand into a large buffer that is written out with one write() whenever it fills up, instead
+    of an fprintf per translated address. "-" writes to standard output.
+*/
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_LINE_MAX 256
+
+typedef struct Output_writer
+{
+    int fd;
+    char *buffer;
+    size_t length;
+    int error;
+} Output_writer;
+
+Output_writer *open_output(char *path)
+{
+    Output_writer *writer = malloc(sizeof(Output_writer));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+
+    writer->fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    writer->length = 0;
+    writer->error = 0;
+    if (writer->fd < 0 || writer->buffer == NULL)
+    {
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void flush_output(Output_writer *writer)
+{
+    size_t written = 0;
+
+    while (written < writer->length)
+    {
+        ssize_t result = write(writer->fd, writer->buffer + written, writer->length - written);
+        if (result <= 0)
+        {
+            writer->error = 1;
+            break;
+        }
+        written += result;
+    }
+    writer->length = 0;
+}
+
+int close_output(Output_writer *writer)
+{
+    flush_output(writer);
+
+    int error = writer->error;
+    if (writer->fd != STDOUT_FILENO && close(writer->fd) != 0)
+    {
+        error = 1;
+    }
+    free(writer->buffer);
+    free(writer);
+    return error ? -1 : 0;
+}
+
+static inline void output_reserve(Output_writer *writer, size_t length)
+{
+    if (writer->length + length > OUTPUT_BUFFER_SIZE)
+    {
+        flush_output(writer);
+    }
+}
+
+static inline void output_text(Output_writer *writer, const char *text, size_t length)
+{
+    memcpy(writer->buffer + writer->length, text, length);
+    writer->length += length;
+}
+
+static inline void output_unsigned(Output_writer *writer, unsigned long long value)
+{
+    char digits[20];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    char *out = writer->buffer + writer->length;
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = digits[count - 1 - i];
+    }
+    writer->length += count;
+}
+
+static inline void output_signed(Output_writer *writer, long long value)
+{
+    if (value < 0)
+    {
+        writer->buffer[writer->length++] = '-';
+        output_unsigned(writer, 0ULL - (unsigned long long)value);
+    }
+    else
+    {
+        output_unsigned(writer, (unsigned long long)value);
+    }
+}
+
+#define OUTPUT_LITERAL(writer, text) output_text(writer, text, sizeof(text) - 1)
+
+void write_translation(Output_writer *writer, unsigned long long virtual_address, int tlb_index, long long physical_address, int value)
+{
+    output_reserve(writer, OUTPUT_LINE_MAX);
+    OUTPUT_LITERAL(writer, "Virtual address: ");
+    output_unsigned(writer, virtual_address);
+    OUTPUT_LITERAL(writer, " TLB: ");
+    output_signed(writer, tlb_index);
+    OUTPUT_LITERAL(writer, " Physical address: ");
+    output_signed(writer, physical_address);
+    OUTPUT_LITERAL(writer, " Value: ");
+    output_signed(writer, value);
+    OUTPUT_LITERAL(writer, "\n");
+}
+
+/* printf-style output for the occasional report line; not meant for the per-address path. */
+__attribute__((format(printf, 2, 3))) void output_printf(Output_writer *writer, const char *format, ...)
+{
+    va_list arguments;
+
+    output_reserve(writer, OUTPUT_LINE_MAX);
+    va_start(arguments, format);
+    int length = vsnprintf(writer->buffer + writer->length, OUTPUT_LINE_MAX, format, arguments);
+    va_end(arguments);
+    if (length > 0)
+    {
+        writer->length += length < OUTPUT_LINE_MAX ? length : OUTPUT_LINE_MAX - 1;
+    }
+}
+
+int stats_only = 0;
+int extended_stats = 0;
+
+long long physical_address_calculator(int frame_number, unsigned long long offset)
+{
+    return ((long long)frame_number << geometry.offset_bits) | offset;
+}
+
+int value_calculator(Simulator *simulator, int frame_number, unsigned long long offset)
+{
+    return (signed char)frame_data(simulator, frame_number)[offset];
+}
+
+/*
+    Submits the reads of upcoming addresses whose pages are not resident now, scanning from *cursor until the reader
+    has no free slot or the scan is io_depth addresses ahead. Resident pages are remembered in upcoming so that an
+    eviction before their access can resubmit them. The residency check is a page-table lookup not charged as a walk.
+*/
+static void submit_upcoming_reads(Simulator *simulator, const Address *addresses, int count, int current, int *cursor)
+{
+    Page_reader *reader = simulator->page_reader;
+    int end = count - current > reader->depth ? current + reader->depth : count;
+    const Address *address = &addresses[current];
+    unsigned long long key = page_key(address->process, address->page_number);
+
+    if ((unsigned long long)page_map_get(&reader->upcoming, key) == simulator->current_access)
+    {
+        page_map_remove(&reader->upcoming, key);
+    }
+    if (*cursor < current)
+    {
+        *cursor = current;
+    }
+    while (*cursor < end && reader->free_count > 0)
+    {
+        address = &addresses[*cursor];
+        key = page_key(address->process, address->page_number);
+        Process *process = &simulator->processes[address->process];
+        int references;
+
+        if (process->page_table == NULL || page_table_type->lookup(process->page_table, address->process, address->page_number, &references) < 0)
+        {
+            if (!zswap_holds(simulator->zswap, key))
+            {
+                page_reader_submit(reader, key, address->page_number);
+            }
+        }
+        else
+        {
+            page_map_put(&reader->upcoming, key, (long long)(simulator->current_access + (*cursor - current)));
+        }
+        (*cursor)++;
+    }
+    page_reader_flush(reader);
+}
+
+/*
+    Addresses are streamed through in chunks of ADDRESS_CHUNK_SIZE: a chunk is decoded, translated and written out before
+    the next one is read, so memory stays bounded by the chunk size whatever the trace length. output_file is NULL when
+    no per-address lines are wanted.
+*/
+int check_tlb(Simulator *simulator, const Address *addresses, int count, Output_writer *output_file)
+{
+    unsigned long long page_number_to_check;
+    int read_cursor = 0;
+
+    for (const Address *current_address = addresses; current_address < addresses + count; current_address++)
+    {
+        if (simulator->page_reader != NULL)
+        {
+            submit_upcoming_reads(simulator, addresses, count, (int)(current_address - addresses), &read_cursor);
+        }
+        if (current_address->process != simulator->current_asid || simulator->current_process == NULL)
+        {
+            if (switch_process(simulator, current_address->process) != 0)
+            {
+                return -1;
+            }
+        }
+        Process *process = simulator->current_process;
+        Frame_pool *pool = process->pool;
+        page_number_to_check = current_address->page_number;
+        unsigned long long key = page_key(simulator->current_asid, page_number_to_check);
+        int frame_number = -1;
+        int tlb_index = tlb_lookup(&simulator->tlb, key, &frame_number);
+
+        if (tlb_index < 0 && simulator->huge_pages != NULL)
+        {
+            tlb_index = huge_tlb_lookup(simulator, key, page_number_to_check, &frame_number);
+        }
+        process->translated_addresses++;
+        if (tlb_index >= 0)
+        {
+            simulator->tlb_hit_counter++;
+            process->tlb_hits++;
+            unsigned long long offset = current_address->offset;
+            long long physical_address = physical_address_calculator(frame_number, offset);
+            int value = current_address->write ? write_value(simulator, pool, frame_number, offset) : value_calculator(simulator, frame_number, offset);
+            if (output_file != NULL)
+            {
+                write_translation(output_file, current_address->virtual_address, tlb_index, physical_address, value);
+            }
+
+            simulator->policy->on_access(pool->policy_state, frame_number - pool->first_frame);
+        }
+        else
+        {
+            int from_l2 = simulator->l2_tlb.size > 0 && (frame_number = l2_tlb_lookup(simulator, key)) >= 0;
+            if (!from_l2)
+            {
+                frame_number = page_table_lookup(simulator, page_number_to_check);
+            }
+            if (frame_number < 0)
+            {
+                simulator->page_fault_counter++;
+                process->page_faults++;
+                process->interval_faults++;
+                if (simulator->frame_allocation == FRAME_ALLOCATION_PFF)
+                {
+                    adjust_page_fault_frequency(simulator, process);
+                }
+                INSTRUMENT_START(timer);
+                frame_number = handle_page_fault(simulator, page_number_to_check);
+                INSTRUMENT_STOP(PHASE_PAGE_FAULT, timer);
+            }
+            else
+            {
+                simulator->policy->on_access(pool->policy_state, frame_number - pool->first_frame);
+            }
+
+            unsigned long long offset = current_address->offset;
+            long long physical_address = physical_address_calculator(frame_number, offset);
+            int value = current_address->write ? write_value(simulator, pool, frame_number, offset) : value_calculator(simulator, frame_number, offset);
+            Tlb *fill_tlb = &simulator->tlb;
+            unsigned long long tag = key;
+            int reported_index;
+            if (simulator->huge_pages != NULL && huge_region_promoted(simulator, key))
+            {
+                fill_tlb = huge_tlb(simulator);
+                tag = huge_tag(simulator->huge_pages, key);
+            }
+            tlb_index = tlb_select_entry(fill_tlb, tag);
+            reported_index = fill_tlb == &simulator->tlb ? tlb_index : simulator->tlb.size + tlb_index;
+            if (output_file != NULL)
+            {
+                write_translation(output_file, current_address->virtual_address, reported_index, physical_address, value);
+            }
+
+            if (fill_tlb == &simulator->tlb)
+            {
+                fill_tlb_hierarchy(simulator, tag, frame_number, tlb_index, from_l2);
+            }
+            else
+            {
+                update_tlb(fill_tlb, tag, frame_number, tlb_index);
+            }
+        }
+        if (simulator->frame_prefetched != NULL && simulator->frame_prefetched[frame_number])
+        {
+            simulator->frame_prefetched[frame_number] = 0;
+            simulator->prefetch_hits++;
+            train_prefetcher(simulator, process, page_number_to_check);
+        }
+        if (simulator->huge_pages != NULL)
+        {
+            huge_page_access(simulator, key);
+        }
+        if (simulator->frame_last_use != NULL)
+        {
+            track_resident_use(simulator, process, frame_number);
+            simulator->resident_sum += simulator->resident_frames;
+        }
+        simulator->current_access++;
+        if (simulator->interval_length > 0)
+        {
+            process->interval_accesses++;
+            if (++simulator->interval_position == simulator->interval_length && record_interval(simulator) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    simulator->total_translated_addresses += count;
+    return 0;
+}
+
+/*
+    Trace input. Text traces hold one address per line, in decimal or 0x-prefixed hex, optionally preceded by a process
+    id ("pid address") and followed by R or W for a read or a write ("address W"); they are read in TRACE_BLOCK_SIZE
+    blocks and parsed in place, and only whole lines are consumed from a block. Binary traces are raw little-endian u32
+    or u64 addresses, optionally preceded by a Trace_header, and are mmapped and decoded straight out of the mapping.
+    With TRACE_FLAG_PROCESS_IDS or TRACE_FLAG_WRITES set in the header, every address is preceded by a u32 meta word
+    whose low 16 bits are the process id and whose top bit marks a write. Addresses without a process id belong to
+    process 0, and unmarked accesses are reads.
+*/
+#define TRACE_BLOCK_SIZE (1 << 20)
+#define TRACE_MAGIC "VMTRACE"
+#define TRACE_VERSION 1
+#define TRACE_FLAG_PROCESS_IDS 1ULL
+#define TRACE_FLAG_WRITES 2ULL
+#define TRACE_META_SIZE 4
+#define TRACE_META_PROCESS_MASK 0xFFFFu
+#define TRACE_META_WRITE (1u << 31)
+
+enum
+{
+    TRACE_FORMAT_AUTO,
+    TRACE_FORMAT_TEXT,
+    TRACE_FORMAT_BINARY32,
+    TRACE_FORMAT_BINARY64
+};
+
+const char *trace_format_names[] = {"auto", "text", "bin32", "bin64"};
+
+typedef struct Trace_header
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned long long count;
+    unsigned long long flags;
+} Trace_header;
+
+typedef struct Trace_reader
+{
+    int fd;
+    int format;
+    char *buffer;
+    size_t length;
+    size_t position;
+    int end_of_file;
+    unsigned long long line;
+    const unsigned char *map;
+    size_t map_size;
+    size_t data_offset;
+    size_t record_size;
+    size_t stride;
+    int process_ids;
+    int writes;
+    int error;
+} Trace_reader;
+
+int open_trace(Trace_reader *trace, char *path, int format)
+{
+    memset(trace, 0, sizeof(Trace_reader));
+    trace->fd = open(path, O_RDONLY);
+    if (trace->fd < 0)
+    {
+        printf("Error: could not open addresses file\n");
+        return -1;
+    }
+
+    Trace_header header;
+    ssize_t header_length = pread(trace->fd, &header, sizeof(header), 0);
+    int has_header = header_length == (ssize_t)sizeof(header) && memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0;
+
+    if (format == TRACE_FORMAT_AUTO)
+    {
+        format = has_header ? (header.record_size == 8 ? TRACE_FORMAT_BINARY64 : TRACE_FORMAT_BINARY32) : TRACE_FORMAT_TEXT;
+    }
+    trace->format = format;
+
+    if (format == TRACE_FORMAT_TEXT)
+    {
+        trace->buffer = malloc(TRACE_BLOCK_SIZE);
+        if (trace->buffer == NULL)
+        {
+            printf("Error: could not allocate trace buffer\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    struct stat file_status;
+    if (fstat(trace->fd, &file_status) != 0)
+    {
+        printf("Error: could not open addresses file\n");
+        return -1;
+    }
+    if (has_header && (header.version != TRACE_VERSION || (header.record_size != 4 && header.record_size != 8) ||
+                       (header.flags & ~(TRACE_FLAG_PROCESS_IDS | TRACE_FLAG_WRITES)) != 0))
+    {
+        printf("Error: unsupported binary trace version, record size or flags\n");
+        return -1;
+    }
+
+    trace->record_size = has_header ? header.record_size : (format == TRACE_FORMAT_BINARY64 ? 8 : 4);
+    trace->process_ids = has_header && (header.flags & TRACE_FLAG_PROCESS_IDS) != 0;
+    trace->writes = has_header && (header.flags & TRACE_FLAG_WRITES) != 0;
+    trace->stride = trace->record_size + (trace->process_ids || trace->writes ? TRACE_META_SIZE : 0);
+    trace->data_offset = has_header ? sizeof(header) : 0;
+    trace->position = trace->data_offset;
+    trace->map_size = file_status.st_size;
+    if (trace->map_size > trace->data_offset)
+    {
+        void *map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, trace->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            printf("Error: binary traces must be regular files\n");
+            return -1;
+        }
+        madvise(map, trace->map_size, MADV_SEQUENTIAL);
+        trace->map = map;
+    }
+    return 0;
+}
+
+void close_trace(Trace_reader *trace)
+{
+    if (trace->map != NULL)
+    {
+        munmap((void *)trace->map, trace->map_size);
+    }
+    free(trace->buffer);
+    if (trace->fd >= 0)
+    {
+        close(trace->fd);
+    }
+}
+
+int rewind_trace(Trace_reader *trace)
+{
+    if (trace->format != TRACE_FORMAT_TEXT)
+    {
+        trace->position = trace->data_offset;
+        return 0;
+    }
+    trace->length = 0;
+    trace->position = 0;
+    trace->end_of_file = 0;
+    trace->line = 0;
+    return lseek(trace->fd, 0, SEEK_SET) == 0 ? 0 : -1;
+}
+
+static inline int is_eight_digits(unsigned long long chunk)
+{
+    return (((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+/* SWAR conversion of eight ASCII digits (little-endian load) into their value. */
+static inline unsigned long long parse_eight_digits(unsigned long long chunk)
+{
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+             (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return chunk;
+}
+
+static inline int hex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/*
+    Parses the number starting at *cursor, stopping at end. Returns -1 if there is no number there or it does not fit
+    in 64 bits; the cursor is left on the first unconsumed character.
+*/
+int parse_address(const char **cursor, const char *end, unsigned long long *value)
+{
+    const char *p = *cursor;
+    unsigned long long result = 0;
+
+    if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' && hex_digit_value(p[2]) >= 0)
+    {
+        int digit;
+        for (p += 2; p < end && (digit = hex_digit_value(*p)) >= 0; p++)
+        {
+            if (result >> 60 != 0)
+            {
+                return -1;
+            }
+            result = (result << 4) | digit;
+        }
+    }
+    else
+    {
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            return -1;
+        }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        unsigned long long chunk;
+        while (end - p >= 8 && (memcpy(&chunk, p, 8), is_eight_digits(chunk)))
+        {
+            unsigned long long digits = parse_eight_digits(chunk);
+            if (result > (ULLONG_MAX - digits) / 100000000ULL)
+            {
+                return -1;
+            }
+            result = result * 100000000ULL + digits;
+            p += 8;
+        }
+#endif
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (result > (ULLONG_MAX - (*p - '0')) / 10)
+            {
+                return -1;
+            }
+            result = result * 10 + (*p - '0');
+        }
+    }
+
+    *cursor = p;
+    *value = result;
+    return 0;
+}
+
+static int refill_trace_buffer(Trace_reader *trace)
+{
+    size_t remaining = trace->length - trace->position;
+
+    memmove(trace->buffer, trace->buffer + trace->position, remaining);
+    trace->length = remaining;
+    trace->position = 0;
+    while (!trace->end_of_file && trace->length < TRACE_BLOCK_SIZE)
+    {
+        ssize_t bytes_read = read(trace->fd, trace->buffer + trace->length, TRACE_BLOCK_SIZE - trace->length);
+        if (bytes_read <= 0)
+        {
+            trace->end_of_file = 1;
+            break;
+        }
+        trace->length += bytes_read;
+    }
+    return trace->length > 0;
+}
+
+static int read_text_trace(Trace_reader *trace, Address *addresses, int capacity)
+{
+    int count = 0;
+
+    while (count < capacity)
+    {
+        char *start = trace->buffer + trace->position;
+        char *newline = memchr(start, '\n', trace->length - trace->position);
+
+        if (newline == NULL)
+        {
+            if (!trace->end_of_file)
+            {
+                if (trace->position == 0 && trace->length == TRACE_BLOCK_SIZE)
+                {
+                    printf("Error: line %llu of the addresses file is too long\n", trace->line + 1);
+                    trace->error = 1;
+                    return count;
+                }
+                refill_trace_buffer(trace);
+                continue;
+            }
+            if (trace->position == trace->length)
+            {
+                break;
+            }
+            newline = trace->buffer + trace->length;
+        }
+
+        const char *cursor = start;
+        trace->line++;
+        trace->position = newline - trace->buffer + (newline < trace->buffer + trace->length);
+
+        while (cursor < newline && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+        {
+            cursor++;
+        }
+        if (cursor == newline)
+        {
+            continue;
+        }
+        if (parse_address(&cursor, newline, &addresses[count].virtual_address) != 0)
+        {
+            printf("Error: invalid address on line %llu of the addresses file\n", trace->line);
+            trace->error = 1;
+            return count;
+        }
+        addresses[count].process = 0;
+        addresses[count].write = 0;
+        while (cursor < newline && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+        {
+            cursor++;
+        }
+        if (cursor != newline && *cursor >= '0' && *cursor <= '9')
+        {
+            unsigned long long process = addresses[count].virtual_address;
+            if (process >= MAX_PROCESSES || parse_address(&cursor, newline, &addresses[count].virtual_address) != 0)
+            {
+                printf("Error: invalid process id or address on line %llu of the addresses file\n", trace->line);
+                trace->error = 1;
+                return count;
+            }
+            addresses[count].process = (unsigned int)process;
+            trace->process_ids = 1;
+            while (cursor < newline && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+            {
+                cursor++;
+            }
+        }
+        if (cursor != newline && ((*cursor | 0x20) == 'r' || (*cursor | 0x20) == 'w'))
+        {
+            addresses[count].write = (*cursor | 0x20) == 'w';
+            trace->writes |= addresses[count].write;
+            cursor++;
+            while (cursor < newline && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+            {
+                cursor++;
+            }
+        }
+        if (cursor != newline)
+        {
+            printf("Error: unexpected text after the address on line %llu of the addresses file\n", trace->line);
+            trace->error = 1;
+            return count;
+        }
+        count++;
+    }
+    return count;
+}
+
+static int read_binary_trace(Trace_reader *trace, Address *addresses, int capacity)
+{
+    size_t available = trace->map_size > trace->position ? (trace->map_size - trace->position) / trace->stride : 0;
+    int count = available < (size_t)capacity ? (int)available : capacity;
+    const unsigned char *record = trace->map + trace->position;
+
+    for (int i = 0; i < count; i++, record += trace->stride)
+    {
+        const unsigned char *address = record;
+        unsigned long long value = 0;
+
+        addresses[i].process = 0;
+        addresses[i].write = 0;
+        if (trace->stride > trace->record_size)
+        {
+            unsigned int meta = record[0] | record[1] << 8 | record[2] << 16 | (unsigned int)record[3] << 24;
+            addresses[i].process = meta & TRACE_META_PROCESS_MASK;
+            addresses[i].write = (meta & TRACE_META_WRITE) != 0;
+            address += TRACE_META_SIZE;
+        }
+        for (size_t byte = trace->record_size; byte-- > 0;)
+        {
+            value = (value << 8) | address[byte];
+        }
+        addresses[i].virtual_address = value;
+    }
+    trace->position += count * trace->stride;
+    return count;
+}
+
+/*
+    Fills up to capacity addresses (virtual_address, process and write only); returns how many, 0 at the end of the trace or
+    on error.
+*/
+int read_trace(Trace_reader *trace, Address *addresses, int capacity)
+{
+    if (trace->error)
+    {
+        return 0;
+    }
+    return trace->format == TRACE_FORMAT_TEXT ? read_text_trace(trace, addresses, capacity) : read_binary_trace(trace, addresses, capacity);
+}
+
+/* Writes address as one binary record, its meta word first when the trace has them; returns the end of the record. */
+static unsigned char *encode_trace_record(unsigned char *record, const Address *address, int record_size, int meta)
+{
+    if (meta)
+    {
+        unsigned int word = address->process | (address->write ? TRACE_META_WRITE : 0);
+        for (int byte = 0; byte < TRACE_META_SIZE; byte++)
+        {
+            *record++ = (unsigned char)(word >> (8 * byte));
+        }
+    }
+    for (int byte = 0; byte < record_size; byte++)
+    {
+        *record++ = (unsigned char)(address->virtual_address >> (8 * byte));
+    }
+    return record;
+}
+
+/*
+    Process ids and write marks are kept when the source has any. A text trace only shows that once it has been read, so
+    it gets a first pass to find out, and is rewound.
+*/
+int convert_trace(Trace_reader *trace, char *output_path, int record_size)
+{
+    FILE *output = fopen(output_path, "wb");
+    Address *chunk = malloc(ADDRESS_CHUNK_SIZE * sizeof(Address));
+    unsigned char *records = malloc((size_t)ADDRESS_CHUNK_SIZE * (record_size + TRACE_META_SIZE));
+    Trace_header header = {TRACE_MAGIC, TRACE_VERSION, (unsigned int)record_size, 0, 0};
+    int status = output != NULL && chunk != NULL && records != NULL ? 0 : -1;
+    int count;
+
+    if (status == 0 && trace->format == TRACE_FORMAT_TEXT)
+    {
+        while (!(trace->process_ids && trace->writes) && read_trace(trace, chunk, ADDRESS_CHUNK_SIZE) > 0)
+        {
+        }
+        if (trace->error || rewind_trace(trace) != 0)
+        {
+            status = -1;
+        }
+    }
+    if (status == 0)
+    {
+        header.flags = (trace->process_ids ? TRACE_FLAG_PROCESS_IDS : 0) | (trace->writes ? TRACE_FLAG_WRITES : 0);
+        size_t stride = record_size + (header.flags != 0 ? TRACE_META_SIZE : 0);
+
+        fwrite(&header, sizeof(header), 1, output);
+        while ((count = read_trace(trace, chunk, ADDRESS_CHUNK_SIZE)) > 0)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                unsigned long long value = chunk[i].virtual_address;
+                if (record_size == 4 && value > 0xFFFFFFFFULL)
+                {
+                    printf("Error: address %llu does not fit in a 32-bit trace record\n", value);
+                    trace->error = 1;
+                    break;
+                }
+                encode_trace_record(records + i * stride, &chunk[i], record_size, header.flags != 0);
+            }
+            if (trace->error)
+            {
+                break;
+            }
+            fwrite(records, stride, count, output);
+            header.count += count;
+        }
+        fseek(output, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, output);
+    }
+
+    /* Every failure ends here, and a partly written output file is removed. */
+    free(chunk);
+    free(records);
+    if ((output != NULL && fclose(output) != 0) || trace->error)
+    {
+        status = -1;
+    }
+    if (status != 0)
+    {
+        printf("Error: could not write converted trace\n");
+        if (output != NULL)
+        {
+            remove(output_path);
+        }
+    }
+    return status;
+}
+
+/*
+    Synthetic traces (--generate). Every pattern draws its pages from a footprint of --footprint pages and depends only
+    on the options and --seed, so the same command always writes the same trace:
+        uniform     each access picks a page uniformly at random;
+        zipf        page popularity follows a Zipf law of exponent --zipf-skew; ranks are scattered over the footprint
+                    by a seeded permutation, so hot pages are not neighbours;
+        sequential  an 8-byte scan through the footprint that wraps at its end;
+        stride      one access per page, --stride pages apart, wrapping;
+        loop        one access per page, cycling through the footprint in order;
+        phase       GENERATE_PHASES phases of zipf, loop, uniform and sequential in turn, each over a footprint shifted
+                    by half its size from the previous one.
+    Offsets within a page are random except in the scan, and --write-ratio of the accesses, picked at random, are writes.
+    The trace is written in the binary format, with 32-bit records when the address space fits.
+*/
+#define DEFAULT_TRACE_LENGTH 1000000
+#define DEFAULT_FOOTPRINT 4096
+#define MAX_FOOTPRINT (1 << 24)
+#define DEFAULT_ZIPF_SKEW 0.99
+#define DEFAULT_STRIDE 4
+#define GENERATE_PHASES 8
+#define SCAN_STEP 8
+
+enum
+{
+    PATTERN_UNIFORM,
+    PATTERN_ZIPF,
+    PATTERN_SEQUENTIAL,
+    PATTERN_STRIDE,
+    PATTERN_LOOP,
+    PATTERN_PHASE
+};
+const char *pattern_names[] = {"uniform", "zipf", "sequential", "stride", "loop", "phase"};
+const int phase_patterns[] = {PATTERN_ZIPF, PATTERN_LOOP, PATTERN_UNIFORM, PATTERN_SEQUENTIAL};
+
+typedef struct Generator
+{
+    unsigned long long state; /* splitmix64 */
+    unsigned long long footprint;
+    unsigned long long stride;
+    double *zipf_cdf;         /* NULL unless a pattern needs it */
+    unsigned int *zipf_pages; /* page of each popularity rank */
+    unsigned long long position;
+} Generator;
+
+static inline unsigned long long next_random(Generator *generator)
+{
+    unsigned long long z = (generator->state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline double next_uniform(Generator *generator)
+{
+    return (next_random(generator) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int init_zipf(Generator *generator, double skew)
+{
+    unsigned long long n = generator->footprint;
+    double total = 0;
+
+    generator->zipf_cdf = malloc(n * sizeof(double));
+    generator->zipf_pages = malloc(n * sizeof(unsigned int));
+    if (generator->zipf_cdf == NULL || generator->zipf_pages == NULL)
+    {
+        printf("Error: could not allocate the Zipf table\n");
+        return -1;
+    }
+    for (unsigned long long rank = 0; rank < n; rank++)
+    {
+        total += pow((double)(rank + 1), -skew);
+        generator->zipf_cdf[rank] = total;
+        generator->zipf_pages[rank] = (unsigned int)rank;
+    }
+    for (unsigned long long rank = 0; rank < n; rank++)
+    {
+        generator->zipf_cdf[rank] /= total;
+    }
+    for (unsigned long long i = n - 1; i > 0; i--)
+    {
+        unsigned long long j = next_random(generator) % (i + 1);
+        unsigned int page = generator->zipf_pages[i];
+        generator->zipf_pages[i] = generator->zipf_pages[j];
+        generator->zipf_pages[j] = page;
+    }
+    return 0;
+}
+
+static unsigned long long zipf_page(Generator *generator)
+{
+    double u = next_uniform(generator);
+    unsigned long long low = 0;
+    unsigned long long high = generator->footprint - 1;
+
+    while (low < high)
+    {
+        unsigned long long middle = low + (high - low) / 2;
+        if (generator->zipf_cdf[middle] < u)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return generator->zipf_pages[low];
+}
+
+/* Next virtual address of pattern, in the footprint that starts at page base. */
+static unsigned long long generate_address(Generator *generator, int pattern, unsigned long long base)
+{
+    unsigned long long page;
+    unsigned long long offset = next_random(generator) & geometry.offset_mask;
+
+    switch (pattern)
+    {
+    case PATTERN_ZIPF:
+        page = zipf_page(generator);
+        break;
+    case PATTERN_SEQUENTIAL:
+    {
+        unsigned long long byte = generator->position++ * SCAN_STEP % (generator->footprint << geometry.offset_bits);
+        page = byte >> geometry.offset_bits;
+        offset = byte & geometry.offset_mask;
+        break;
+    }
+    case PATTERN_STRIDE:
+        page = generator->position++ * generator->stride % generator->footprint;
+        break;
+    case PATTERN_LOOP:
+        page = generator->position++ % generator->footprint;
+        break;
+    default:
+        page = next_random(generator) % generator->footprint;
+        break;
+    }
+    return (((base + page) & geometry.page_mask) << geometry.offset_bits) | offset;
+}
+
+int generate_trace(int pattern, char *output_path, unsigned long long length, unsigned long long seed, unsigned long long footprint,
+                   double skew, unsigned long long stride, double write_ratio)
+{
+    int record_size = geometry.virtual_address_bits <= 32 ? 4 : 8;
+    Generator generator = {seed, footprint < geometry.number_of_pages ? footprint : geometry.number_of_pages, stride, NULL, NULL, 0};
+    Trace_header header = {TRACE_MAGIC, TRACE_VERSION, (unsigned int)record_size, length, write_ratio > 0 ? TRACE_FLAG_WRITES : 0};
+    int stride_bytes = record_size + (header.flags != 0 ? TRACE_META_SIZE : 0);
+    unsigned long long phase_length = length / GENERATE_PHASES > 0 ? length / GENERATE_PHASES : 1;
+    unsigned char *records = malloc((size_t)ADDRESS_CHUNK_SIZE * stride_bytes);
+    FILE *output = fopen(output_path, "wb");
+    int status = 0;
+
+    if (output == NULL || records == NULL)
+    {
+        printf("Error: could not write generated trace\n");
+        free(records);
+        if (output != NULL)
+        {
+            fclose(output);
+        }
+        return -1;
+    }
+    if ((pattern == PATTERN_ZIPF || pattern == PATTERN_PHASE) && init_zipf(&generator, skew) != 0)
+    {
+        status = -1;
+    }
+
+    fwrite(&header, sizeof(header), 1, output);
+    for (unsigned long long i = 0; status == 0 && i < length;)
+    {
+        unsigned char *record = records;
+        for (int j = 0; j < ADDRESS_CHUNK_SIZE && i < length; j++, i++)
+        {
+            Address address = {0};
+            if (pattern == PATTERN_PHASE)
+            {
+                unsigned long long phase = i / phase_length;
+                if (i % phase_length == 0)
+                {
+                    generator.position = 0;
+                }
+                address.virtual_address = generate_address(&generator, phase_patterns[phase % 4], phase * (generator.footprint / 2));
+            }
+            else
+            {
+                address.virtual_address = generate_address(&generator, pattern, 0);
+            }
+            address.write = write_ratio > 0 && next_uniform(&generator) < write_ratio;
+            record = encode_trace_record(record, &address, record_size, header.flags != 0);
+        }
+        fwrite(records, 1, record - records, output);
+    }
+
+    free(generator.zipf_cdf);
+    free(generator.zipf_pages);
+    free(records);
+    if (fclose(output) != 0 || status != 0)
+    {
+        printf("Error: could not write generated trace\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* process_limit is one more than the highest process id the run accepts. */
+int extract_page_number_and_offset(Trace_reader *trace, unsigned int process_limit, Address *addresses, int capacity)
+{
+    INSTRUMENT_START(timer);
+    int count = read_trace(trace, addresses, capacity);
+
+    for (int i = 0; i < count; i++)
+    {
+        addresses[i].page_number = (addresses[i].virtual_address >> geometry.offset_bits) & geometry.page_mask;
+        addresses[i].offset = addresses[i].virtual_address & geometry.offset_mask;
+        if (addresses[i].process >= process_limit)
+        {
+            printf("Error: process id %u is out of range; this configuration allows %u processes\n", addresses[i].process, process_limit);
+            trace->error = 1;
+            return i;
+        }
+    }
+    INSTRUMENT_STOP(PHASE_PARSE, timer);
+    return count;
+}
+
+/* Turns the page keys of a whole trace into the index of each access's next reference to the same page. */
+unsigned long long *build_next_use(const unsigned long long *keys, size_t total)
+{
+    Page_map last_seen;
+    unsigned long long *next_use = malloc((total > 0 ? total : 1) * sizeof(unsigned long long));
+
+    if (next_use == NULL || page_map_init(&last_seen, 1024) != 0)
+    {
+        printf("Error: could not allocate next-use table\n");
+        free(next_use);
+        return NULL;
+    }
+    for (size_t index = total; index-- > 0;)
+    {
+        long long next = page_map_get(&last_seen, keys[index]);
+        next_use[index] = next == -1 ? NEVER_USED_AGAIN : (unsigned long long)next;
+        page_map_put(&last_seen, keys[index], index);
+    }
+    page_map_free(&last_seen);
+    return next_use;
+}
+
+/*
+    OPT needs to see the future, so it gets one extra pass over the trace before translation; the file is rewound
+    after. Returns the next-use table, or NULL on error.
+*/
+unsigned long long *compute_next_use(Trace_reader *trace, unsigned int process_limit, Address *chunk)
+{
+    size_t capacity = ADDRESS_CHUNK_SIZE;
+    size_t total = 0;
+    unsigned long long *pages = malloc(capacity * sizeof(unsigned long long));
+    int count;
+
+    if (pages == NULL)
+    {
+        printf("Error: could not allocate next-use table\n");
+        return NULL;
+    }
+
+    while ((count = extract_page_number_and_offset(trace, process_limit, chunk, ADDRESS_CHUNK_SIZE)) > 0)
+    {
+        if (total + count > capacity)
+        {
+            capacity *= 2;
+            unsigned long long *grown = realloc(pages, capacity * sizeof(unsigned long long));
+            if (grown == NULL)
+            {
+                printf("Error: could not allocate next-use table\n");
+                free(pages);
+                return NULL;
+            }
+            pages = grown;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            pages[total++] = page_key(chunk[i].process, chunk[i].page_number);
+        }
+    }
+    if (trace->error || rewind_trace(trace) != 0)
+    {
+        printf("Error: opt needs a seekable addresses file\n");
+        free(pages);
+        return NULL;
+    }
+
+    unsigned long long *next_use = build_next_use(pages, total);
+    free(pages);
+    return next_use;
+}
+
+void write_process_stats(Simulator *simulator, Output_writer *output_file)
+{
+    for (unsigned int asid = 0; asid < simulator->process_limit; asid++)
+    {
+        Process *process = &simulator->processes[asid];
+        if (process->translated_addresses == 0)
+        {
+            continue;
+        }
+        output_printf(output_file, "Process %u: Translated Addresses = %llu, Page Faults = %llu, Page Fault Rate = %.3f, TLB Hits = %llu, TLB Hit Rate = %.3f, Peak Resident Frames = %d\n",
+                      asid, process->translated_addresses, process->page_faults, (float)process->page_faults / process->translated_addresses,
+                      process->tlb_hits, (float)process->tlb_hits / process->translated_addresses, process->peak_resident_frames);
+    }
+    output_printf(output_file, "Frame Allocation = %s\n", frame_allocation_names[simulator->frame_allocation]);
+    output_printf(output_file, "Context Switches = %llu\n", simulator->context_switch_counter);
+    output_printf(output_file, "TLB Flushes = %llu\n", simulator->tlb_flush_counter);
+}
+
+/*
+    Accuracy is the share of prefetched pages used before leaving memory, coverage the share of would-be faults that a
+    prefetch absorbed, and wasted reads the prefetched pages that were never used (or not yet, at the end of the run).
+*/
+void write_prefetch_stats(Simulator *simulator, Output_writer *output_file)
+{
+    unsigned long long reads = simulator->prefetch_reads;
+    unsigned long long hits = simulator->prefetch_hits;
+    unsigned long long misses = hits + simulator->page_fault_counter;
+
+    output_printf(output_file, "Prefetch = %s, degree %d\n", prefetch_names[simulator->prefetch], simulator->prefetch_degree);
+    output_printf(output_file, "Prefetched Pages = %llu\n", reads);
+    output_printf(output_file, "Prefetch Hits = %llu\n", hits);
+    output_printf(output_file, "Prefetch Accuracy = %.3f\n", reads ? (double)hits / reads : 0.0);
+    output_printf(output_file, "Prefetch Coverage = %.3f\n", misses ? (double)hits / misses : 0.0);
+    output_printf(output_file, "Wasted Prefetch Reads = %llu\n", reads - hits);
+    output_printf(output_file, "Backing Store Reads = %llu\n",
+                  simulator->page_fault_counter + reads - (simulator->zswap != NULL ? simulator->zswap->hits : 0));
+}
+
+/* Bytes written counts whole pages reaching the store, the file or a private copy; queued duplicates are written once. */
+void write_writeback_stats(Simulator *simulator, Output_writer *output_file)
+{
+    output_printf(output_file, "Write Accesses = %llu\n", simulator->write_accesses);
+    output_printf(output_file, "Dirty Evictions = %llu\n", simulator->dirty_evictions);
+    output_printf(output_file, "Write-Back Batches = %llu\n", simulator->writeback_batches);
+    output_printf(output_file, "Bytes Written = %llu\n", simulator->bytes_written);
+    output_printf(output_file, "Dirty Frames at Exit = %llu%s\n", simulator->dirty_frames_at_exit, writable_store ? " (written back)" : "");
+}
+
+/*
+    The pool's cycles are the compressions of every page that left memory and the decompressions of every hit; the
+    saving is the store reads those hits avoided, so a fault whose page was already being read ahead saves nothing.
+    Hits on prefetch reads are counted but, like the reads, not charged.
+*/
+static double zswap_cycles(const Simulator *simulator)
+{
+    const Zswap_pool *pool = simulator->zswap;
+
+    return pool != NULL ? (double)(pool->compressions + pool->hits) * zswap_latency : 0.0;
+}
+
+void write_zswap_stats(Simulator *simulator, Output_writer *output_file)
+{
+    Zswap_pool *pool = simulator->zswap;
+    double saved = (double)simulator->zswap_reads_avoided * fault_latency - zswap_cycles(simulator);
+
+    output_printf(output_file, "Zswap Pool = %zu bytes, Peak Used = %zu bytes, Pages Held at Exit = %d\n", pool->capacity, pool->peak, pool->order.size);
+    output_printf(output_file, "Zswap Stored Pages = %llu\n", pool->stored_pages);
+    output_printf(output_file, "Zswap Rejected Pages = %llu\n", pool->rejected_pages);
+    output_printf(output_file, "Zswap Pool Evictions = %llu\n", pool->pool_evictions);
+    output_printf(output_file, "Zswap Compression Ratio = %.2f\n", pool->bytes_compressed ? (double)pool->bytes_stored / pool->bytes_compressed : 0.0);
+    output_printf(output_file, "Zswap Hits = %llu (%llu on page faults)\n", pool->hits, simulator->zswap_fault_hits);
+    output_printf(output_file, "Zswap Hit Rate = %.3f (of page loads)\n", pool->lookups ? (double)pool->hits / pool->lookups : 0.0);
+    output_printf(output_file, "Zswap Cycles Saved = %.0f (%.1f per access)\n", saved,
+                  simulator->total_translated_addresses ? saved / simulator->total_translated_addresses : 0.0);
+}
+
+void write_tlb_hierarchy_stats(Simulator *simulator, Output_writer *output_file)
+{
+    unsigned long long accesses = simulator->total_translated_addresses;
+    unsigned long long l1_misses = accesses - simulator->tlb_hit_counter;
+    double l1_cycles = (double)accesses * l1_tlb_latency;
+    double l2_cycles = simulator->l2_tlb.size > 0 ? (double)l1_misses * l2_tlb_latency : 0.0;
+    double walk_cycles = (double)simulator->page_walk_references * walk_latency;
+    double fault_cycles = (double)(simulator->page_fault_counter - simulator->zswap_reads_avoided) * fault_latency + zswap_cycles(simulator);
+    double memory_cycles = (double)accesses * walk_latency;
+    double per_access = accesses > 0 ? 1.0 / accesses : 0.0;
+
+    if (simulator->l2_tlb.size > 0)
+    {
+        output_printf(output_file, "L2 TLB = %d entries, %d-way, %s\n", simulator->l2_tlb.size, simulator->l2_tlb.ways, tlb_inclusion_names[tlb_inclusion]);
+        output_printf(output_file, "L2 TLB Hits = %llu\n", simulator->l2_tlb_hit_counter);
+        output_printf(output_file, "L2 TLB Hit Rate = %.3f (of L1 misses)\n", l1_misses ? (double)simulator->l2_tlb_hit_counter / l1_misses : 0.0);
+        output_printf(output_file, "Combined TLB Hit Rate = %.3f\n", (double)(simulator->tlb_hit_counter + simulator->l2_tlb_hit_counter) * per_access);
+    }
+    output_printf(output_file, "AMAT = %.1f cycles\n", (l1_cycles + l2_cycles + walk_cycles + fault_cycles + memory_cycles) * per_access);
+    output_printf(output_file, "AMAT Breakdown = L1 TLB %.1f, L2 TLB %.1f, Page Walks %.1f, Page Faults %.1f, Memory %.1f\n", l1_cycles * per_access,
+                  l2_cycles * per_access, walk_cycles * per_access, fault_cycles * per_access, memory_cycles * per_access);
+}
+
+/*
+    Reach is the address space the TLB maps: the largest it can reach, and what its valid entries mapped at the end of
+    the run, against the same TLB holding base pages only. The hit-rate delta is measured against the shadow TLB.
+*/
+void write_huge_page_stats(Simulator *simulator, Output_writer *output_file)
+{
+    Huge_pages *huge = simulator->huge_pages;
+    unsigned long long base_reach = (unsigned long long)simulator->tlb.size << geometry.offset_bits;
+    unsigned long long huge_reach = (unsigned long long)(huge_tlb_separate ? huge_tlb_size : simulator->tlb.size) << huge_page_bits;
+    unsigned long long exit_reach = tlb_reach(&simulator->tlb, huge->order) + (huge_tlb_separate ? tlb_reach(&huge->tlb, huge->order) : 0);
+    unsigned long long huge_pages_at_exit = 0;
+    double base_rate = (double)huge->base_tlb_hits / simulator->total_translated_addresses;
+
+    for (size_t i = 0; i < huge->regions.capacity; i++)
+    {
+        huge_pages_at_exit += huge->regions.keys[i] != PAGE_MAP_EMPTY && (huge->regions.values[i] & HUGE_REGION_PROMOTED) != 0;
+    }
+    if (huge_tlb_separate)
+    {
+        output_printf(output_file, "Huge Pages = %llu bytes (%d base pages), separate %d-entry TLB\n", 1ULL << huge_page_bits, 1 << huge->order, huge->tlb.size);
+        huge_reach += base_reach;
+    }
+    else
+    {
+        output_printf(output_file, "Huge Pages = %llu bytes (%d base pages), unified TLB\n", 1ULL << huge_page_bits, 1 << huge->order);
+    }
+    output_printf(output_file, "Huge Page Promotions = %llu\n", huge->promotions);
+    output_printf(output_file, "Huge Page Demotions = %llu\n", huge->demotions);
+    output_printf(output_file, "Huge Pages at Exit = %llu\n", huge_pages_at_exit);
+    output_printf(output_file, "Huge TLB Hits = %llu\n", huge->huge_tlb_hits);
+    output_printf(output_file, "TLB Reach = %llu bytes, %llu at exit (base pages only: %llu)\n", huge_reach, exit_reach, base_reach);
+    output_printf(output_file, "Base-Page TLB Hits = %llu\n", huge->base_tlb_hits);
+    output_printf(output_file, "Base-Page TLB Hit Rate = %.3f (huge pages %+.3f)\n", base_rate,
+                  (double)simulator->tlb_hit_counter / simulator->total_translated_addresses - base_rate);
+}
+
+/*
+    How much memory the resident sets actually needed. Reclaimable frames is physical memory minus the average resident
+    set: what working-set or PFF allocation at this window or threshold (and so at the fault rate reported above)
+    leaves free for other uses.
+*/
+void write_resident_stats(Simulator *simulator, Output_writer *output_file)
+{
+    double average = simulator->total_translated_addresses ? (double)simulator->resident_sum / simulator->total_translated_addresses : 0.0;
+    double reclaimable = simulator->physical_memory_frames - average;
+
+    if (simulator->frame_allocation == FRAME_ALLOCATION_WORKING_SET)
+    {
+        output_printf(output_file, "Working Set Window = %d\n", simulator->working_set_window);
+    }
+    else
+    {
+        output_printf(output_file, "PFF Threshold = %d\n", simulator->pff_threshold);
+    }
+    output_printf(output_file, "Average Resident Frames = %.1f\n", average);
+    output_printf(output_file, "Peak Resident Frames = %d\n", simulator->peak_resident_frames);
+    output_printf(output_file, "Reclaimable Frames = %.1f (%.1f%% of memory)\n", reclaimable, 100.0 * reclaimable / simulator->physical_memory_frames);
+    output_printf(output_file, "Released Frames = %llu\n", simulator->released_frames);
+    output_printf(output_file, "Replacement Evictions = %llu\n", simulator->replacement_evictions);
+}
+
+/* With --interval-output the samples went to that file, and only the thrashing count is reported here. */
+void write_interval_stats(Simulator *simulator, Output_writer *output_file, int report_processes)
+{
+    for (size_t i = 0; i < simulator->interval_count; i++)
+    {
+        const Interval_sample *sample = &simulator->intervals[i];
+
+        if (sample->asid == INTERVAL_ALL_PROCESSES)
+        {
+            output_printf(output_file, "Interval %llu: ", sample->index);
+        }
+        else if (report_processes)
+        {
+            output_printf(output_file, "Interval %llu Process %u: ", sample->index, sample->asid);
+        }
+        else
+        {
+            continue;
+        }
+        output_printf(output_file, "Accesses = %llu, Page Faults = %llu, Page Fault Rate = %.3f, TLB Hit Rate = %.3f, Resident Frames = %d, "
+                      "Evictions = %llu, Thrashing = %s\n", sample->accesses, sample->page_faults, (float)sample->page_faults / sample->accesses,
+                      (float)sample->tlb_hits / sample->accesses, sample->resident_frames, sample->evictions, sample->thrashing ? "yes" : "no");
+    }
+    output_printf(output_file, "Thrashing Intervals = %llu\n", simulator->thrashing_intervals);
+}
+
+void write_async_io_stats(Simulator *simulator, Output_writer *output_file)
+{
+    Page_reader *reader = simulator->page_reader;
+
+    output_printf(output_file, "Async I/O = %s, depth %d\n", async_io_names[reader->engine], reader->depth);
+    output_printf(output_file, "Page Reads Submitted Ahead = %llu\n", reader->submitted);
+    output_printf(output_file, "Faults Served Ahead = %llu\n", reader->used);
+    output_printf(output_file, "Page Reads Wasted = %llu\n", reader->wasted);
+    output_printf(output_file, "Synchronous Page Reads = %llu\n", reader->synchronous);
+    output_printf(output_file, "I/O Wait = %.3f seconds\n", reader->wait_seconds);
+}
+
+#ifdef VM_INSTRUMENT
+static void write_histogram(Output_writer *output_file, const char *name, const unsigned long long *buckets, const char *unit)
+{
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (buckets[bucket] > 0)
+        {
+            unsigned long long low = bucket == 0 ? 0 : 1ULL << (bucket - 1);
+            output_printf(output_file, "%s %llu-%llu %s = %llu\n", name, low, bucket == 0 ? 0 : 2 * low - 1, unit, buckets[bucket]);
+        }
+    }
+}
+
+void write_instrument_stats(Output_writer *output_file)
+{
+    double ns_per_tick = instrumentation.ns_per_tick;
+
+    output_printf(output_file, "Instrumentation Tick = %.3f ns\n", ns_per_tick);
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        unsigned long long calls = instrumentation.calls[phase];
+        double milliseconds = instrumentation.ticks[phase] * ns_per_tick / 1e6;
+        output_printf(output_file, "Time %s = %.3f ms (%llu calls, %.1f ns/call)\n", phase_names[phase], milliseconds, calls,
+                      calls > 0 ? milliseconds * 1e6 / calls : 0.0);
+    }
+    write_histogram(output_file, "Page Fault Latency", instrumentation.fault_latency, "ticks");
+    write_histogram(output_file, "TLB Probe Depth", instrumentation.probe_depth, "entries");
+    for (int i = 0; i < PERF_COUNTERS; i++)
+    {
+        if (perf_counters.values[i] >= 0)
+        {
+            output_printf(output_file, "%s = %lld\n", perf_counter_names[i], perf_counters.values[i]);
+        }
+    }
+    if (perf_counters.error != 0)
+    {
+        output_printf(output_file, "Hardware Counters = %s unavailable (%s)\n", perf_counters.opened > 0 ? "some" : "all",
+                      strerror(perf_counters.error));
+    }
+}
+#endif
+
+void write_extended_stats(Simulator *simulator, Output_writer *output_file)
+{
+    output_printf(output_file, "Page Table = %s\n", page_table_type->name);
+    output_printf(output_file, "Page Table Memory = %zu bytes\n", page_table_memory_usage(simulator));
+    output_printf(output_file, "Page Walks = %llu\n", simulator->page_walk_counter);
+    output_printf(output_file, "Page Walk Memory References = %llu\n", simulator->page_walk_references);
+    output_printf(output_file, "Page Walk Cycles = %llu\n", simulator->page_walk_references * walk_latency);
+    output_printf(output_file, "Average Page Walk Latency = %.1f cycles\n",
+                  simulator->page_walk_counter ? (double)simulator->page_walk_references * walk_latency / simulator->page_walk_counter : 0.0);
+}
+
+void write_report(Simulator *simulator, Output_writer *output_file, int report_processes)
+{
+    output_printf(output_file, "Number of Translated Addresses = %llu\n", simulator->total_translated_addresses);
+    output_printf(output_file, "Page Faults = %llu\n", simulator->page_fault_counter);
+    output_printf(output_file, "Page Fault Rate = %.3f\n", (float)simulator->page_fault_counter / simulator->total_translated_addresses);
+    output_printf(output_file, "TLB Hits = %llu\n", simulator->tlb_hit_counter);
+    output_printf(output_file, "TLB Hit Rate = %.3f\n", (float)simulator->tlb_hit_counter / simulator->total_translated_addresses);
+    if (simulator->l2_tlb.size > 0 || extended_stats)
+    {
+        write_tlb_hierarchy_stats(simulator, output_file);
+    }
+    if (simulator->frame_prefetched != NULL)
+    {
+        write_prefetch_stats(simulator, output_file);
+    }
+    if (simulator->write_accesses > 0 || writable_store)
+    {
+        write_writeback_stats(simulator, output_file);
+    }
+    if (simulator->zswap != NULL)
+    {
+        write_zswap_stats(simulator, output_file);
+    }
+    if (simulator->huge_pages != NULL)
+    {
+        write_huge_page_stats(simulator, output_file);
+    }
+    if (report_processes)
+    {
+        write_process_stats(simulator, output_file);
+    }
+    if (simulator->frame_last_use != NULL)
+    {
+        write_resident_stats(simulator, output_file);
+    }
+    if (simulator->interval_length > 0)
+    {
+        write_interval_stats(simulator, output_file, report_processes);
+    }
+    if (simulator->page_reader != NULL)
+    {
+        write_async_io_stats(simulator, output_file);
+    }
+    if (extended_stats)
+    {
+        write_extended_stats(simulator, output_file);
+    }
+#ifdef VM_INSTRUMENT
+    write_instrument_stats(output_file);
+#endif
+}
+
+/*
+    Benchmark records (--bench). Each run appends one record to the --bench file: CSV, with a header when the file is
+    new, or one JSON object per line. seconds covers decoding and simulating the trace, not loading the backing store or
+    building OPT's next-use table, and peak RSS is the process's high-water mark. The Makefile's bench target runs every
+    policy over generated traces this way, one process per run; --bench-label tags the rows, e.g. with a git revision,
+    so results of two versions can be compared.
+*/
+#define BENCH_FORMAT_CSV 0
+#define BENCH_FORMAT_JSON 1
+#define BENCH_COLUMNS 13
+
+const char *bench_format_names[] = {"csv", "json"};
+
+static void write_bench_string(FILE *file, const char *text, int format)
+{
+    fputc('"', file);
+    for (; *text != '\0'; text++)
+    {
+        if (*text == '"')
+        {
+            fputs(format == BENCH_FORMAT_JSON ? "\\\"" : "\"\"", file);
+        }
+        else if (format == BENCH_FORMAT_JSON && (*text == '\\' || (unsigned char)*text < 0x20))
+        {
+            fprintf(file, "\\u%04x", (unsigned char)*text);
+        }
+        else
+        {
+            fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
+
+int write_bench_record(Simulator *simulator, const char *path, int format, const char *label, const char *trace_path, double seconds)
+{
+    static const char *columns[BENCH_COLUMNS] = {"label", "trace", "policy", "frames", "tlb_size", "page_size", "translations", "page_faults",
+                                    "tlb_hits", "seconds", "translations_per_second", "ns_per_translation", "peak_rss_kb"};
+    const char *trace_name = strrchr(trace_path, '/') != NULL ? strrchr(trace_path, '/') + 1 : trace_path;
+    unsigned long long translations = simulator->total_translated_addresses;
+    struct rusage usage;
+    char numbers[BENCH_COLUMNS - 3][32];
+    FILE *file = fopen(path, "a");
+
+    if (file == NULL)
+    {
+        printf("Error: could not write benchmark file\n");
+        return -1;
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    snprintf(numbers[0], sizeof(numbers[0]), "%d", simulator->physical_memory_frames);
+    snprintf(numbers[1], sizeof(numbers[1]), "%d", simulator->tlb.size);
+    snprintf(numbers[2], sizeof(numbers[2]), "%zu", geometry.page_size);
+    snprintf(numbers[3], sizeof(numbers[3]), "%llu", translations);
+    snprintf(numbers[4], sizeof(numbers[4]), "%llu", simulator->page_fault_counter);
+    snprintf(numbers[5], sizeof(numbers[5]), "%llu", simulator->tlb_hit_counter);
+    snprintf(numbers[6], sizeof(numbers[6]), "%.6f", seconds);
+    snprintf(numbers[7], sizeof(numbers[7]), "%.0f", seconds > 0 ? translations / seconds : 0.0);
+    snprintf(numbers[8], sizeof(numbers[8]), "%.2f", translations > 0 ? seconds * 1e9 / translations : 0.0);
+    snprintf(numbers[9], sizeof(numbers[9]), "%ld", usage.ru_maxrss);
+
+    if (format == BENCH_FORMAT_CSV && fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0)
+    {
+        for (int i = 0; i < BENCH_COLUMNS; i++)
+        {
+            fprintf(file, i == 0 ? "%s" : ",%s", columns[i]);
+        }
+        fputc('\n', file);
+    }
+    const char *strings[] = {label, trace_name, simulator->policy->name};
+    fputs(format == BENCH_FORMAT_JSON ? "{" : "", file);
+    for (int i = 0; i < BENCH_COLUMNS; i++)
+    {
+        if (i > 0)
+        {
+            fputc(',', file);
+        }
+        if (format == BENCH_FORMAT_JSON)
+        {
+            fprintf(file, "\"%s\":", columns[i]);
+        }
+        if (i < 3)
+        {
+            write_bench_string(file, strings[i], format);
+        }
+        else
+        {
+            fputs(numbers[i - 3], file);
+        }
+    }
+    fputs(format == BENCH_FORMAT_JSON ? "}\n" : "\n", file);
+    if (fclose(file) != 0)
+    {
+        printf("Error: could not write benchmark file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Approximate simulation. --warm-up n simulates n accesses before anything is measured: they update the page tables,
+    TLB and replacement state but print no translations and are left out of the estimates. --sample adds one of two
+    sampling modes on top:
+    - shards keeps only the pages whose hash falls below rate * 2^SAMPLE_HASH_BITS (spatial sampling as in SHARDS,
+      Waldspurger et al., FAST '15), and shrinks memory and the TLB by the same rate, so the sampled pages compete for
+      proportionally as much space as the full trace would. Warm-up counts trace accesses, sampled or not;
+    - interval measures window accesses out of every window / rate, simulates the warm-up accesses just before each
+      window (window of them by default) and skips the rest without simulating them.
+    The sampled pages, or the windows, are the sampling units, so the error bounds reflect how much the units differ from
+    each other. Windows use a ratio estimator. Pages use the Horvitz-Thompson estimate of the total (the sampled count
+    divided by the rate) over the whole trace's accesses: the number of sampled accesses swings with whichever hot
+    pages happen to be sampled, and dividing by it would bias the rates (the SHARDS-adj correction addresses the same
+    thing). The usual report still covers every simulated access, warm-up included.
+*/
+#define SAMPLE_NONE 0
+#define SAMPLE_SHARDS 1
+#define SAMPLE_INTERVAL 2
+#define SAMPLE_HASH_BITS 24
+#define DEFAULT_SAMPLE_RATE 0.01
+#define DEFAULT_SAMPLE_WINDOW 10000
+#define SAMPLE_CONFIDENCE_Z 1.96 /* 95% two-sided */
+
+const char *sample_mode_names[] = {"none", "shards", "interval"};
+
+typedef struct Sample_unit
+{
+    unsigned long long accesses;
+    unsigned long long page_faults;
+    unsigned long long tlb_hits;
+} Sample_unit;
+
+typedef struct Sampler
+{
+    int mode;
+    double rate;
+    unsigned long long threshold; /* shards: pages whose hash is below it are kept */
+    unsigned long long window;
+    unsigned long long period;
+    unsigned long long warm_up;
+    unsigned long long position; /* trace accesses seen so far */
+    unsigned long long simulated;
+    Page_map unit_of_page; /* shards: page key -> its unit */
+    Sample_unit *units;
+    size_t unit_count;
+    size_t unit_capacity;
+} Sampler;
+
+int init_sampler(Sampler *sampler, int mode, double rate, unsigned long long window, unsigned long long warm_up)
+{
+    memset(sampler, 0, sizeof(Sampler));
+    sampler->mode = mode;
+    sampler->rate = rate;
+    sampler->threshold = (unsigned long long)ceil(rate * (1ULL << SAMPLE_HASH_BITS));
+    sampler->window = window;
+    sampler->period = (unsigned long long)ceil(window / rate);
+    sampler->warm_up = mode == SAMPLE_INTERVAL && warm_up > sampler->period - window ? sampler->period - window : warm_up;
+    if (mode == SAMPLE_SHARDS && page_map_init(&sampler->unit_of_page, 1024) != 0)
+    {
+        printf("Error: could not allocate sampling state\n");
+        return -1;
+    }
+    return 0;
+}
+
+void free_sampler(Sampler *sampler)
+{
+    if (sampler->mode == SAMPLE_SHARDS)
+    {
+        page_map_free(&sampler->unit_of_page);
+    }
+    free(sampler->units);
+}
+
+/* Shrinks memory and the TLB by the sampling rate for shards, keeping at least one frame and one TLB set. */
+void scale_sampled_config(Simulator_config *config, double rate)
+{
+    long frames = lround(config->frames * rate);
+
+    config->frames = frames > 0 ? (int)frames : 1;
+    if (config->tlb_ways > 0)
+    {
+        long sets = lround(config->tlb_size / config->tlb_ways * rate);
+        config->tlb_size = (sets > 0 ? (int)sets : 1) * config->tlb_ways;
+    }
+    else
+    {
+        long entries = lround(config->tlb_size * rate);
+        config->tlb_size = entries > 0 ? (int)entries : 1;
+    }
+}
+
+static inline int page_sampled(const Sampler *sampler, const Address *address)
+{
+    unsigned long long key = page_key(address->process, address->page_number);
+
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key >> (64 - SAMPLE_HASH_BITS) < sampler->threshold;
+}
+
+static Sample_unit *new_sample_unit(Sampler *sampler)
+{
+    if (sampler->unit_count == sampler->unit_capacity)
+    {
+        size_t capacity = sampler->unit_capacity > 0 ? 2 * sampler->unit_capacity : 256;
+        Sample_unit *units = realloc(sampler->units, capacity * sizeof(Sample_unit));
+        if (units == NULL)
+        {
+            printf("Error: could not allocate sampling state\n");
+            return NULL;
+        }
+        sampler->units = units;
+        sampler->unit_capacity = capacity;
+    }
+    Sample_unit *unit = &sampler->units[sampler->unit_count++];
+    memset(unit, 0, sizeof(Sample_unit));
+    return unit;
+}
+
+/* Simulates addresses[0, count) and adds what they did to unit. */
+static int measure_addresses(Simulator *simulator, Sample_unit *unit, const Address *addresses, int count, Output_writer *output_file)
+{
+    unsigned long long page_faults = simulator->page_fault_counter;
+    unsigned long long tlb_hits = simulator->tlb_hit_counter;
+
+    if (check_tlb(simulator, addresses, count, output_file) != 0)
+    {
+        return -1;
+    }
+    unit->accesses += (unsigned long long)count;
+    unit->page_faults += simulator->page_fault_counter - page_faults;
+    unit->tlb_hits += simulator->tlb_hit_counter - tlb_hits;
+    return 0;
+}
+
+static int sample_shards(Simulator *simulator, Sampler *sampler, const Address *addresses, int count, Output_writer *output_file)
+{
+    for (int i = 0; i < count; i++)
+    {
+        sampler->position++;
+        if (!page_sampled(sampler, &addresses[i]))
+        {
+            continue;
+        }
+        sampler->simulated++;
+        if (sampler->position <= sampler->warm_up)
+        {
+            if (check_tlb(simulator, &addresses[i], 1, NULL) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        unsigned long long key = page_key(addresses[i].process, addresses[i].page_number);
+        long long index = page_map_get(&sampler->unit_of_page, key);
+        if (index < 0)
+        {
+            if (new_sample_unit(sampler) == NULL)
+            {
+                return -1;
+            }
+            index = (long long)sampler->unit_count - 1;
+            page_map_put(&sampler->unit_of_page, key, index);
+        }
+        if (measure_addresses(simulator, &sampler->units[index], &addresses[i], 1, output_file) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int sample_interval(Simulator *simulator, Sampler *sampler, const Address *addresses, int count, Output_writer *output_file)
+{
+    unsigned long long measure_start = sampler->period - sampler->window;
+    unsigned long long warm_start = measure_start - sampler->warm_up;
+    int i = 0;
+
+    while (i < count)
+    {
+        unsigned long long phase = sampler->position % sampler->period;
+        unsigned long long end = phase < warm_start ? warm_start : phase < measure_start ? measure_start : sampler->period;
+        int run = end - phase < (unsigned long long)(count - i) ? (int)(end - phase) : count - i;
+
+        if (phase >= measure_start)
+        {
+            if ((phase == measure_start && new_sample_unit(sampler) == NULL) ||
+                measure_addresses(simulator, &sampler->units[sampler->unit_count - 1], &addresses[i], run, output_file) != 0)
+            {
+                return -1;
+            }
+            sampler->simulated += (unsigned long long)run;
+        }
+        else if (phase >= warm_start)
+        {
+            if (check_tlb(simulator, &addresses[i], run, NULL) != 0)
+            {
+                return -1;
+            }
+            sampler->simulated += (unsigned long long)run;
+        }
+        sampler->position += (unsigned long long)run;
+        i += run;
+    }
+    return 0;
+}
+
+/* Runs one chunk of the trace through the sampler: warm-up, skipped, sampled or measured, depending on the mode. */
+int sample_chunk(Simulator *simulator, Sampler *sampler, const Address *addresses, int count, Output_writer *output_file)
+{
+    if (sampler->mode == SAMPLE_SHARDS)
+    {
+        return sample_shards(simulator, sampler, addresses, count, output_file);
+    }
+    if (sampler->mode == SAMPLE_INTERVAL)
+    {
+        return sample_interval(simulator, sampler, addresses, count, output_file);
+    }
+
+    int warm = 0;
+    if (sampler->position < sampler->warm_up)
+    {
+        warm = sampler->warm_up - sampler->position < (unsigned long long)count ? (int)(sampler->warm_up - sampler->position) : count;
+    }
+    if (warm > 0 && check_tlb(simulator, addresses, warm, NULL) != 0)
+    {
+        return -1;
+    }
+    if (warm < count && sampler->unit_count == 0 && new_sample_unit(sampler) == NULL)
+    {
+        return -1;
+    }
+    if (warm < count && measure_addresses(simulator, &sampler->units[0], addresses + warm, count - warm, output_file) != 0)
+    {
+        return -1;
+    }
+    sampler->position += (unsigned long long)count;
+    sampler->simulated += (unsigned long long)count;
+    return 0;
+}
+
+static inline double unit_count(const Sample_unit *unit, int tlb_hits)
+{
+    return (double)(tlb_hits ? unit->tlb_hits : unit->page_faults);
+}
+
+/*
+    Ratio estimate sum(y) / sum(x) over the units, with the half-width of its confidence interval from the usual
+    linearised variance, (1 - rate) n / (n - 1) sum((y - r x)^2) / sum(x)^2. With fewer than two units there is no
+    bound (-1).
+*/
+static double ratio_estimate(const Sampler *sampler, int tlb_hits, double *half_width)
+{
+    double total_x = 0, total_y = 0, squares = 0;
+    size_t n = sampler->unit_count;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        total_x += (double)sampler->units[i].accesses;
+        total_y += unit_count(&sampler->units[i], tlb_hits);
+    }
+    double ratio = total_x > 0 ? total_y / total_x : 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        double residual = unit_count(&sampler->units[i], tlb_hits) - ratio * (double)sampler->units[i].accesses;
+        squares += residual * residual;
+    }
+    *half_width = n > 1 && total_x > 0 ? SAMPLE_CONFIDENCE_Z * sqrt((1 - sampler->rate) * (double)n / (double)(n - 1) * squares) / total_x : -1;
+    return ratio;
+}
+
+/*
+    Shards: each page is in the sample with probability rate, so sum(y) / rate estimates the trace's total, with
+    variance (1 - rate) / rate^2 sum(y^2). TLB hits are estimated through the misses, which the sample scales the same
+    way. The rate is taken over the measured part of the whole trace.
+*/
+static double horvitz_thompson_estimate(const Sampler *sampler, int tlb_hits, double *half_width)
+{
+    double total = 0, squares = 0;
+    double accesses = (double)(sampler->position > sampler->warm_up ? sampler->position - sampler->warm_up : 0);
+
+    for (size_t i = 0; i < sampler->unit_count; i++)
+    {
+        const Sample_unit *unit = &sampler->units[i];
+        double y = tlb_hits ? (double)(unit->accesses - unit->tlb_hits) : (double)unit->page_faults;
+        total += y;
+        squares += y * y;
+    }
+    if (accesses == 0)
+    {
+        *half_width = -1;
+        return 0;
+    }
+    *half_width = SAMPLE_CONFIDENCE_Z * sqrt((1 - sampler->rate) * squares) / sampler->rate / accesses;
+    double rate = total / sampler->rate / accesses;
+    rate = rate < 1 ? rate : 1; /* a few heavy pages in a small sample can push the total past the trace */
+    return tlb_hits ? 1 - rate : rate;
+}
+
+void write_sample_stats(const Sampler *sampler, const Simulator_config *config, Output_writer *output_file)
+{
+    unsigned long long measured = 0;
+    double fault_bound, hit_bound;
+
+    for (size_t i = 0; i < sampler->unit_count; i++)
+    {
+        measured += sampler->units[i].accesses;
+    }
+    double (*estimate)(const Sampler *, int, double *) = sampler->mode == SAMPLE_SHARDS ? horvitz_thompson_estimate : ratio_estimate;
+    double fault_rate = estimate(sampler, 0, &fault_bound);
+    double hit_rate = estimate(sampler, 1, &hit_bound);
+
+    output_printf(output_file, "Sampling = %s", sample_mode_names[sampler->mode]);
+    if (sampler->mode != SAMPLE_NONE)
+    {
+        output_printf(output_file, ", rate %.4f", sampler->rate);
+    }
+    output_printf(output_file, " (%llu of %llu accesses simulated, %llu measured)\n", sampler->simulated, sampler->position, measured);
+    if (sampler->mode == SAMPLE_SHARDS)
+    {
+        output_printf(output_file, "Sampled Pages = %zu, Scaled Frames = %d, Scaled TLB Entries = %d\n", sampler->unit_count, config->frames, config->tlb_size);
+    }
+    else if (sampler->mode == SAMPLE_INTERVAL)
+    {
+        output_printf(output_file, "Windows = %zu of %llu accesses every %llu, %llu warm-up accesses before each\n", sampler->unit_count,
+                      sampler->window, sampler->period, sampler->warm_up);
+    }
+    if (fault_bound < 0)
+    {
+        output_printf(output_file, "Estimated Page Fault Rate = %.4f\n", fault_rate);
+        output_printf(output_file, "Estimated TLB Hit Rate = %.4f\n", hit_rate);
+    }
+    else
+    {
+        output_printf(output_file, "Estimated Page Fault Rate = %.4f +- %.4f (95%% confidence)\n", fault_rate, fault_bound);
+        output_printf(output_file, "Estimated TLB Hit Rate = %.4f +- %.4f (95%% confidence)\n", hit_rate, hit_bound);
+    }
+    output_printf(output_file, "Estimated Page Faults = %.0f (over all %llu accesses)\n", fault_rate * (double)sampler->position, sampler->position);
+}
+
+/*
+    Sweep mode runs every combination of the listed policies, frame counts and TLB sizes over one trace. The trace is
+    decoded once into a read-only array shared by all runs (as is OPT's next-use table), and the configurations are
+    handed out to a pool of threads; each builds, runs and frees its own Simulator, so the workers share nothing
+    writable. The results come out as one table in configuration order.
+*/
+#define MAX_SWEEP_VALUES 64
+
+typedef struct Sweep_job
+{
+    Simulator_config config;
+    int status;
+    double seconds;
+    unsigned long long total_translated_addresses;
+    unsigned long long page_fault_counter;
+    unsigned long long tlb_hit_counter;
+    unsigned long long page_walk_references;
+} Sweep_job;
+
+typedef struct Sweep
+{
+    const Address *addresses;
+    size_t count;
+    const unsigned long long *next_use;
+    Sweep_job *jobs;
+    int job_count;
+    int next_job;
+} Sweep;
+
+/* Reads and decodes the whole trace into one array; returns NULL on error. */
+Address *load_trace(Trace_reader *trace, unsigned int process_limit, size_t *count)
+{
+    size_t capacity = ADDRESS_CHUNK_SIZE;
+    Address *addresses = malloc(capacity * sizeof(Address));
+    int read;
+
+    *count = 0;
+    if (addresses == NULL)
+    {
+        printf("Error: could not allocate address buffer\n");
+        return NULL;
+    }
+    while ((read = extract_page_number_and_offset(trace, process_limit, addresses + *count, ADDRESS_CHUNK_SIZE)) > 0)
+    {
+        *count += read;
+        if (*count + ADDRESS_CHUNK_SIZE > capacity)
+        {
+            capacity *= 2;
+            Address *grown = realloc(addresses, capacity * sizeof(Address));
+            if (grown == NULL)
+            {
+                printf("Error: could not allocate address buffer\n");
+                free(addresses);
+                return NULL;
+            }
+            addresses = grown;
+        }
+    }
+    if (trace->error)
+    {
+        free(addresses);
+        return NULL;
+    }
+    return addresses;
+}
+
+static void run_sweep_job(Sweep *sweep, Sweep_job *job)
+{
+    Simulator *simulator = malloc(sizeof(Simulator));
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->status = -1;
+    if (simulator == NULL)
+    {
+        printf("Error: could not allocate simulator\n");
+        return;
+    }
+    if (init_simulator(simulator, &job->config) == 0)
+    {
+        simulator->next_use = sweep->next_use;
+        job->status = 0;
+        for (size_t position = 0; position < sweep->count && job->status == 0; position += ADDRESS_CHUNK_SIZE)
+        {
+            size_t remaining = sweep->count - position;
+            int count = remaining < ADDRESS_CHUNK_SIZE ? (int)remaining : ADDRESS_CHUNK_SIZE;
+            job->status = check_tlb(simulator, sweep->addresses + position, count, NULL);
+        }
+        job->total_translated_addresses = simulator->total_translated_addresses;
+        job->page_fault_counter = simulator->page_fault_counter;
+        job->tlb_hit_counter = simulator->tlb_hit_counter;
+        job->page_walk_references = simulator->page_walk_references;
+    }
+    free_simulator(simulator);
+    free(simulator);
+    job->seconds = seconds_since(&start);
+}
+
+static void *sweep_worker(void *argument)
+{
+    Sweep *sweep = argument;
+    int index;
+
+    while ((index = __atomic_fetch_add(&sweep->next_job, 1, __ATOMIC_RELAXED)) < sweep->job_count)
+    {
+        run_sweep_job(sweep, &sweep->jobs[index]);
+    }
+    return NULL;
+}
+
+int run_sweep(Trace_reader *trace, unsigned int process_limit, Sweep_job *jobs, int job_count, int threads, Output_writer *output_file)
+{
+    Sweep sweep = {NULL, 0, NULL, jobs, job_count, 0};
+    unsigned long long *next_use = NULL;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    struct timespec start;
+    int started = 0;
+    int status = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Address *addresses = load_trace(trace, process_limit, &sweep.count);
+    if (addresses == NULL || workers == NULL)
+    {
+        free(addresses);
+        free(workers);
+        return -1;
+    }
+    sweep.addresses = addresses;
+
+    for (int i = 0; i < job_count && next_use == NULL; i++)
+    {
+        if (jobs[i].config.policy->needs_next_use)
+        {
+            unsigned long long *keys = malloc((sweep.count > 0 ? sweep.count : 1) * sizeof(unsigned long long));
+            if (keys == NULL)
+            {
+                printf("Error: could not allocate next-use table\n");
+                free(addresses);
+                free(workers);
+                return -1;
+            }
+            for (size_t index = 0; index < sweep.count; index++)
+            {
+                keys[index] = page_key(addresses[index].process, addresses[index].page_number);
+            }
+            next_use = build_next_use(keys, sweep.count);
+            free(keys);
+            if (next_use == NULL)
+            {
+                free(addresses);
+                free(workers);
+                return -1;
+            }
+            sweep.next_use = next_use;
+        }
+    }
+
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&workers[started], NULL, sweep_worker, &sweep) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        sweep_worker(&sweep);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    output_printf(output_file, "%-8s %8s %6s %12s %12s %10s %12s %12s %14s %9s\n", "Policy", "Frames", "TLB", "Translated",
+                  "Page Faults", "Fault Rate", "TLB Hits", "TLB Hit Rate", "Walk Cycles", "Seconds");
+    for (int i = 0; i < job_count; i++)
+    {
+        Sweep_job *job = &jobs[i];
+        if (job->status != 0)
+        {
+            output_printf(output_file, "%-8s %8d %6d %12s\n", job->config.policy->name, job->config.frames, job->config.tlb_size, "failed");
+            status = -1;
+            continue;
+        }
+        output_printf(output_file, "%-8s %8d %6d %12llu %12llu %10.3f %12llu %12.3f %14llu %9.3f\n", job->config.policy->name,
+                      job->config.frames, job->config.tlb_size, job->total_translated_addresses, job->page_fault_counter,
+                      (float)job->page_fault_counter / job->total_translated_addresses, job->tlb_hit_counter,
+                      (float)job->tlb_hit_counter / job->total_translated_addresses, job->page_walk_references * walk_latency,
+                      job->seconds);
+    }
+    output_printf(output_file, "Sweep: %d configurations, %zu addresses, %d threads, %.3f seconds\n", job_count, sweep.count,
+                  started > 0 ? started : 1, seconds_since(&start));
+
+    free(next_use);
+    free(addresses);
+    free(workers);
+    return status;
+}
+
+/*
+    Concurrent engine (--cpus): several simulated CPUs translate at once, each on its own host thread with a private
+    TLB, sharing one page table, one frame pool and one CLOCK. The trace is decoded once and dealt out in blocks of
+    SMP_BLOCK_SIZE accesses to whichever CPU asks next, so the CPUs run as threads of the trace's address spaces.
+
+    The page table is a hash on the page key split into SMP_SHARDS shards, each with its own lock and map, so a TLB
+    miss only locks the shard of its page. Every frame has an atomic pin count: an access pins its frame and checks that
+    the frame still holds its page, and the replacement claims a victim by swinging the count from 0 to -1, so a frame
+    is never reused under a running access. The CLOCK hand is a shared counter and the reference bits are atomic bytes.
+    A fault holds the shard of its page while it sweeps, so it only try-locks the victim's shard, and passes over the
+    frame if that shard is busy.
+
+    Each frame records which CPUs' TLBs may cache it. Evicting it invalidates the evicting CPU's own entry and sends
+    every other such CPU a shootdown: the key goes into that CPU's mailbox, which it drains before its next
+    translation, and the IPI is charged --ipi-latency cycles at both ends. A mailbox that overflows makes its CPU flush
+    the whole TLB. An entry used before its shootdown is drained fails the pin check and counts as a stale hit that
+    walks the page table, as it would have after an acknowledged shootdown.
+
+    With one CPU the counters match the main engine's clock. With several they depend on the interleaving, while the
+    checksum of the values read does not, unless the trace writes.
+*/
+#define MAX_CPUS 64
+#define DEFAULT_IPI_LATENCY 2000
+#define SMP_SHARD_BITS 8
+#define SMP_SHARDS (1 << SMP_SHARD_BITS)
+#define SMP_BLOCK_SIZE 4096
+#define SHOOTDOWN_QUEUE 64
+
+int ipi_latency = DEFAULT_IPI_LATENCY;
+
+typedef struct Smp Smp;
+
+typedef struct Smp_shard
+{
+    pthread_mutex_t lock;
+    Page_map pages;  /* key -> frame of each resident page */
+    Page_map copies; /* key -> index in saved of each page written back */
+    char **saved;
+    size_t saved_count;
+} __attribute__((aligned(64))) Smp_shard;
+
+typedef struct Smp_cpu
+{
+    Smp *smp;
+    int id;
+    int status;
+    Tlb tlb;
+    unsigned int current_process;
+    pthread_mutex_t mailbox_lock;
+    unsigned long long mailbox[SHOOTDOWN_QUEUE];
+    int mailbox_count; /* read without the lock to pass over an empty mailbox */
+    int mailbox_overflow;
+    unsigned long long translated_addresses;
+    unsigned long long tlb_hits;
+    unsigned long long stale_hits;
+    unsigned long long page_walks;
+    unsigned long long page_faults;
+    unsigned long long evictions;
+    unsigned long long busy_victims;
+    unsigned long long shootdowns;
+    unsigned long long ipis_sent;
+    unsigned long long ipis_received; /* counted by the senders, under mailbox_lock */
+    unsigned long long tlb_flushes;
+    long long value_sum;
+    double seconds;
+} __attribute__((aligned(64))) Smp_cpu;
+
+typedef struct Smp
+{
+    const Address *addresses;
+    size_t count;
+    size_t next_block;
+    int error;
+    int cpu_count;
+    int frames;
+    int tlb_flush_on_switch;
+    char *memory;
+    unsigned long long *frame_page;
+    int *frame_pins; /* accesses using the frame, or -1 while it is unused or being replaced */
+    unsigned char *referenced;
+    unsigned char *dirty;
+    unsigned long long *tlb_holders; /* bit c set: CPU c's TLB may cache the frame */
+    unsigned long long hand;
+    int next_unused_frame;
+    Smp_shard *shards;
+    Smp_cpu *cpus;
+} Smp;
+
+static inline Smp_shard *smp_shard(Smp *smp, unsigned long long key)
+{
+    return &smp->shards[(key * 0x9E3779B97F4A7C15ULL) >> (64 - SMP_SHARD_BITS)];
+}
+
+static inline void smp_unpin_frame(Smp *smp, int frame)
+{
+    __atomic_fetch_sub(&smp->frame_pins[frame], 1, __ATOMIC_RELEASE);
+}
+
+/* Pins frame for an access unless it is being replaced or no longer holds the page with key. */
+static int smp_pin_frame(Smp *smp, int frame, unsigned long long key)
+{
+    int pins = __atomic_load_n(&smp->frame_pins[frame], __ATOMIC_RELAXED);
+
+    do
+    {
+        if (pins < 0)
+        {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&smp->frame_pins[frame], &pins, pins + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    if (smp->frame_page[frame] != key)
+    {
+        smp_unpin_frame(smp, frame);
+        return 0;
+    }
+    return 1;
+}
+
+static void smp_post_shootdown(Smp_cpu *cpu, unsigned long long key)
+{
+    pthread_mutex_lock(&cpu->mailbox_lock);
+    if (cpu->mailbox_count < SHOOTDOWN_QUEUE)
+    {
+        cpu->mailbox[cpu->mailbox_count] = key;
+        __atomic_store_n(&cpu->mailbox_count, cpu->mailbox_count + 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        cpu->mailbox_overflow = 1;
+    }
+    cpu->ipis_received++;
+    pthread_mutex_unlock(&cpu->mailbox_lock);
+}
+
+static void smp_drain_mailbox(Smp_cpu *cpu)
+{
+    if (__atomic_load_n(&cpu->mailbox_count, __ATOMIC_ACQUIRE) == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&cpu->mailbox_lock);
+    if (cpu->mailbox_overflow)
+    {
+        flush_tlb(&cpu->tlb);
+        cpu->tlb_flushes++;
+        cpu->mailbox_overflow = 0;
+    }
+    else
+    {
+        for (int i = 0; i < cpu->mailbox_count; i++)
+        {
+            invalidate_tlb_entry(&cpu->tlb, cpu->mailbox[i]);
+        }
+    }
+    __atomic_store_n(&cpu->mailbox_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cpu->mailbox_lock);
+}
+
+/* Drops the translations of the page with key that was in frame from every TLB that may cache it. */
+static void smp_shoot_down(Smp_cpu *cpu, int frame, unsigned long long key)
+{
+    Smp *smp = cpu->smp;
+    unsigned long long self = 1ULL << cpu->id;
+    unsigned long long holders = __atomic_exchange_n(&smp->tlb_holders[frame], 0, __ATOMIC_RELAXED);
+
+    if (holders & self)
+    {
+        invalidate_tlb_entry(&cpu->tlb, key);
+    }
+    holders &= ~self;
+    if (holders != 0)
+    {
+        cpu->shootdowns++;
+    }
+    for (int target = 0; holders != 0; target++, holders >>= 1)
+    {
+        if (holders & 1)
+        {
+            smp_post_shootdown(&smp->cpus[target], key);
+            cpu->ipis_sent++;
+        }
+    }
+}
+
+static int smp_save_page(Smp_shard *shard, unsigned long long key, const char *data)
+{
+    long long index = page_map_get(&shard->copies, key);
+
+    if (index < 0)
+    {
+        char **grown = realloc(shard->saved, (shard->saved_count + 1) * sizeof(char *));
+        if (grown != NULL)
+        {
+            shard->saved = grown;
+        }
+        if (grown == NULL || (grown[shard->saved_count] = malloc(geometry.page_size)) == NULL)
+        {
+            printf("Error: could not allocate a page copy\n");
+            return -1;
+        }
+        index = (long long)shard->saved_count++;
+        page_map_put(&shard->copies, key, index);
+    }
+    memcpy(shard->saved[index], data, geometry.page_size);
+    return 0;
+}
+
+/*
+    Sweeps the CLOCK hand to an unreferenced frame it can claim and evicts its page; held is the shard the caller has
+    locked. Returns the claimed frame, or -1 if its dirty page could not be saved.
+*/
+static int smp_claim_victim(Smp_cpu *cpu, Smp_shard *held)
+{
+    Smp *smp = cpu->smp;
+
+    for (;;)
+    {
+        int frame = (int)(__atomic_fetch_add(&smp->hand, 1, __ATOMIC_RELAXED) % smp->frames);
+        int unpinned = 0;
+
+        if (__atomic_load_n(&smp->referenced[frame], __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&smp->referenced[frame], 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!__atomic_compare_exchange_n(&smp->frame_pins[frame], &unpinned, -1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        unsigned long long victim_key = smp->frame_page[frame];
+        Smp_shard *shard = smp_shard(smp, victim_key);
+        if (shard != held && pthread_mutex_trylock(&shard->lock) != 0)
+        {
+            __atomic_store_n(&smp->frame_pins[frame], 0, __ATOMIC_RELEASE);
+            cpu->busy_victims++;
+            continue;
+        }
+        page_map_remove(&shard->pages, victim_key);
+        int status = 0;
+        if (__atomic_load_n(&smp->dirty[frame], __ATOMIC_RELAXED))
+        {
+            status = smp_save_page(shard, victim_key, smp->memory + (size_t)frame * geometry.page_size);
+        }
+        if (shard != held)
+        {
+            pthread_mutex_unlock(&shard->lock);
+        }
+        cpu->evictions++;
+        smp_shoot_down(cpu, frame, victim_key);
+        return status == 0 ? frame : -1;
+    }
+}
+
+/* Loads the page with key, whose shard the caller holds, into a free or replaced frame and returns it pinned. */
+static int smp_fault(Smp_cpu *cpu, Smp_shard *shard, unsigned long long key)
+{
+    Smp *smp = cpu->smp;
+    int frame = __atomic_load_n(&smp->next_unused_frame, __ATOMIC_RELAXED);
+
+    while (frame < smp->frames &&
+           !__atomic_compare_exchange_n(&smp->next_unused_frame, &frame, frame + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    if (frame >= smp->frames && (frame = smp_claim_victim(cpu, shard)) < 0)
+    {
+        return -1;
+    }
+
+    char *data = smp->memory + (size_t)frame * geometry.page_size;
+    long long copy = page_map_get(&shard->copies, key);
+    if (copy >= 0)
+    {
+        memcpy(data, shard->saved[copy], geometry.page_size);
+    }
+    else
+    {
+        read_page_from_backing_store(key & geometry.page_mask, data);
+    }
+    smp->frame_page[frame] = key;
+    __atomic_store_n(&smp->dirty[frame], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&smp->referenced[frame], 1, __ATOMIC_RELAXED);
+    page_map_put(&shard->pages, key, frame);
+    __atomic_store_n(&smp->frame_pins[frame], 1, __ATOMIC_RELEASE);
+    return frame;
+}
+
+/* Finds the page with key in the shared page table, faulting it in if it is not resident, and returns its frame pinned. */
+static int smp_walk(Smp_cpu *cpu, unsigned long long key)
+{
+    Smp *smp = cpu->smp;
+    Smp_shard *shard = smp_shard(smp, key);
+
+    cpu->page_walks++;
+    for (;;)
+    {
+        pthread_mutex_lock(&shard->lock);
+        long long frame = page_map_get(&shard->pages, key);
+        if (frame < 0)
+        {
+            cpu->page_faults++;
+            int loaded = smp_fault(cpu, shard, key);
+            pthread_mutex_unlock(&shard->lock);
+            return loaded;
+        }
+        int pinned = smp_pin_frame(smp, (int)frame, key);
+        pthread_mutex_unlock(&shard->lock);
+        if (pinned)
+        {
+            return (int)frame;
+        }
+        /* A replacement has claimed the frame and backs off once it finds this shard locked. */
+    }
+}
+
+static int smp_translate(Smp_cpu *cpu, const Address *address)
+{
+    Smp *smp = cpu->smp;
+    unsigned long long key = page_key(address->process, address->page_number);
+    int frame = -1;
+
+    smp_drain_mailbox(cpu);
+    if (smp->tlb_flush_on_switch && address->process != cpu->current_process)
+    {
+        flush_tlb(&cpu->tlb);
+    }
+    cpu->current_process = address->process;
+    cpu->translated_addresses++;
+
+    int hit = tlb_lookup(&cpu->tlb, key, &frame) >= 0;
+    if (hit && !smp_pin_frame(smp, frame, key))
+    {
+        cpu->stale_hits++;
+        invalidate_tlb_entry(&cpu->tlb, key);
+        hit = 0;
+    }
+    if (hit)
+    {
+        cpu->tlb_hits++;
+    }
+    else
+    {
+        if ((frame = smp_walk(cpu, key)) < 0)
+        {
+            return -1;
+        }
+        update_tlb(&cpu->tlb, key, frame, tlb_select_entry(&cpu->tlb, key));
+        if (!(__atomic_load_n(&smp->tlb_holders[frame], __ATOMIC_RELAXED) & (1ULL << cpu->id)))
+        {
+            __atomic_fetch_or(&smp->tlb_holders[frame], 1ULL << cpu->id, __ATOMIC_RELAXED);
+        }
+    }
+
+    char *byte = smp->memory + (size_t)frame * geometry.page_size + address->offset;
+    if (address->write)
+    {
+        cpu->value_sum += (signed char)__atomic_add_fetch(byte, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&smp->dirty[frame], 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        cpu->value_sum += (signed char)__atomic_load_n(byte, __ATOMIC_RELAXED);
+    }
+    if (!__atomic_load_n(&smp->referenced[frame], __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&smp->referenced[frame], 1, __ATOMIC_RELAXED);
+    }
+    smp_unpin_frame(smp, frame);
+    return 0;
+}
+
+static void *smp_cpu_thread(void *argument)
+{
+    Smp_cpu *cpu = argument;
+    Smp *smp = cpu->smp;
+    struct timespec start;
+    size_t first;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!__atomic_load_n(&smp->error, __ATOMIC_RELAXED) &&
+           (first = __atomic_fetch_add(&smp->next_block, SMP_BLOCK_SIZE, __ATOMIC_RELAXED)) < smp->count)
+    {
+        size_t last = smp->count - first < SMP_BLOCK_SIZE ? smp->count : first + SMP_BLOCK_SIZE;
+        for (size_t i = first; i < last; i++)
+        {
+            if (smp_translate(cpu, &smp->addresses[i]) != 0)
+            {
+                cpu->status = -1;
+                __atomic_store_n(&smp->error, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+    cpu->seconds = seconds_since(&start);
+    return NULL;
+}
+
+static void free_smp(Smp *smp)
+{
+    if (smp->shards != NULL)
+    {
+        for (int i = 0; i < SMP_SHARDS; i++)
+        {
+            Smp_shard *shard = &smp->shards[i];
+            for (size_t page = 0; page < shard->saved_count; page++)
+            {
+                free(shard->saved[page]);
+            }
+            free(shard->saved);
+            page_map_free(&shard->pages);
+            page_map_free(&shard->copies);
+            pthread_mutex_destroy(&shard->lock);
+        }
+    }
+    if (smp->cpus != NULL)
+    {
+        for (int i = 0; i < smp->cpu_count; i++)
+        {
+            free_tlb(&smp->cpus[i].tlb);
+            pthread_mutex_destroy(&smp->cpus[i].mailbox_lock);
+        }
+    }
+    free(smp->shards);
+    free(smp->cpus);
+    free(smp->memory);
+    free(smp->frame_page);
+    free(smp->frame_pins);
+    free(smp->referenced);
+    free(smp->dirty);
+    free(smp->tlb_holders);
+}
+
+static int init_smp(Smp *smp, const Simulator_config *config, int cpu_count)
+{
+    memset(smp, 0, sizeof(Smp));
+    smp->cpu_count = cpu_count;
+    smp->frames = config->frames;
+    smp->tlb_flush_on_switch = config->tlb_flush_on_switch;
+    smp->memory = malloc((size_t)config->frames * geometry.page_size);
+    smp->frame_page = malloc(config->frames * sizeof(unsigned long long));
+    smp->frame_pins = malloc(config->frames * sizeof(int));
+    smp->referenced = calloc(config->frames, 1);
+    smp->dirty = calloc(config->frames, 1);
+    smp->tlb_holders = calloc(config->frames, sizeof(unsigned long long));
+    smp->shards = aligned_alloc(64, SMP_SHARDS * sizeof(Smp_shard));
+    smp->cpus = aligned_alloc(64, cpu_count * sizeof(Smp_cpu));
+    if (smp->memory == NULL || smp->frame_page == NULL || smp->frame_pins == NULL || smp->referenced == NULL ||
+        smp->dirty == NULL || smp->tlb_holders == NULL || smp->shards == NULL || smp->cpus == NULL)
+    {
+        printf("Error: could not allocate the concurrent engine\n");
+        free(smp->shards);
+        free(smp->cpus);
+        smp->shards = NULL;
+        smp->cpus = NULL;
+        return -1;
+    }
+    for (int i = 0; i < config->frames; i++)
+    {
+        smp->frame_page[i] = NO_PAGE;
+        smp->frame_pins[i] = -1;
+    }
+
+    int status = 0;
+    memset(smp->shards, 0, SMP_SHARDS * sizeof(Smp_shard));
+    for (int i = 0; i < SMP_SHARDS; i++)
+    {
+        pthread_mutex_init(&smp->shards[i].lock, NULL);
+        if (page_map_init(&smp->shards[i].pages, config->frames / SMP_SHARDS + 1) != 0 || page_map_init(&smp->shards[i].copies, 1) != 0)
+        {
+            printf("Error: could not allocate the concurrent engine\n");
+            status = -1;
+        }
+    }
+    memset(smp->cpus, 0, cpu_count * sizeof(Smp_cpu));
+    for (int i = 0; i < cpu_count; i++)
+    {
+        Smp_cpu *cpu = &smp->cpus[i];
+        cpu->smp = smp;
+        cpu->id = i;
+        pthread_mutex_init(&cpu->mailbox_lock, NULL);
+        if (status == 0 && init_tlb(&cpu->tlb, config->tlb_size, config->tlb_ways, config->tlb_replacement, config->tlb_probe_name) != 0)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/* Cycles of one CPU: its lookups, memory references, walks, faults and the IPIs it sent or took. */
+static unsigned long long smp_cpu_cycles(const Smp_cpu *cpu)
+{
+    return cpu->translated_addresses * (l1_tlb_latency + walk_latency) + cpu->page_walks * walk_latency +
+           cpu->page_faults * fault_latency + (cpu->ipis_sent + cpu->ipis_received) * ipi_latency;
+}
+
+int run_smp(Trace_reader *trace, unsigned int process_limit, const Simulator_config *config, int cpu_count, Output_writer *output_file)
+{
+    Smp smp;
+    pthread_t *threads = malloc(cpu_count * sizeof(pthread_t));
+    struct timespec start;
+    int started = 0;
+    int status = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Address *addresses = load_trace(trace, process_limit, &smp.count);
+    size_t count = smp.count;
+    if (addresses == NULL || threads == NULL)
+    {
+        free(addresses);
+        free(threads);
+        return -1;
+    }
+    if (init_smp(&smp, config, cpu_count) != 0)
+    {
+        free_smp(&smp);
+        free(addresses);
+        free(threads);
+        return -1;
+    }
+    smp.addresses = addresses;
+    smp.count = count;
+
+    double load_seconds = seconds_since(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (; started < cpu_count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, smp_cpu_thread, &smp.cpus[started]) != 0)
+        {
+            printf("Error: could not start the thread of CPU %d\n", started);
+            __atomic_store_n(&smp.error, 1, __ATOMIC_RELAXED);
+            status = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double run_seconds = seconds_since(&start);
+
+    unsigned long long tlb_hits = 0;
+    unsigned long long page_faults = 0;
+    unsigned long long shootdowns = 0;
+    unsigned long long ipis = 0;
+    unsigned long long slowest = 0;
+    long long checksum = 0;
+    for (int i = 0; i < cpu_count; i++)
+    {
+        Smp_cpu *cpu = &smp.cpus[i];
+        status = cpu->status != 0 ? -1 : status;
+        tlb_hits += cpu->tlb_hits;
+        page_faults += cpu->page_faults;
+        shootdowns += cpu->shootdowns;
+        ipis += cpu->ipis_sent;
+        checksum += cpu->value_sum;
+        slowest = smp_cpu_cycles(cpu) > slowest ? smp_cpu_cycles(cpu) : slowest;
+    }
+
+    if (status == 0)
+    {
+        output_printf(output_file, "Number of Translated Addresses = %llu\n", (unsigned long long)count);
+        output_printf(output_file, "Page Faults = %llu\n", page_faults);
+        output_printf(output_file, "Page Fault Rate = %.3f\n", (float)page_faults / count);
+        output_printf(output_file, "TLB Hits = %llu\n", tlb_hits);
+        output_printf(output_file, "TLB Hit Rate = %.3f\n", (float)tlb_hits / count);
+        for (int i = 0; i < cpu_count; i++)
+        {
+            Smp_cpu *cpu = &smp.cpus[i];
+            output_printf(output_file, "CPU %d: Translated Addresses = %llu, Page Faults = %llu, TLB Hits = %llu, TLB Hit Rate = %.3f, Stale TLB Hits = %llu\n",
+                          i, cpu->translated_addresses, cpu->page_faults, cpu->tlb_hits,
+                          cpu->translated_addresses > 0 ? (float)cpu->tlb_hits / cpu->translated_addresses : 0.0f, cpu->stale_hits);
+            output_printf(output_file,
+                          "CPU %d: Evictions = %llu, Busy Victims = %llu, Shootdowns = %llu, IPIs Sent = %llu, IPIs Received = %llu, TLB Flushes = %llu\n",
+                          i, cpu->evictions, cpu->busy_victims, cpu->shootdowns, cpu->ipis_sent, cpu->ipis_received, cpu->tlb_flushes);
+            output_printf(output_file, "CPU %d: Cycles = %llu, Seconds = %.3f\n", i, smp_cpu_cycles(cpu), cpu->seconds);
+        }
+        output_printf(output_file, "TLB Shootdowns = %llu, IPIs = %llu, IPI Cycles = %llu\n", shootdowns, ipis, 2 * ipis * ipi_latency);
+        output_printf(output_file, "Simulated Cycles = %llu (slowest CPU)\n", slowest);
+        output_printf(output_file, "Value Checksum = %lld\n", checksum);
+        output_printf(output_file, "CPUs = %d, Trace Load Seconds = %.3f, Run Seconds = %.3f, Translations per Second = %.0f\n", cpu_count,
+                      load_seconds, run_seconds, run_seconds > 0 ? count / run_seconds : 0.0);
+    }
+    free_smp(&smp);
+    free(addresses);
+    free(threads);
+    return status;
+}
+
+/*
+    Reference engine (--reference): a deliberately naive second implementation of the plain machine that make check
+    cross-checks the main engine against. Everything is a flat array searched linearly: the TLB is scanned entry by
+    entry, a page is found by scanning the frames, and the victim is found by a scan for the oldest load (fifo), the
+    oldest use (lru), the fewest uses and then the oldest use (lfu) or the furthest next use (opt); clock, esc and cflru
+    follow their definitions over the same arrays. Only trace decoding, the backing store and the output format are
+    shared with the main engine. OPT may pick a different page among those never used again, so only its counters are
+    expected to match. arc, and options that change the machine (huge pages, an L2 TLB, prefetching, asynchronous I/O,
+    allocation other than global), are not modelled; per-process lines are not reported.
+*/
+typedef struct Reference_frame
+{
+    unsigned long long key; /* NO_PAGE while unused */
+    unsigned long long loaded;
+    unsigned long long used;
+    unsigned long long uses;
+    unsigned long long next_use;
+    int referenced;
+    int dirty;
+} Reference_frame;
+
+typedef struct Reference_tlb_entry
+{
+    unsigned long long key; /* NO_PAGE while invalid */
+    int frame;
+    unsigned long long used;
+} Reference_tlb_entry;
+
+typedef struct Reference
+{
+    const char *policy;
+    Reference_frame *frames;
+    int frame_count;
+    int frames_used;
+    int hand;
+    char *memory;
+    Reference_tlb_entry *tlb;
+    int tlb_size;
+    int tlb_ways;
+    int *tlb_next; /* FIFO pointer of each set */
+    int tlb_replacement;
+    unsigned long long tlb_clock;
+    Page_map copies; /* key -> index in pages of a page written back */
+    char **pages;
+    size_t page_count;
+} Reference;
+
+static int reference_is(const Reference *reference, const char *name)
+{
+    return strcmp(reference->policy, name) == 0;
+}
+
+/* The frame among the first window in LRU order, oldest first, that is clean; the LRU frame if all are dirty. */
+static int reference_cflru_victim(Reference *reference)
+{
+    int window = reference->frame_count / 4 > 0 ? reference->frame_count / 4 : 1;
+    unsigned long long after = 0;
+    int oldest = -1;
+
+    for (int i = 0; i < window; i++)
+    {
+        int candidate = -1;
+        for (int frame = 0; frame < reference->frame_count; frame++)
+        {
+            if ((i == 0 || reference->frames[frame].used > after) &&
+                (candidate < 0 || reference->frames[frame].used < reference->frames[candidate].used))
+            {
+                candidate = frame;
+            }
+        }
+        if (candidate < 0)
+        {
+            break;
+        }
+        if (i == 0)
+        {
+            oldest = candidate;
+        }
+        if (!reference->frames[candidate].dirty)
+        {
+            return candidate;
+        }
+        after = reference->frames[candidate].used;
+    }
+    return oldest;
+}
+
+static int reference_victim(Reference *reference)
+{
+    Reference_frame *frames = reference->frames;
+    int count = reference->frame_count;
+    int victim = 0;
+
+    if (reference_is(reference, "clock"))
+    {
+        while (frames[reference->hand].referenced)
+        {
+            frames[reference->hand].referenced = 0;
+            reference->hand = (reference->hand + 1) % count;
+        }
+        victim = reference->hand;
+        reference->hand = (reference->hand + 1) % count;
+        return victim;
+    }
+    if (reference_is(reference, "esc"))
+    {
+        for (;;)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                int frame = (reference->hand + i) % count;
+                if (!frames[frame].referenced && !frames[frame].dirty)
+                {
+                    reference->hand = (frame + 1) % count;
+                    return frame;
+                }
+            }
+            for (int i = 0; i < count; i++)
+            {
+                int frame = (reference->hand + i) % count;
+                if (!frames[frame].referenced)
+                {
+                    reference->hand = (frame + 1) % count;
+                    return frame;
+                }
+                frames[frame].referenced = 0;
+            }
+        }
+    }
+    if (reference_is(reference, "cflru"))
+    {
+        return reference_cflru_victim(reference);
+    }
+    for (int frame = 1; frame < count; frame++)
+    {
+        int better;
+        if (reference_is(reference, "fifo"))
+        {
+            better = frames[frame].loaded < frames[victim].loaded;
+        }
+        else if (reference_is(reference, "lfu"))
+        {
+            better = frames[frame].uses < frames[victim].uses ||
+                     (frames[frame].uses == frames[victim].uses && frames[frame].used < frames[victim].used);
+        }
+        else if (reference_is(reference, "opt"))
+        {
+            better = frames[frame].next_use > frames[victim].next_use;
+        }
+        else
+        {
+            better = frames[frame].used < frames[victim].used;
+        }
+        if (better)
+        {
+            victim = frame;
+        }
+    }
+    return victim;
+}
+
+static void reference_use(Reference *reference, int frame, unsigned long long now, unsigned long long next_use)
+{
+    reference->frames[frame].used = now;
+    reference->frames[frame].uses++;
+    reference->frames[frame].next_use = next_use;
+    reference->frames[frame].referenced = 1;
+}
+
+static int reference_save_page(Reference *reference, Reference_frame *frame, const char *data)
+{
+    long long index = page_map_get(&reference->copies, frame->key);
+
+    if (index < 0)
+    {
+        char **grown = realloc(reference->pages, (reference->page_count + 1) * sizeof(char *));
+        if (grown != NULL)
+        {
+            reference->pages = grown;
+        }
+        if (grown == NULL || (grown[reference->page_count] = malloc(geometry.page_size)) == NULL)
+        {
+            printf("Error: could not allocate a reference page copy\n");
+            return -1;
+        }
+        index = (long long)reference->page_count++;
+        page_map_put(&reference->copies, frame->key, index);
+    }
+    memcpy(reference->pages[index], data, geometry.page_size);
+    return 0;
+}
+
+/* Returns the frame the page with key now occupies, evicting a victim once every frame is in use, or -1 on error. */
+static int reference_fault(Reference *reference, unsigned long long key, unsigned long long now, unsigned long long next_use)
+{
+    int frame = reference->frames_used < reference->frame_count ? reference->frames_used++ : reference_victim(reference);
+    Reference_frame *victim = &reference->frames[frame];
+    char *data = reference->memory + (size_t)frame * geometry.page_size;
+
+    if (victim->key != NO_PAGE)
+    {
+        if (victim->dirty && reference_save_page(reference, victim, data) != 0)
+        {
+            return -1;
+        }
+        for (int i = 0; i < reference->tlb_size; i++)
+        {
+            if (reference->tlb[i].key == victim->key)
+            {
+                reference->tlb[i].key = NO_PAGE;
+                reference->tlb[i].frame = -1;
+            }
+        }
+    }
+
+    long long copy = page_map_get(&reference->copies, key);
+    if (copy >= 0)
+    {
+        memcpy(data, reference->pages[copy], geometry.page_size);
+    }
+    else
+    {
+        read_page_from_backing_store(key & geometry.page_mask, data);
+    }
+    *victim = (Reference_frame){key, now, now, 1, next_use, 1, 0};
+    return frame;
+}
+
+static int reference_tlb_select(Reference *reference, unsigned long long key)
+{
+    int set = (int)(key % (reference->tlb_size / reference->tlb_ways));
+    Reference_tlb_entry *entries = reference->tlb + set * reference->tlb_ways;
+    int way = 0;
+
+    if (reference->tlb_replacement == TLB_REPLACEMENT_FIFO)
+    {
+        way = reference->tlb_next[set];
+        reference->tlb_next[set] = (way + 1) % reference->tlb_ways;
+        return set * reference->tlb_ways + way;
+    }
+    for (int i = 0; i < reference->tlb_ways; i++)
+    {
+        if (entries[i].key == NO_PAGE)
+        {
+            return set * reference->tlb_ways + i;
+        }
+    }
+    for (int i = 1; i < reference->tlb_ways; i++)
+    {
+        if (entries[i].used < entries[way].used)
+        {
+            way = i;
+        }
+    }
+    return set * reference->tlb_ways + way;
+}
+
+/* Runs config over the whole trace; per-address lines are written only when write_addresses is set. */
+int run_reference(Trace_reader *trace, unsigned int process_limit, const Simulator_config *config, Output_writer *output_file,
+                  int write_addresses)
+{
+    size_t count;
+    Address *addresses = NULL;
+    unsigned long long *next_use = NULL;
+    unsigned long long page_faults = 0;
+    unsigned long long tlb_hits = 0;
+    unsigned int current_process = 0;
+    int tlb_ways = config->tlb_ways > 0 ? config->tlb_ways : config->tlb_size;
+    int status = 0;
+    Reference reference = {config->policy->name, NULL, config->frames, 0, 0, NULL, NULL, config->tlb_size, tlb_ways, NULL,
+                           config->tlb_replacement, 0, {0}, NULL, 0};
+
+    /* The same geometry checks as init_tlb, so the cross-check refuses what the engine it checks refuses. */
+    if (check_tlb_geometry(config->tlb_size, config->tlb_ways) != 0 || (addresses = load_trace(trace, process_limit, &count)) == NULL)
+    {
+        return -1;
+    }
+    reference.frames = malloc(config->frames * sizeof(Reference_frame));
+    reference.memory = malloc((size_t)config->frames * geometry.page_size);
+    reference.tlb = malloc(config->tlb_size * sizeof(Reference_tlb_entry));
+    reference.tlb_next = calloc(config->tlb_size / tlb_ways, sizeof(int));
+    next_use = malloc((count > 0 ? count : 1) * sizeof(unsigned long long));
+    if (reference.frames == NULL || reference.memory == NULL || reference.tlb == NULL || reference.tlb_next == NULL ||
+        next_use == NULL || page_map_init(&reference.copies, 64) != 0)
+    {
+        printf("Error: could not allocate the reference engine\n");
+        status = -1;
+    }
+
+    if (status == 0)
+    {
+        Page_map seen;
+        if (page_map_init(&seen, count) != 0)
+        {
+            printf("Error: could not allocate the reference engine\n");
+            status = -1;
+        }
+        for (size_t i = count; status == 0 && i-- > 0;)
+        {
+            unsigned long long key = page_key(addresses[i].process, addresses[i].page_number);
+            long long next = page_map_get(&seen, key);
+            next_use[i] = next >= 0 ? (unsigned long long)next : NEVER_USED_AGAIN;
+            page_map_put(&seen, key, (long long)i);
+        }
+        if (status == 0)
+        {
+            page_map_free(&seen);
+        }
+        for (int i = 0; i < config->frames; i++)
+        {
+            reference.frames[i].key = NO_PAGE;
+        }
+        for (int i = 0; i < config->tlb_size; i++)
+        {
+            reference.tlb[i] = (Reference_tlb_entry){NO_PAGE, -1, 0};
+        }
+    }
+
+    for (size_t i = 0; status == 0 && i < count; i++)
+    {
+        const Address *address = &addresses[i];
+        unsigned long long key = page_key(address->process, address->page_number);
+        int set = (int)(key % (config->tlb_size / tlb_ways));
+        int tlb_index = -1;
+        int frame = -1;
+
+        if (config->tlb_flush_on_switch && address->process != current_process)
+        {
+            for (int entry = 0; entry < config->tlb_size; entry++)
+            {
+                reference.tlb[entry] = (Reference_tlb_entry){NO_PAGE, -1, reference.tlb[entry].used};
+            }
+        }
+        current_process = address->process;
+
+        for (int way = 0; way < tlb_ways; way++)
+        {
+            Reference_tlb_entry *entry = &reference.tlb[set * tlb_ways + way];
+            if (entry->key == key)
+            {
+                entry->used = ++reference.tlb_clock;
+                tlb_index = set * tlb_ways + way;
+                frame = entry->frame;
+            }
+        }
+        if (tlb_index >= 0)
+        {
+            tlb_hits++;
+            reference_use(&reference, frame, i, next_use[i]);
+        }
+        else
+        {
+            for (int candidate = 0; candidate < config->frames; candidate++)
+            {
+                if (reference.frames[candidate].key == key)
+                {
+                    frame = candidate;
+                }
+            }
+            if (frame >= 0)
+            {
+                reference_use(&reference, frame, i, next_use[i]);
+            }
+            else
+            {
+                page_faults++;
+                if ((frame = reference_fault(&reference, key, i, next_use[i])) < 0)
+                {
+                    status = -1;
+                    break;
+                }
+            }
+        }
+
+        char *byte = reference.memory + (size_t)frame * geometry.page_size + address->offset;
+        if (address->write)
+        {
+            *byte = (char)(*byte + 1);
+            reference.frames[frame].dirty = 1;
+        }
+        if (tlb_index < 0)
+        {
+            tlb_index = reference_tlb_select(&reference, key);
+            reference.tlb[tlb_index] = (Reference_tlb_entry){key, frame, ++reference.tlb_clock};
+        }
+        if (write_addresses)
+        {
+            write_translation(output_file, address->virtual_address, tlb_index, physical_address_calculator(frame, address->offset),
+                              (signed char)*byte);
+        }
+    }
+
+    if (status == 0)
+    {
+        output_printf(output_file, "Number of Translated Addresses = %llu\n", (unsigned long long)count);
+        output_printf(output_file, "Page Faults = %llu\n", page_faults);
+        output_printf(output_file, "Page Fault Rate = %.3f\n", (float)page_faults / count);
+        output_printf(output_file, "TLB Hits = %llu\n", tlb_hits);
+        output_printf(output_file, "TLB Hit Rate = %.3f\n", (float)tlb_hits / count);
+    }
+    for (size_t i = 0; i < reference.page_count; i++)
+    {
+        free(reference.pages[i]);
+    }
+    free(reference.pages);
+    if (reference.copies.keys != NULL)
+    {
+        page_map_free(&reference.copies);
+    }
+    free(reference.frames);
+    free(reference.memory);
+    free(reference.tlb);
+    free(reference.tlb_next);
+    free(next_use);
+    free(addresses);
+    return status;
+}
+
+/*
+    Stack-distance (Mattson) analysis. LRU has the inclusion property: a reference hits in a memory of F frames iff
+    fewer than F distinct pages were referenced since the previous reference to the same page. One pass that records
+    this stack distance for every reference therefore gives the LRU fault count of every memory size at once.
+
+    Each page's most recent reference is marked in a Fenwick tree indexed by time, so the distance is the number of
+    marks after the page's previous reference, found in O(log n). When time reaches the tree's capacity the live marks
+    are renumbered 0..distinct-1, which keeps the tree proportional to the number of distinct pages rather than to the
+    trace length.
+*/
+typedef struct Fenwick_tree
+{
+    int *tree;
+    size_t size;
+} Fenwick_tree;
+
+int fenwick_init(Fenwick_tree *fenwick, size_t size)
+{
+    fenwick->tree = calloc(size + 1, sizeof(int));
+    fenwick->size = size;
+    return fenwick->tree == NULL ? -1 : 0;
+}
+
+void fenwick_free(Fenwick_tree *fenwick)
+{
+    free(fenwick->tree);
+}
+
+static inline void fenwick_add(Fenwick_tree *fenwick, size_t index, int delta)
+{
+    for (index++; index <= fenwick->size; index += index & -index)
+    {
+        fenwick->tree[index] += delta;
+    }
+}
+
+/* Sum of the marks at indices below index. */
+static inline long long fenwick_prefix(const Fenwick_tree *fenwick, size_t index)
+{
+    long long sum = 0;
+
+    for (; index > 0; index -= index & -index)
+    {
+        sum += fenwick->tree[index];
+    }
+    return sum;
+}
+
+typedef struct Stack_distance
+{
+    Page_map last_reference;
+    Fenwick_tree marks;
+    unsigned long long *time_key;
+    size_t capacity;
+    size_t time;
+    unsigned long long *histogram; /* histogram[d]: references at stack distance d (1 = most recently used page) */
+    size_t histogram_size;
+    unsigned long long cold_misses;
+    unsigned long long references;
+} Stack_distance;
+
+#define STACK_DISTANCE_MIN_CAPACITY (1 << 16)
+
+static int stack_distance_alloc(Stack_distance *analysis, size_t capacity)
+{
+    analysis->capacity = capacity;
+    analysis->time_key = malloc(capacity * sizeof(unsigned long long));
+    if (analysis->time_key == NULL || fenwick_init(&analysis->marks, capacity) != 0)
+    {
+        printf("Error: could not allocate stack-distance tables\n");
+        return -1;
+    }
+    return 0;
+}
+
+int stack_distance_init(Stack_distance *analysis)
+{
+    memset(analysis, 0, sizeof(Stack_distance));
+    analysis->histogram_size = 1024;
+    analysis->histogram = calloc(analysis->histogram_size, sizeof(unsigned long long));
+    if (analysis->histogram == NULL || page_map_init(&analysis->last_reference, 1024) != 0)
+    {
+        printf("Error: could not allocate stack-distance tables\n");
+        return -1;
+    }
+    return stack_distance_alloc(analysis, STACK_DISTANCE_MIN_CAPACITY);
+}
+
+void stack_distance_free(Stack_distance *analysis)
+{
+    page_map_free(&analysis->last_reference);
+    fenwick_free(&analysis->marks);
+    free(analysis->time_key);
+    free(analysis->histogram);
+}
+
+/* Renumbers the live marks from 0 and sizes the tree to twice the number of distinct pages. */
+static int stack_distance_compact(Stack_distance *analysis)
+{
+    unsigned long long *old_keys = analysis->time_key;
+    size_t old_time = analysis->time;
+    size_t distinct = analysis->last_reference.count;
+    size_t capacity = distinct * 2 > STACK_DISTANCE_MIN_CAPACITY ? distinct * 2 : STACK_DISTANCE_MIN_CAPACITY;
+
+    fenwick_free(&analysis->marks);
+    if (stack_distance_alloc(analysis, capacity) != 0)
+    {
+        free(old_keys);
+        return -1;
+    }
+    analysis->time = 0;
+    for (size_t time = 0; time < old_time; time++)
+    {
+        if (page_map_get(&analysis->last_reference, old_keys[time]) == (long long)time)
+        {
+            page_map_put(&analysis->last_reference, old_keys[time], analysis->time);
+            analysis->time_key[analysis->time] = old_keys[time];
+            fenwick_add(&analysis->marks, analysis->time, 1);
+            analysis->time++;
+        }
+    }
+    free(old_keys);
+    return 0;
+}
+
+int stack_distance_reference(Stack_distance *analysis, unsigned long long key)
+{
+    if (analysis->time == analysis->capacity && stack_distance_compact(analysis) != 0)
+    {
+        return -1;
+    }
+
+    long long previous = page_map_get(&analysis->last_reference, key);
+    analysis->references++;
+    if (previous < 0)
+    {
+        analysis->cold_misses++;
+    }
+    else
+    {
+        size_t distance = (size_t)(fenwick_prefix(&analysis->marks, analysis->time) - fenwick_prefix(&analysis->marks, previous + 1)) + 1;
+        if (distance >= analysis->histogram_size)
+        {
+            size_t size = analysis->histogram_size;
+            while (size <= distance)
+            {
+                size *= 2;
+            }
+            unsigned long long *grown = realloc(analysis->histogram, size * sizeof(unsigned long long));
+            if (grown == NULL)
+            {
+                printf("Error: could not allocate stack-distance tables\n");
+                return -1;
+            }
+            memset(grown + analysis->histogram_size, 0, (size - analysis->histogram_size) * sizeof(unsigned long long));
+            analysis->histogram = grown;
+            analysis->histogram_size = size;
+        }
+        analysis->histogram[distance]++;
+        fenwick_add(&analysis->marks, previous, -1);
+    }
+    page_map_put(&analysis->last_reference, key, analysis->time);
+    analysis->time_key[analysis->time] = key;
+    fenwick_add(&analysis->marks, analysis->time, 1);
+    analysis->time++;
+    return 0;
+}
+
+/*
+    Writes the LRU miss-ratio curve for sizes 1..max_size (0: up to the number of distinct pages). The same curve
+    describes a fully associative LRU TLB of that many entries over a memory that never evicts, since both cache the
+    same pages; it is printed as TLB hits alongside the page faults.
+*/
+int run_stack_distance(Trace_reader *trace, unsigned int process_limit, int max_size, Output_writer *output_file)
+{
+    Stack_distance analysis;
+    Address *chunk = malloc(ADDRESS_CHUNK_SIZE * sizeof(Address));
+    int count;
+
+    if (chunk == NULL || stack_distance_init(&analysis) != 0)
+    {
+        free(chunk);
+        return -1;
+    }
+    while ((count = extract_page_number_and_offset(trace, process_limit, chunk, ADDRESS_CHUNK_SIZE)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (stack_distance_reference(&analysis, page_key(chunk[i].process, chunk[i].page_number)) != 0)
+            {
+                trace->error = 1;
+                break;
+            }
+        }
+    }
+    free(chunk);
+    if (trace->error)
+    {
+        stack_distance_free(&analysis);
+        return -1;
+    }
+
+    size_t distinct = analysis.last_reference.count;
+    size_t sizes = max_size > 0 ? (size_t)max_size : distinct;
+    unsigned long long misses = analysis.references;
+
+    output_printf(output_file, "Stack distance analysis (LRU): %llu references, %zu distinct pages, %llu cold misses\n",
+                  analysis.references, distinct, analysis.cold_misses);
+    output_printf(output_file, "%8s %12s %10s %12s %12s\n", "Size", "Page Faults", "Fault Rate", "TLB Hits", "TLB Hit Rate");
+    for (size_t size = 1; size <= sizes; size++)
+    {
+        misses -= size < analysis.histogram_size ? analysis.histogram[size] : 0;
+        output_printf(output_file, "%8zu %12llu %10.3f %12llu %12.3f\n", size, misses, (float)misses / analysis.references,
+                      analysis.references - misses, (float)(analysis.references - misses) / analysis.references);
+    }
+    stack_distance_free(&analysis);
+    return 0;
+}
+
+/* Parses a comma-separated list of integers; returns how many, or -1 if the text is not such a list. */
+int parse_int_list(const char *text, int *values, int capacity)
+{
+    int count = 0;
+
+    while (count < capacity)
+    {
+        char *end;
+        long value = strtol(text, &end, 0);
+        if (end == text || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        values[count++] = (int)value;
+        if (*end == '\0')
+        {
+            return count;
+        }
+        text = end + 1;
+    }
+    return -1;
+}
+
+/* Parses a byte count with an optional K, M or G suffix; returns 0 if the text is not a size. */
+unsigned long long parse_size(const char *text)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 0);
+
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        value <<= 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        value <<= 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        value <<= 10;
+        end++;
+        break;
+    }
+    return *end == '\0' && end != text ? value : 0;
+}
+
+/* Long options without a short letter; getopt_long returns these codes for them. */
+enum
+{
+    OPTION_GENERATE = 256,
+    OPTION_TRACE_LENGTH,
+    OPTION_SEED,
+    OPTION_FOOTPRINT,
+    OPTION_ZIPF_SKEW,
+    OPTION_STRIDE,
+    OPTION_BENCH,
+    OPTION_BENCH_FORMAT,
+    OPTION_BENCH_LABEL,
+    OPTION_WRITE_RATIO,
+    OPTION_REFERENCE,
+    OPTION_INTERVAL_OUTPUT,
+    OPTION_INTERVAL_FORMAT,
+    OPTION_SAMPLE,
+    OPTION_SAMPLE_RATE,
+    OPTION_SAMPLE_WINDOW,
+    OPTION_WARM_UP,
+    OPTION_CHECKPOINT,
+    OPTION_CHECKPOINT_AT,
+    OPTION_RESTORE,
+    OPTION_CPUS,
+    OPTION_IPI_LATENCY,
+    OPTION_ZSWAP_POOL,
+    OPTION_ZSWAP_LATENCY
+};
+
+void print_usage(char *program_name)
+{
+    printf("Usage: %s <address_file> <replacement_algorithm> [options]\n", program_name);
+    printf("       %s <address_file> <algorithm,...> --frames <n,...> --tlb-size <n,...> [--threads <n>] [options]\n", program_name);
+    printf("       %s <address_file> --convert-trace <output> [--trace-width 4|8]\n", program_name);
+    printf("       %s <address_file> --mrc [--mrc-max <n>] [options]\n", program_name);
+    printf("       %s <trace_file> --generate <pattern> [--trace-length <n>] [--seed <n>] [options]\n", program_name);
+    printf("Replacement algorithms:");
+    for (size_t i = 0; i < sizeof(replacement_policies) / sizeof(replacement_policies[0]); i++)
+    {
+        printf(" %s", replacement_policies[i].name);
+    }
+    printf("\n");
+    printf("Comma-separated lists of algorithms, frame counts or TLB sizes run every combination as a sweep.\n");
+    printf("Options:\n");
+    printf("  -f, --frames <n>           number of physical memory frames (default %d, max %d)\n", PHYSICAL_MEMORY_FRAMES, MAX_PHYSICAL_MEMORY_FRAMES);
+    printf("  -p, --page-size <bytes>    page and frame size, a power of two from %d to %dK (default %d); accepts K and M\n", 1 << MIN_OFFSET_BITS, 1 << (MAX_OFFSET_BITS - 10), 1 << OFFSET_BITS);
+    printf("  -a, --va-bits <n>          width of a virtual address in bits, up to %d (default %d)\n", MAX_VIRTUAL_ADDRESS_BITS, PAGE_NUMBER_BITS + OFFSET_BITS);
+    printf("      --page-table <type>    page table organization: flat (default), radix or inverted\n");
+    printf("      --page-table-levels <n> radix levels, %d to %d (default: enough for %d bits per level)\n", MIN_RADIX_LEVELS, MAX_RADIX_LEVELS, RADIX_BITS_PER_LEVEL);
+    printf("      --walk-latency <n>     cycles per memory reference of a page walk (default %d)\n", DEFAULT_WALK_LATENCY);
+    printf("  -b, --backing-store <path> backing store file (default %s)\n", DEFAULT_BACKING_STORE);
+    printf("      --writable-store       write dirty pages back into the backing store file instead of private copies\n");
+    printf("      --writeback-batch <n>  dirty pages queued before a write-back flush (default %d, max %d)\n", DEFAULT_WRITEBACK_BATCH, MAX_WRITEBACK_BATCH);
+    printf("  -t, --tlb-size <n>         number of TLB entries (default %d, max %d)\n", TLB_SIZE, MAX_TLB_SIZE);
+    printf("  -w, --tlb-ways <n>         TLB associativity: 0 = fully associative (default), 1 = direct-mapped\n");
+    printf("  -r, --tlb-replacement <p>  TLB replacement: fifo (default), lru or random\n");
+    printf("      --tlb-probe <kernel>   TLB tag probe: auto (default),");
+    for (size_t i = 0; i < sizeof(tlb_probes) / sizeof(tlb_probes[0]); i++)
+    {
+        printf(" %s", tlb_probes[i].name);
+    }
+    printf("\n");
+    printf("      --l2-tlb-size <n>      entries of a second-level TLB probed on L1 misses (default 0, none)\n");
+    printf("      --l2-tlb-ways <n>      L2 TLB associativity, 0 = fully associative (default)\n");
+    printf("      --tlb-inclusion <p>    L2 TLB contents: inclusive (default) or exclusive of the L1\n");
+    printf("      --l1-tlb-latency <n>   cycles of an L1 TLB lookup (default %d)\n", DEFAULT_L1_TLB_LATENCY);
+    printf("      --l2-tlb-latency <n>   cycles of an L2 TLB lookup (default %d)\n", DEFAULT_L2_TLB_LATENCY);
+    printf("      --fault-latency <n>    cycles of a backing-store read on a page fault (default %d)\n", DEFAULT_FAULT_LATENCY);
+    printf("      --huge-page-size <bytes> promote hot, fully resident aligned regions of this size to huge pages\n");
+    printf("      --huge-tlb <t>         huge-page TLB entries: separate (default) or unified with the base TLB\n");
+    printf("      --huge-tlb-size <n>    entries of a separate huge-page TLB (default %d)\n", DEFAULT_HUGE_TLB_SIZE);
+    printf("      --promote-threshold <n> accesses to a fully resident region before it is promoted (default: its base pages)\n");
+    printf("      --prefetch <p>         read predicted pages on a fault: none (default), sequential, stride or markov\n");
+    printf("      --prefetch-degree <n>  pages read ahead per fault (default %d, max %d)\n", DEFAULT_PREFETCH_DEGREE, MAX_PREFETCH_DEGREE);
+    printf("      --zswap-pool <bytes>   compress evicted pages into a pool of this size that faults read first; accepts K and M\n");
+    printf("      --zswap-latency <n>    cycles of compressing or decompressing a page (default %d)\n", DEFAULT_ZSWAP_LATENCY);
+    printf("      --async-io <engine>    read faulting pages ahead of time: off (default), uring, or threads\n");
+    printf("      --io-depth <n>         page reads kept in flight with --async-io (default %d, max %d)\n", DEFAULT_IO_DEPTH, MAX_IO_DEPTH);
+    printf("      --io-threads <n>       reader threads for --async-io threads (default %d)\n", DEFAULT_IO_THREADS);
+    printf("  -o, --output <path>        output file, or - for standard output (default %s)\n", DEFAULT_OUTPUT_FILE);
+    printf("      --stats-only           only write the final counters, not one line per address\n");
+    printf("  -x, --extended-stats       also report page-walk and page-table statistics\n");
+    printf("      --trace-format <f>     addresses file format: auto (default), text, bin32 or bin64\n");
+    printf("      --convert-trace <path> write the addresses file as a binary trace and exit\n");
+    printf("      --trace-width <n>      record size in bytes for --convert-trace: 4 (default) or 8\n");
+    printf("      --processes <n>        number of processes; trace process ids must be below it\n");
+    printf("      --frame-allocation <a> frame allocation: global (default); local, which splits the frames evenly\n");
+    printf("                             between --processes processes; ws (working set) or pff (page-fault frequency)\n");
+    printf("      --ws-window <n>        working-set window in references of the process (default %d)\n", DEFAULT_WORKING_SET_WINDOW);
+    printf("      --pff-threshold <n>    PFF shrinks a process whose faults are more than n references apart (default %d)\n", DEFAULT_PFF_THRESHOLD);
+    printf("      --interval <n>         report fault rate, resident frames and thrashing every n accesses\n");
+    printf("      --thrashing-threshold <r> interval fault rate, with memory full, counted as thrashing (default %.2f)\n", DEFAULT_THRASHING_FAULT_RATE);
+    printf("      --interval-output <path> stream the interval samples to path instead of the report\n");
+    printf("      --interval-format <f>  interval output format: csv (default) or binary\n");
+    printf("      --sample <m>           estimate from a sample: shards (a hash-selected subset of pages) or interval (windows)\n");
+    printf("      --sample-rate <r>      fraction of pages or of accesses sampled (default %.2f)\n", DEFAULT_SAMPLE_RATE);
+    printf("      --sample-window <n>    interval sampling: accesses measured per window (default %d)\n", DEFAULT_SAMPLE_WINDOW);
+    printf("      --warm-up <n>          simulate n accesses without measuring them (interval sampling: before each window,\n");
+    printf("                             one window by default)\n");
+    printf("      --checkpoint <path>    with --checkpoint-at n: stop after n accesses and save the simulator state to path\n");
+    printf("      --checkpoint-at <n>    access index of the checkpoint\n");
+    printf("      --restore <path>       resume from a checkpoint taken with the same machine options, skipping the accesses\n");
+    printf("                             it covers\n");
+    printf("      --tlb-flush-on-switch  flush the TLB on every context switch instead of relying on ASID tags\n");
+    printf("      --threads <n>          sweep worker threads (default: one per online CPU)\n");
+    printf("      --mrc                  write the LRU miss-ratio curve for every memory and TLB size in one pass\n");
+    printf("      --mrc-max <n>          largest size in the curve (default: the number of distinct pages)\n");
+    printf("      --generate <pattern>   write a synthetic binary trace to <trace_file> and exit: uniform, zipf, sequential,\n");
+    printf("                             stride, loop or phase\n");
+    printf("      --trace-length <n>     accesses in a generated trace (default %d); accepts K and M\n", DEFAULT_TRACE_LENGTH);
+    printf("      --seed <n>             random seed of a generated trace (default 1)\n");
+    printf("      --footprint <n>        distinct pages a generated trace draws from (default %d, max %d)\n", DEFAULT_FOOTPRINT, MAX_FOOTPRINT);
+    printf("      --zipf-skew <s>        Zipf exponent of the zipf and phase patterns (default %.2f)\n", DEFAULT_ZIPF_SKEW);
+    printf("      --stride <n>           pages between accesses of the stride pattern (default %d)\n", DEFAULT_STRIDE);
+    printf("      --write-ratio <r>      fraction of the accesses of a generated trace that are writes (default 0)\n");
+    printf("      --bench <path>         append a timing record of the run to <path>\n");
+    printf("      --bench-format <f>     benchmark record format: csv (default) or json (one object per line)\n");
+    printf("      --bench-label <s>      label column of the benchmark record, e.g. a version\n");
+    printf("      --reference            run the slow reference engine instead, to cross-check results (see make check)\n");
+    printf("      --cpus <n>             translate on n simulated CPUs at once, each a thread with a private TLB (clock only)\n");
+    printf("      --ipi-latency <n>      cycles a TLB-shootdown IPI costs the sender and the receiver (default %d)\n", DEFAULT_IPI_LATENCY);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"frames", required_argument, NULL, 'f'},
+        {"page-size", required_argument, NULL, 'p'},
+        {"va-bits", required_argument, NULL, 'a'},
+        {"page-table", required_argument, NULL, 'G'},
+        {"page-table-levels", required_argument, NULL, 'L'},
+        {"walk-latency", required_argument, NULL, 'Y'},
+        {"extended-stats", no_argument, NULL, 'x'},
+        {"backing-store", required_argument, NULL, 'b'},
+        {"tlb-size", required_argument, NULL, 't'},
+        {"tlb-ways", required_argument, NULL, 'w'},
+        {"tlb-replacement", required_argument, NULL, 'r'},
+        {"tlb-probe", required_argument, NULL, 'P'},
+        {"output", required_argument, NULL, 'o'},
+        {"stats-only", no_argument, NULL, 'S'},
+        {"trace-format", required_argument, NULL, 'T'},
+        {"convert-trace", required_argument, NULL, 'C'},
+        {"trace-width", required_argument, NULL, 'W'},
+        {"processes", required_argument, NULL, 'N'},
+        {"frame-allocation", required_argument, NULL, 'A'},
+        {"tlb-flush-on-switch", no_argument, NULL, 'F'},
+        {"threads", required_argument, NULL, 'J'},
+        {"mrc", no_argument, NULL, 'M'},
+        {"mrc-max", required_argument, NULL, 'K'},
+        {"ws-window", required_argument, NULL, 'D'},
+        {"pff-threshold", required_argument, NULL, 'Q'},
+        {"interval", required_argument, NULL, 'I'},
+        {"thrashing-threshold", required_argument, NULL, 'H'},
+        {"async-io", required_argument, NULL, 'U'},
+        {"prefetch", required_argument, NULL, 'X'},
+        {"prefetch-degree", required_argument, NULL, 'Z'},
+        {"io-depth", required_argument, NULL, 'E'},
+        {"io-threads", required_argument, NULL, 'R'},
+        {"writable-store", no_argument, NULL, 'V'},
+        {"writeback-batch", required_argument, NULL, 'B'},
+        {"l2-tlb-size", required_argument, NULL, 'l'},
+        {"l2-tlb-ways", required_argument, NULL, 'k'},
+        {"tlb-inclusion", required_argument, NULL, 'i'},
+        {"l1-tlb-latency", required_argument, NULL, 'c'},
+        {"l2-tlb-latency", required_argument, NULL, 'd'},
+        {"fault-latency", required_argument, NULL, 'e'},
+        {"huge-page-size", required_argument, NULL, 'g'},
+        {"huge-tlb", required_argument, NULL, 'u'},
+        {"huge-tlb-size", required_argument, NULL, 'z'},
+        {"promote-threshold", required_argument, NULL, 'O'},
+        {"generate", required_argument, NULL, OPTION_GENERATE},
+        {"trace-length", required_argument, NULL, OPTION_TRACE_LENGTH},
+        {"seed", required_argument, NULL, OPTION_SEED},
+        {"footprint", required_argument, NULL, OPTION_FOOTPRINT},
+        {"zipf-skew", required_argument, NULL, OPTION_ZIPF_SKEW},
+        {"stride", required_argument, NULL, OPTION_STRIDE},
+        {"bench", required_argument, NULL, OPTION_BENCH},
+        {"bench-format", required_argument, NULL, OPTION_BENCH_FORMAT},
+        {"bench-label", required_argument, NULL, OPTION_BENCH_LABEL},
+        {"write-ratio", required_argument, NULL, OPTION_WRITE_RATIO},
+        {"reference", no_argument, NULL, OPTION_REFERENCE},
+        {"interval-output", required_argument, NULL, OPTION_INTERVAL_OUTPUT},
+        {"interval-format", required_argument, NULL, OPTION_INTERVAL_FORMAT},
+        {"sample", required_argument, NULL, OPTION_SAMPLE},
+        {"sample-rate", required_argument, NULL, OPTION_SAMPLE_RATE},
+        {"sample-window", required_argument, NULL, OPTION_SAMPLE_WINDOW},
+        {"warm-up", required_argument, NULL, OPTION_WARM_UP},
+        {"checkpoint", required_argument, NULL, OPTION_CHECKPOINT},
+        {"checkpoint-at", required_argument, NULL, OPTION_CHECKPOINT_AT},
+        {"restore", required_argument, NULL, OPTION_RESTORE},
+        {"cpus", required_argument, NULL, OPTION_CPUS},
+        {"ipi-latency", required_argument, NULL, OPTION_IPI_LATENCY},
+        {"zswap-pool", required_argument, NULL, OPTION_ZSWAP_POOL},
+        {"zswap-latency", required_argument, NULL, OPTION_ZSWAP_LATENCY},
+        {NULL, 0, NULL, 0}};
+    int frame_values[MAX_SWEEP_VALUES] = {PHYSICAL_MEMORY_FRAMES};
+    int frame_count = 1;
+    int offset_bits = OFFSET_BITS;
+    int virtual_address_bits = PAGE_NUMBER_BITS + OFFSET_BITS;
+    char *backing_store_path = DEFAULT_BACKING_STORE;
+    int tlb_values[MAX_SWEEP_VALUES] = {TLB_SIZE};
+    int tlb_count = 1;
+    int tlb_associativity = 0;
+    int tlb_policy = TLB_REPLACEMENT_FIFO;
+    char *tlb_probe_name = NULL;
+    int trace_format = TRACE_FORMAT_AUTO;
+    char *convert_path = NULL;
+    int trace_width = 4;
+    char *output_path = DEFAULT_OUTPUT_FILE;
+    int process_count = 0;
+    int frame_allocation = FRAME_ALLOCATION_GLOBAL;
+    int tlb_flush_on_switch = 0;
+    int threads = 0;
+    int miss_ratio_curve = 0;
+    int miss_ratio_curve_max = 0;
+    int working_set_window = DEFAULT_WORKING_SET_WINDOW;
+    int pff_threshold = DEFAULT_PFF_THRESHOLD;
+    int interval_length = 0;
+    double thrashing_threshold = DEFAULT_THRASHING_FAULT_RATE;
+    int prefetch = PREFETCH_NONE;
+    int prefetch_degree = DEFAULT_PREFETCH_DEGREE;
+    int generate_pattern = -1;
+    unsigned long long trace_length = DEFAULT_TRACE_LENGTH;
+    unsigned long long seed = 1;
+    unsigned long long footprint = DEFAULT_FOOTPRINT;
+    double zipf_skew = DEFAULT_ZIPF_SKEW;
+    unsigned long long stride = DEFAULT_STRIDE;
+    char *bench_path = NULL;
+    int bench_format = BENCH_FORMAT_CSV;
+    char *bench_label = "";
+    double write_ratio = 0;
+    int reference = 0;
+    char *interval_output_path = NULL;
+    int interval_format = INTERVAL_FORMAT_CSV;
+    int sample_mode = SAMPLE_NONE;
+    double sample_rate = DEFAULT_SAMPLE_RATE;
+    unsigned long long sample_window = DEFAULT_SAMPLE_WINDOW;
+    long long warm_up = -1; /* -1: not given */
+    char *checkpoint_path = NULL;
+    unsigned long long checkpoint_at = 0;
+    char *restore_path = NULL;
+    int cpus = 0;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "f:p:a:b:t:w:r:o:x", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            frame_count = parse_int_list(optarg, frame_values, MAX_SWEEP_VALUES);
+            for (int i = 0; i < frame_count; i++)
+            {
+                if (frame_values[i] < 1 || frame_values[i] > MAX_PHYSICAL_MEMORY_FRAMES)
+                {
+                    frame_count = -1;
+                }
+            }
+            if (frame_count < 0)
+            {
+                printf("Error: number of frames must be between 1 and %d\n", MAX_PHYSICAL_MEMORY_FRAMES);
+                return 1;
+            }
+            break;
+        case 'p':
+        {
+            unsigned long long page_size = parse_size(optarg);
+            if (page_size == 0 || (page_size & (page_size - 1)) != 0)
+            {
+                printf("Error: page size must be a power of two\n");
+                return 1;
+            }
+            offset_bits = __builtin_ctzll(page_size);
+            break;
+        }
+        case 'a':
+            virtual_address_bits = atoi(optarg);
+            break;
+        case 'G':
+            page_table_type = find_page_table_type(optarg);
+            if (page_table_type == NULL)
+            {
+                printf("Error: unknown page table type\n");
+                return 1;
+            }
+            break;
+        case 'L':
+            radix_levels = atoi(optarg);
+            if (radix_levels < MIN_RADIX_LEVELS || radix_levels > MAX_RADIX_LEVELS)
+            {
+                printf("Error: radix page table levels must be between %d and %d\n", MIN_RADIX_LEVELS, MAX_RADIX_LEVELS);
+                return 1;
+            }
+            break;
+        case 'x':
+            extended_stats = 1;
+            break;
+        case 'b':
+            backing_store_path = optarg;
+            break;
+        case 't':
+            tlb_count = parse_int_list(optarg, tlb_values, MAX_SWEEP_VALUES);
+            if (tlb_count < 0)
+            {
+                printf("Error: TLB size must be a number or a comma-separated list\n");
+                return 1;
+            }
+            break;
+        case 'w':
+            tlb_associativity = atoi(optarg);
+            break;
+        case 'r':
+            tlb_policy = -1;
+            for (int i = 0; i < (int)(sizeof(tlb_replacement_names) / sizeof(tlb_replacement_names[0])); i++)
+            {
+                if (strcmp(optarg, tlb_replacement_names[i]) == 0)
+                {
+                    tlb_policy = i;
+                }
+            }
+            if (tlb_policy < 0)
+            {
+                printf("Error: unknown TLB replacement algorithm\n");
+                return 1;
+            }
+            break;
+        case 'P':
+            tlb_probe_name = optarg;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'S':
+            stats_only = 1;
+            break;
+        case 'T':
+            trace_format = -1;
+            for (int i = 0; i < (int)(sizeof(trace_format_names) / sizeof(trace_format_names[0])); i++)
+            {
+                if (strcmp(optarg, trace_format_names[i]) == 0)
+                {
+                    trace_format = i;
+                }
+            }
+            if (trace_format < 0)
+            {
+                printf("Error: unknown trace format\n");
+                return 1;
+            }
+            break;
+        case 'C':
+            convert_path = optarg;
+            break;
+        case 'W':
+            trace_width = atoi(optarg);
+            if (trace_width != 4 && trace_width != 8)
+            {
+                printf("Error: trace width must be 4 or 8\n");
+                return 1;
+            }
+            break;
+        case 'N':
+            process_count = atoi(optarg);
+            if (process_count < 1 || process_count > MAX_PROCESSES)
+            {
+                printf("Error: number of processes must be between 1 and %d\n", MAX_PROCESSES);
+                return 1;
+            }
+            break;
+        case 'A':
+            frame_allocation = -1;
+            for (int i = 0; i < (int)(sizeof(frame_allocation_names) / sizeof(frame_allocation_names[0])); i++)
+            {
+                if (strcmp(optarg, frame_allocation_names[i]) == 0)
+                {
+                    frame_allocation = i;
+                }
+            }
+            if (frame_allocation < 0)
+            {
+                printf("Error: unknown frame allocation\n");
+                return 1;
+            }
+            break;
+        case 'F':
+            tlb_flush_on_switch = 1;
+            break;
+        case 'J':
+            threads = atoi(optarg);
+            if (threads < 1)
+            {
+                printf("Error: number of threads must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'M':
+            miss_ratio_curve = 1;
+            break;
+        case 'K':
+            miss_ratio_curve_max = atoi(optarg);
+            if (miss_ratio_curve_max < 1)
+            {
+                printf("Error: --mrc-max must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'X':
+            prefetch = -1;
+            for (int i = 0; i < (int)(sizeof(prefetch_names) / sizeof(prefetch_names[0])); i++)
+            {
+                if (strcmp(optarg, prefetch_names[i]) == 0)
+                {
+                    prefetch = i;
+                }
+            }
+            if (prefetch < 0)
+            {
+                printf("Error: unknown prefetcher\n");
+                return 1;
+            }
+            break;
+        case 'Z':
+            prefetch_degree = atoi(optarg);
+            if (prefetch_degree < 1 || prefetch_degree > MAX_PREFETCH_DEGREE)
+            {
+                printf("Error: prefetch degree must be between 1 and %d\n", MAX_PREFETCH_DEGREE);
+                return 1;
+            }
+            break;
+        case 'U':
+            async_io = -1;
+            for (int i = 0; i < (int)(sizeof(async_io_names) / sizeof(async_io_names[0])); i++)
+            {
+                if (strcmp(optarg, async_io_names[i]) == 0)
+                {
+                    async_io = i;
+                }
+            }
+            if (async_io < 0)
+            {
+                printf("Error: unknown asynchronous I/O engine\n");
+                return 1;
+            }
+            break;
+        case 'E':
+            io_depth = atoi(optarg);
+            if (io_depth < 1 || io_depth > MAX_IO_DEPTH)
+            {
+                printf("Error: I/O depth must be between 1 and %d\n", MAX_IO_DEPTH);
+                return 1;
+            }
+            break;
+        case 'R':
+            io_threads = atoi(optarg);
+            if (io_threads < 1)
+            {
+                printf("Error: number of I/O threads must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'D':
+            working_set_window = atoi(optarg);
+            if (working_set_window < 1)
+            {
+                printf("Error: working-set window must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'Q':
+            pff_threshold = atoi(optarg);
+            if (pff_threshold < 1)
+            {
+                printf("Error: PFF threshold must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'V':
+            writable_store = 1;
+            break;
+        case 'l':
+            l2_tlb_size = atoi(optarg);
+            if (l2_tlb_size < 0 || l2_tlb_size > MAX_TLB_SIZE)
+            {
+                printf("Error: L2 TLB size must be between 0 and %d\n", MAX_TLB_SIZE);
+                return 1;
+            }
+            break;
+        case 'k':
+            l2_tlb_ways = atoi(optarg);
+            if (l2_tlb_ways < 0)
+            {
+                printf("Error: L2 TLB associativity cannot be negative\n");
+                return 1;
+            }
+            break;
+        case 'i':
+            tlb_inclusion = -1;
+            for (int i = 0; i < (int)(sizeof(tlb_inclusion_names) / sizeof(tlb_inclusion_names[0])); i++)
+            {
+                if (strcmp(optarg, tlb_inclusion_names[i]) == 0)
+                {
+                    tlb_inclusion = i;
+                }
+            }
+            if (tlb_inclusion < 0)
+            {
+                printf("Error: TLB inclusion must be inclusive or exclusive\n");
+                return 1;
+            }
+            break;
+        case 'c':
+        case 'd':
+        case 'e':
+        case 'Y':
+        case OPTION_IPI_LATENCY:
+        case OPTION_ZSWAP_LATENCY:
+        {
+            int latency = atoi(optarg);
+            if (latency < 0)
+            {
+                printf("Error: latencies cannot be negative\n");
+                return 1;
+            }
+            *(option == 'c'                  ? &l1_tlb_latency
+              : option == 'd'                ? &l2_tlb_latency
+              : option == 'e'                ? &fault_latency
+              : option == 'Y'                ? &walk_latency
+              : option == OPTION_IPI_LATENCY ? &ipi_latency
+                                             : &zswap_latency) = latency;
+            break;
+        }
+        case 'g':
+        {
+            unsigned long long huge_page_size = parse_size(optarg);
+            if (huge_page_size == 0 || (huge_page_size & (huge_page_size - 1)) != 0)
+            {
+                printf("Error: huge page size must be a power of two\n");
+                return 1;
+            }
+            huge_page_bits = __builtin_ctzll(huge_page_size);
+            break;
+        }
+        case 'u':
+            if (strcmp(optarg, "separate") != 0 && strcmp(optarg, "unified") != 0)
+            {
+                printf("Error: huge-page TLB must be separate or unified\n");
+                return 1;
+            }
+            huge_tlb_separate = strcmp(optarg, "separate") == 0;
+            break;
+        case 'z':
+            huge_tlb_size = atoi(optarg);
+            if (huge_tlb_size < 1 || huge_tlb_size > MAX_TLB_SIZE)
+            {
+                printf("Error: huge-page TLB size must be between 1 and %d\n", MAX_TLB_SIZE);
+                return 1;
+            }
+            break;
+        case 'O':
+            promote_threshold = atoi(optarg);
+            if (promote_threshold < 1)
+            {
+                printf("Error: promotion threshold must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'B':
+            writeback_batch = atoi(optarg);
+            if (writeback_batch < 1 || writeback_batch > MAX_WRITEBACK_BATCH)
+            {
+                printf("Error: write-back batch must be between 1 and %d\n", MAX_WRITEBACK_BATCH);
+                return 1;
+            }
+            break;
+        case 'I':
+            interval_length = atoi(optarg);
+            if (interval_length < 1)
+            {
+                printf("Error: interval must be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'H':
+            thrashing_threshold = atof(optarg);
+            if (thrashing_threshold <= 0 || thrashing_threshold > 1)
+            {
+                printf("Error: thrashing threshold must be a fault rate in (0, 1]\n");
+                return 1;
+            }
+            break;
+        case OPTION_GENERATE:
+            generate_pattern = -1;
+            for (int i = 0; i < (int)(sizeof(pattern_names) / sizeof(pattern_names[0])); i++)
+            {
+                if (strcmp(optarg, pattern_names[i]) == 0)
+                {
+                    generate_pattern = i;
+                }
+            }
+            if (generate_pattern < 0)
+            {
+                printf("Error: trace pattern must be uniform, zipf, sequential, stride, loop or phase\n");
+                return 1;
+            }
+            break;
+        case OPTION_TRACE_LENGTH:
+            trace_length = parse_size(optarg);
+            if (trace_length == 0)
+            {
+                printf("Error: trace length must be a positive number of accesses\n");
+                return 1;
+            }
+            break;
+        case OPTION_SEED:
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case OPTION_FOOTPRINT:
+            footprint = parse_size(optarg);
+            if (footprint == 0 || footprint > MAX_FOOTPRINT)
+            {
+                printf("Error: footprint must be between 1 and %d pages\n", MAX_FOOTPRINT);
+                return 1;
+            }
+            break;
+        case OPTION_ZIPF_SKEW:
+            zipf_skew = atof(optarg);
+            if (zipf_skew < 0)
+            {
+                printf("Error: Zipf skew cannot be negative\n");
+                return 1;
+            }
+            break;
+        case OPTION_STRIDE:
+            stride = parse_size(optarg);
+            if (stride == 0)
+            {
+                printf("Error: stride must be at least one page\n");
+                return 1;
+            }
+            break;
+        case OPTION_BENCH:
+            bench_path = optarg;
+            break;
+        case OPTION_BENCH_FORMAT:
+            bench_format = -1;
+            for (int i = 0; i < (int)(sizeof(bench_format_names) / sizeof(bench_format_names[0])); i++)
+            {
+                if (strcmp(optarg, bench_format_names[i]) == 0)
+                {
+                    bench_format = i;
+                }
+            }
+            if (bench_format < 0)
+            {
+                printf("Error: benchmark format must be csv or json\n");
+                return 1;
+            }
+            break;
+        case OPTION_BENCH_LABEL:
+            bench_label = optarg;
+            break;
+        case OPTION_WRITE_RATIO:
+            write_ratio = atof(optarg);
+            if (write_ratio < 0 || write_ratio > 1)
+            {
+                printf("Error: write ratio must be between 0 and 1\n");
+                return 1;
+            }
+            break;
+        case OPTION_REFERENCE:
+            reference = 1;
+            break;
+        case OPTION_INTERVAL_OUTPUT:
+            interval_output_path = optarg;
+            break;
+        case OPTION_INTERVAL_FORMAT:
+            interval_format = -1;
+            for (int i = 0; i < (int)(sizeof(interval_format_names) / sizeof(interval_format_names[0])); i++)
+            {
+                if (strcmp(optarg, interval_format_names[i]) == 0)
+                {
+                    interval_format = i;
+                }
+            }
+            if (interval_format < 0)
+            {
+                printf("Error: interval format must be csv or binary\n");
+                return 1;
+            }
+            break;
+        case OPTION_SAMPLE:
+            sample_mode = -1;
+            for (int i = 0; i < (int)(sizeof(sample_mode_names) / sizeof(sample_mode_names[0])); i++)
+            {
+                if (strcmp(optarg, sample_mode_names[i]) == 0)
+                {
+                    sample_mode = i;
+                }
+            }
+            if (sample_mode < 0)
+            {
+                printf("Error: sampling mode must be none, shards or interval\n");
+                return 1;
+            }
+            break;
+        case OPTION_SAMPLE_RATE:
+            sample_rate = atof(optarg);
+            if (sample_rate <= 0 || sample_rate > 1)
+            {
+                printf("Error: sample rate must be greater than 0 and at most 1\n");
+                return 1;
+            }
+            break;
+        case OPTION_SAMPLE_WINDOW:
+            sample_window = parse_size(optarg);
+            if (sample_window == 0)
+            {
+                printf("Error: sample window must be a positive number of accesses\n");
+                return 1;
+            }
+            break;
+        case OPTION_CHECKPOINT:
+            checkpoint_path = optarg;
+            break;
+        case OPTION_CHECKPOINT_AT:
+            checkpoint_at = parse_size(optarg);
+            if (checkpoint_at == 0)
+            {
+                printf("Error: the checkpoint must be at a positive access index\n");
+                return 1;
+            }
+            break;
+        case OPTION_RESTORE:
+            restore_path = optarg;
+            break;
+        case OPTION_ZSWAP_POOL:
+            zswap_pool_size = parse_size(optarg);
+            if (zswap_pool_size == 0)
+            {
+                printf("Error: zswap pool size must be a positive number of bytes\n");
+                return 1;
+            }
+            break;
+        case OPTION_CPUS:
+            cpus = atoi(optarg);
+            if (cpus < 1 || cpus > MAX_CPUS)
+            {
+                printf("Error: number of CPUs must be between 1 and %d\n", MAX_CPUS);
+                return 1;
+            }
+            break;
+        case OPTION_WARM_UP:
+            warm_up = (long long)parse_size(optarg);
+            if (warm_up == 0 && strcmp(optarg, "0") != 0)
+            {
+                printf("Error: warm-up must be a number of accesses\n");
+                return 1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (convert_path != NULL && argc - optind == 1)
+    {
+        Trace_reader trace;
+        int status = open_trace(&trace, argv[optind], trace_format) == 0 && convert_trace(&trace, convert_path, trace_width) == 0 ? 0 : 1;
+        close_trace(&trace);
+        return status;
+    }
+
+    if (argc - optind != (miss_ratio_curve || generate_pattern >= 0 ? 1 : 2))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char *address_file = argv[optind];
+    Replacement_policy *policies[MAX_SWEEP_VALUES];
+    int policy_count = 0;
+
+    if (init_geometry(offset_bits, virtual_address_bits) != 0)
+    {
+        return 1;
+    }
+    if (process_count > 0 && (unsigned int)process_count > geometry.asid_limit)
+    {
+        printf("Error: this geometry leaves room for at most %u processes\n", geometry.asid_limit);
+        return 1;
+    }
+    if (huge_page_bits != 0 && (huge_page_bits <= offset_bits || huge_page_bits > MAX_HUGE_PAGE_BITS || huge_page_bits - offset_bits > geometry.page_number_bits))
+    {
+        printf("Error: huge pages must be larger than a page, at most %d MiB and fit in the address space\n", 1 << (MAX_HUGE_PAGE_BITS - 20));
+        return 1;
+    }
+    if (generate_pattern >= 0)
+    {
+        return generate_trace(generate_pattern, address_file, trace_length, seed, footprint, zipf_skew, stride, write_ratio) == 0 ? 0 : 1;
+    }
+    if (miss_ratio_curve)
+    {
+        Trace_reader trace;
+        Output_writer *output_file;
+        if (open_trace(&trace, address_file, trace_format) != 0 || (output_file = open_output(output_path)) == NULL)
+        {
+            return 1;
+        }
+        int status = run_stack_distance(&trace, process_count > 0 ? (unsigned int)process_count : geometry.asid_limit, miss_ratio_curve_max, output_file);
+        close_trace(&trace);
+        return close_output(output_file) != 0 || status != 0 ? 1 : 0;
+    }
+
+    for (char *name = strtok(argv[optind + 1], ","); name != NULL; name = strtok(NULL, ","))
+    {
+        if (policy_count == MAX_SWEEP_VALUES || (policies[policy_count++] = find_replacement_policy(name)) == NULL)
+        {
+            printf("Error: unknown replacement algorithm\n");
+            return 1;
+        }
+    }
+    if (policy_count == 0)
+    {
+        printf("Error: unknown replacement algorithm\n");
+        return 1;
+    }
+    for (int i = 0; i < frame_count; i++)
+    {
+        if (frame_allocation == FRAME_ALLOCATION_LOCAL && (process_count == 0 || process_count > frame_values[i]))
+        {
+            printf("Error: local frame allocation needs --processes, with at least one frame per process\n");
+            return 1;
+        }
+    }
+    unsigned int process_limit = process_count > 0 ? (unsigned int)process_count : geometry.asid_limit;
+    Simulator_config config = {policies[0], frame_values[0], tlb_values[0], tlb_associativity, tlb_policy, tlb_probe_name,
+                               frame_allocation, process_count, tlb_flush_on_switch, working_set_window, pff_threshold,
+                               interval_length, thrashing_threshold, prefetch, prefetch_degree};
+
+    int job_count = policy_count * frame_count * tlb_count;
+    int sampling = sample_mode != SAMPLE_NONE || warm_up > 0;
+    if (sampling && (job_count > 1 || reference))
+    {
+        printf("Error: --sample and --warm-up apply to a single run, without --reference\n");
+        return 1;
+    }
+    if (sample_mode != SAMPLE_NONE && (config.policy->needs_next_use || interval_length > 0))
+    {
+        printf("Error: sampled runs skip accesses, which rules out opt and --interval\n");
+        return 1;
+    }
+    if (sample_mode == SAMPLE_SHARDS && (prefetch != PREFETCH_NONE || huge_page_bits != 0 || l2_tlb_size > 0 || async_io != ASYNC_IO_OFF ||
+                                         frame_allocation == FRAME_ALLOCATION_WORKING_SET || frame_allocation == FRAME_ALLOCATION_PFF))
+    {
+        printf("Error: shards sampling breaks up the spatial and temporal neighbours that prefetching, huge pages, the L2 TLB,\n");
+        printf("       asynchronous I/O and working-set or PFF allocation rely on\n");
+        return 1;
+    }
+    if (sample_mode == SAMPLE_SHARDS)
+    {
+        scale_sampled_config(&config, sample_rate);
+        zswap_pool_size = zswap_pool_size > 0 ? (size_t)ceil(zswap_pool_size * sample_rate) : 0;
+        if (frame_allocation == FRAME_ALLOCATION_LOCAL && process_count > config.frames)
+        {
+            printf("Error: local frame allocation needs at least one sampled frame per process\n");
+            return 1;
+        }
+    }
+    if ((checkpoint_path != NULL) != (checkpoint_at > 0))
+    {
+        printf("Error: --checkpoint and --checkpoint-at go together\n");
+        return 1;
+    }
+    if ((checkpoint_path != NULL || restore_path != NULL) &&
+        (job_count > 1 || reference || sampling || huge_page_bits != 0 || async_io != ASYNC_IO_OFF || interval_length > 0 || writable_store ||
+         zswap_pool_size > 0))
+    {
+        printf("Error: checkpoints cover a single run without sampling, huge pages, asynchronous I/O, intervals, a\n");
+        printf("       writable store or zswap\n");
+        return 1;
+    }
+    if (sample_mode == SAMPLE_INTERVAL && sample_window >= (unsigned long long)ceil(sample_window / sample_rate))
+    {
+        printf("Error: interval sampling needs a rate below 1\n");
+        return 1;
+    }
+    if (reference && (job_count > 1 || strcmp(config.policy->name, "arc") == 0 || tlb_policy == TLB_REPLACEMENT_RANDOM ||
+                      frame_allocation != FRAME_ALLOCATION_GLOBAL || prefetch != PREFETCH_NONE || async_io != ASYNC_IO_OFF ||
+                      huge_page_bits != 0 || l2_tlb_size > 0 || interval_length > 0 || writable_store || zswap_pool_size > 0))
+    {
+        printf("Error: --reference runs one configuration of the plain machine: no arc, random TLB replacement, huge pages,\n");
+        printf("       L2 TLB, prefetching, asynchronous I/O, intervals, writable store, zswap or allocation other than global\n");
+        return 1;
+    }
+    if (cpus > 0 && (job_count > 1 || reference || sampling || checkpoint_path != NULL || restore_path != NULL || bench_path != NULL ||
+                     strcmp(config.policy->name, "clock") != 0 || page_table_type != &page_table_types[0] ||
+                     frame_allocation != FRAME_ALLOCATION_GLOBAL || prefetch != PREFETCH_NONE || async_io != ASYNC_IO_OFF ||
+                     huge_page_bits != 0 || l2_tlb_size > 0 || interval_length > 0 || writable_store || zswap_pool_size > 0))
+    {
+        printf("Error: --cpus runs one clock configuration on its own sharded page table: no sweep, --reference, sampling,\n");
+        printf("       checkpoints, --bench, --page-table, huge pages, L2 TLB, prefetching, asynchronous I/O, intervals,\n");
+        printf("       writable store, zswap or allocation other than global\n");
+        return 1;
+    }
+    if (cpus > 0 && config.frames <= cpus)
+    {
+        printf("Error: --cpus needs more frames than CPUs, since each CPU keeps one frame pinned\n");
+        return 1;
+    }
+
+    Trace_reader trace;
+    if (open_trace(&trace, address_file, trace_format) != 0)
+    {
+        return 1;
+    }
+
+    Output_writer *output_file = open_output(output_path);
+    if (output_file == NULL)
+    {
+        printf("Error: could not write output file\n");
+        return 0;
+    }
+    if (open_backing_store(backing_store_path) != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+
+    if (reference)
+    {
+        int status = run_reference(&trace, process_limit, &config, output_file, !stats_only);
+        close_trace(&trace);
+        close_backing_store();
+        return close_output(output_file) != 0 || status != 0 ? 1 : 0;
+    }
+    if (cpus > 0)
+    {
+        int status = run_smp(&trace, process_limit, &config, cpus, output_file);
+        close_trace(&trace);
+        close_backing_store();
+        return close_output(output_file) != 0 || status != 0 ? 1 : 0;
+    }
+    if (job_count > 1 && bench_path != NULL)
+    {
+        printf("Error: --bench records a single run; the bench make target runs one process per configuration\n");
+        close_backing_store();
+        close_output(output_file);
+        return 1;
+    }
+    if (interval_output_path != NULL && (job_count > 1 || interval_length == 0))
+    {
+        printf("Error: --interval-output streams the samples of a single run with --interval\n");
+        close_backing_store();
+        close_output(output_file);
+        return 1;
+    }
+    if (job_count > 1 && writable_store)
+    {
+        printf("Error: --writable-store cannot be combined with a sweep\n");
+        close_backing_store();
+        close_output(output_file);
+        return 1;
+    }
+    if (job_count > 1)
+    {
+        Sweep_job *jobs = calloc(job_count, sizeof(Sweep_job));
+        if (jobs == NULL)
+        {
+            printf("Error: could not allocate sweep\n");
+            close_output(output_file);
+            return 1;
+        }
+        for (int i = 0; i < job_count; i++)
+        {
+            jobs[i].config = config;
+            jobs[i].config.policy = policies[i / (frame_count * tlb_count)];
+            jobs[i].config.frames = frame_values[i / tlb_count % frame_count];
+            jobs[i].config.tlb_size = tlb_values[i % tlb_count];
+        }
+        if (threads == 0)
+        {
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = online > 0 ? (int)online : 1;
+        }
+        int status = run_sweep(&trace, process_limit, jobs, job_count, threads < job_count ? threads : job_count, output_file);
+        free(jobs);
+        close_trace(&trace);
+        close_backing_store();
+        if (close_output(output_file) != 0 || status != 0)
+        {
+            return 1;
+        }
+        return 0;
+    }
+
+    Simulator simulator;
+    if (init_simulator(&simulator, &config) != 0 ||
+        (interval_output_path != NULL && (simulator.interval_writer = open_interval_writer(interval_output_path, interval_format)) == NULL))
+    {
+        free_simulator(&simulator);
+        close_output(output_file);
+        return 1;
+    }
+
+    Address *chunk = malloc(ADDRESS_CHUNK_SIZE * sizeof(Address));
+    unsigned long long *next_use = NULL;
+    int count;
+    Sampler sampler;
+
+    if (chunk == NULL)
+    {
+        printf("Error: could not allocate address buffer\n");
+        close_output(output_file);
+        return 1;
+    }
+    if (sampling &&
+        init_sampler(&sampler, sample_mode, sample_rate, sample_window, warm_up >= 0 ? (unsigned long long)warm_up : sample_mode == SAMPLE_INTERVAL ? sample_window : 0) != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+    if (config.policy->needs_next_use)
+    {
+        next_use = compute_next_use(&trace, process_limit, chunk);
+        if (next_use == NULL)
+        {
+            close_output(output_file);
+            return 1;
+        }
+        simulator.next_use = next_use;
+    }
+    unsigned long long restored_accesses = 0;
+    if (restore_path != NULL && restore_checkpoint(&simulator, restore_path, &restored_accesses) != 0)
+    {
+        free_simulator(&simulator);
+        close_output(output_file);
+        return 1;
+    }
+    if (checkpoint_path != NULL && checkpoint_at <= restored_accesses)
+    {
+        printf("Error: --checkpoint-at must come after the restored checkpoint\n");
+        close_output(output_file);
+        return 1;
+    }
+
+    /* position counts the trace's accesses before the chunk; the restored ones are skipped, a checkpoint ends the run. */
+    unsigned long long position = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    INSTRUMENT_BEGIN_RUN();
+    while ((checkpoint_path == NULL || position < checkpoint_at) &&
+           (count = extract_page_number_and_offset(&trace, process_limit, chunk, ADDRESS_CHUNK_SIZE)) > 0)
+    {
+        int first = 0;
+        if (position < restored_accesses)
+        {
+            first = restored_accesses - position < (unsigned long long)count ? (int)(restored_accesses - position) : count;
+        }
+        if (checkpoint_path != NULL && position + count > checkpoint_at)
+        {
+            count = (int)(checkpoint_at - position);
+        }
+        position += (unsigned long long)count;
+        if (first < count &&
+            (sampling ? sample_chunk(&simulator, &sampler, chunk + first, count - first, stats_only ? NULL : output_file)
+                      : check_tlb(&simulator, chunk + first, count - first, stats_only ? NULL : output_file)) != 0)
+        {
+            close_output(output_file);
+            return 1;
+        }
+    }
+    free(chunk);
+    if (trace.error)
+    {
+        close_output(output_file);
+        return 1;
+    }
+    if (position < restored_accesses)
+    {
+        printf("Error: the trace ends before the access the checkpoint was taken at\n");
+        close_output(output_file);
+        return 1;
+    }
+    if (checkpoint_path != NULL && save_checkpoint(&simulator, checkpoint_path) != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+    double seconds = seconds_since(&start);
+    INSTRUMENT_END_RUN();
+    int report_processes = trace.process_ids || process_count > 0;
+    close_trace(&trace);
+    sync_store(&simulator);
+    if (simulator.interval_position > 0 && record_interval(&simulator) != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+    int interval_status = close_interval_writer(simulator.interval_writer);
+    simulator.interval_writer = NULL;
+    if (interval_status != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+
+    write_report(&simulator, output_file, report_processes);
+    if (sampling)
+    {
+        write_sample_stats(&sampler, &config, output_file);
+        free_sampler(&sampler);
+    }
+    if (bench_path != NULL && write_bench_record(&simulator, bench_path, bench_format, bench_label, address_file, seconds) != 0)
+    {
+        close_output(output_file);
+        return 1;
+    }
+
+    free_simulator(&simulator);
+    free(next_use);
+    close_backing_store();
+    if (close_output(output_file) != 0)
+    {
+        printf("Error: could not write output file\n");
+        return 1;
+    }
     return 0;
 }